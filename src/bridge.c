@@ -0,0 +1,207 @@
+#include "bridge.h"
+#include "main.h"
+#include "usart.h"
+#include <string.h>
+
+// Host TX ring must absorb the whole GPS stream plus telemetry while a u-center / CASIC tool is connected
+#define HOST_TX_BUFFER_SIZE     512
+#define GPS_TX_BUFFER_SIZE      256
+#define HOST_RX_BUFFER_SIZE     128
+// One second of telemetry sentences, telemetry_run() keeps it under about 225 bytes
+#define INJECT_BUFFER_SIZE      256
+
+typedef struct {
+    UART_HandleTypeDef* huart;
+    uint8_t*            buffer;
+    uint32_t            size;
+    // Total number of bytes queued / sent, they only wrap at 2^32
+    volatile uint32_t   head;
+    volatile uint32_t   tail;
+    // Size of the DMA transfer in flight, 0 when the port is idle
+    volatile uint32_t   sending;
+} tx_ring_t;
+
+bridge_stats_t bridge_stats = { 0 };
+
+static uint8_t   host_tx_buffer[HOST_TX_BUFFER_SIZE];
+static uint8_t   gps_tx_buffer[GPS_TX_BUFFER_SIZE];
+static tx_ring_t host_tx = { &huart2, host_tx_buffer, HOST_TX_BUFFER_SIZE, 0, 0, 0 };
+static tx_ring_t gps_tx  = { &huart3, gps_tx_buffer, GPS_TX_BUFFER_SIZE, 0, 0, 0 };
+
+// Host reception works like the GPS one: circular DMA ring, write position published by UART events
+static uint8_t           host_rx_ring[HOST_RX_BUFFER_SIZE];
+static volatile uint32_t host_rx_written  = 0;
+static uint32_t          host_rx_read     = 0;
+static uint16_t          host_rx_last_pos = 0;
+static volatile bool     host_rx_restart  = false;
+
+static char   inject_buffer[INJECT_BUFFER_SIZE];
+static size_t inject_size = 0;
+
+// Start the DMA transfer of the next contiguous chunk, must be called with interrupts disabled or from the TX complete interrupt
+static void tx_ring_kick(tx_ring_t* ring)
+{
+    if (ring->sending || ring->head == ring->tail) {
+        return;
+    }
+    uint32_t index = ring->tail % ring->size;
+    uint32_t len   = ring->head - ring->tail;
+    if (index + len > ring->size) {
+        len = ring->size - index;
+    }
+    // If the UART is busy (locked by the main loop) the transfer is retried by bridge_run()
+    if (HAL_UART_Transmit_DMA(ring->huart, ring->buffer + index, len) == HAL_OK) {
+        ring->sending = len;
+    }
+}
+
+static void tx_ring_kick_safe(tx_ring_t* ring)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    tx_ring_kick(ring);
+    __set_PRIMASK(primask);
+}
+
+static bool tx_ring_write(tx_ring_t* ring, const uint8_t* data, size_t len)
+{
+    if (len > ring->size - (ring->head - ring->tail)) {
+        // Never split a chunk, drop it whole
+        return false;
+    }
+    uint32_t index = ring->head % ring->size;
+    size_t   first = ring->size - index;
+    if (first >= len) {
+        memcpy(ring->buffer + index, data, len);
+    } else {
+        memcpy(ring->buffer + index, data, first);
+        memcpy(ring->buffer, data + first, len - first);
+    }
+    ring->head += len;
+    tx_ring_kick_safe(ring);
+    return true;
+}
+
+static void tx_ring_reset(tx_ring_t* ring)
+{
+    ring->sending = 0;
+    ring->tail    = ring->head;
+}
+
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef* huart)
+{
+    tx_ring_t* ring = (huart == &huart2) ? &host_tx : (huart == &huart3) ? &gps_tx : NULL;
+    if (ring != NULL) {
+        ring->tail += ring->sending;
+        ring->sending = 0;
+        tx_ring_kick(ring);
+    }
+}
+
+static void bridge_start_host_rx()
+{
+    host_rx_written  = 0;
+    host_rx_read     = 0;
+    host_rx_last_pos = 0;
+    host_rx_restart  = false;
+    if (HAL_UARTEx_ReceiveToIdle_DMA(&huart2, host_rx_ring, HOST_RX_BUFFER_SIZE) != HAL_OK) {
+        Error_Handler();
+    }
+}
+
+void bridge_start()
+{
+    // Host reception is (re)started by bridge_run()
+    host_rx_restart = true;
+}
+
+// Called before the UARTs are de-initialized, pending transmissions are lost
+void bridge_stop()
+{
+    tx_ring_reset(&host_tx);
+    tx_ring_reset(&gps_tx);
+    inject_size = 0;
+}
+
+void bridge_host_rx_event(uint16_t pos)
+{
+    uint16_t received = (pos >= host_rx_last_pos) ? (pos - host_rx_last_pos) : (pos + HOST_RX_BUFFER_SIZE - host_rx_last_pos);
+    host_rx_written += received;
+    host_rx_last_pos = (pos >= HOST_RX_BUFFER_SIZE) ? 0 : pos;
+}
+
+void bridge_host_rx_error()
+{
+    bridge_stats.host_rx_errors++;
+    host_rx_restart = true;
+}
+
+void bridge_to_host(const uint8_t* data, size_t len)
+{
+    if (tx_ring_write(&host_tx, data, len)) {
+        bridge_stats.to_host += len;
+    } else {
+        bridge_stats.host_overflows += len;
+    }
+}
+
+bool bridge_inject_to_host(const char* sentence, size_t len)
+{
+    if (len > INJECT_BUFFER_SIZE - inject_size) {
+        bridge_stats.host_overflows += len;
+        return false;
+    }
+    memcpy(inject_buffer + inject_size, sentence, len);
+    inject_size += len;
+    return true;
+}
+
+void bridge_flush_injected()
+{
+    if (inject_size == 0) {
+        return;
+    }
+    // Keep the sentences until there is room for all of them
+    if (inject_size <= host_tx.size - (host_tx.head - host_tx.tail)) {
+        bridge_to_host((const uint8_t*)inject_buffer, inject_size);
+        inject_size = 0;
+    }
+}
+
+bool bridge_send_to_gps(const uint8_t* data, size_t len)
+{
+    if (tx_ring_write(&gps_tx, data, len)) {
+        bridge_stats.to_gps += len;
+        return true;
+    }
+    bridge_stats.gps_overflows += len;
+    return false;
+}
+
+bool bridge_gps_tx_idle() { return gps_tx.head == gps_tx.tail; }
+
+void bridge_run()
+{
+    if (host_rx_restart) {
+        bridge_start_host_rx();
+    }
+    uint32_t written = host_rx_written;
+    if (written - host_rx_read > HOST_RX_BUFFER_SIZE) {
+        // DMA has lapped the bridge, drop what has been overwritten
+        bridge_stats.host_rx_overruns++;
+        host_rx_read = written;
+    }
+    while (host_rx_read != written) {
+        // Forward host data to the GPS module in at most two contiguous segments
+        uint32_t index = host_rx_read % HOST_RX_BUFFER_SIZE;
+        uint32_t len   = written - host_rx_read;
+        if (index + len > HOST_RX_BUFFER_SIZE) {
+            len = HOST_RX_BUFFER_SIZE - index;
+        }
+        bridge_send_to_gps(host_rx_ring + index, len);
+        host_rx_read += len;
+    }
+    // Restart transfers that could not be started from the TX complete interrupt
+    tx_ring_kick_safe(&host_tx);
+    tx_ring_kick_safe(&gps_tx);
+}
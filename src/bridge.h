@@ -0,0 +1,39 @@
+#ifndef _BRIDGE_H_
+#define _BRIDGE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Bidirectional GPS passthrough between USART3 (GPS module) and USART2 (host)
+// Both directions use DMA: circular reception and chained transmissions from ring buffers, the main loop never waits for a port
+
+typedef struct {
+    uint32_t to_host;           // Bytes queued to the host (GPS stream + telemetry)
+    uint32_t to_gps;            // Bytes queued to the GPS module (host commands + firmware commands)
+    uint32_t host_overflows;    // Bytes dropped because the host TX ring was full
+    uint32_t gps_overflows;     // Bytes dropped because the GPS TX ring was full
+    uint32_t host_rx_overruns;  // Host reception ring lapped before being forwarded
+    uint32_t host_rx_errors;    // Framing / noise / overrun errors on the host port
+} bridge_stats_t;
+
+extern bridge_stats_t bridge_stats;
+
+void bridge_start();
+void bridge_stop();
+void bridge_run();
+
+// GPS to host direction, called by the GPS reader with data straight from its reception ring
+void bridge_to_host(const uint8_t* data, size_t len);
+// Firmware generated sentences are held until the GPS stream is at a sentence boundary so they never split a GPS sentence
+bool bridge_inject_to_host(const char* sentence, size_t len);
+void bridge_flush_injected();
+// Firmware commands to the GPS module
+bool bridge_send_to_gps(const uint8_t* data, size_t len);
+bool bridge_gps_tx_idle();
+
+// UART event hooks
+void bridge_host_rx_event(uint16_t pos);
+void bridge_host_rx_error();
+
+#endif
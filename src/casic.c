@@ -0,0 +1,178 @@
+#include "casic.h"
+#include "bridge.h"
+#include "gps.h"
+#include "ubx.h"
+#include <string.h>
+
+#define CASIC_SYNC_1        0xBA
+#define CASIC_SYNC_2        0xCE
+// Largest payload we send or parse (CFG-TMODE 40)
+#define CASIC_MAX_PAYLOAD   40
+// Anything bigger is taken as a false sync: a wrong baudrate must not make the framer swallow the bytes that follow
+#define CASIC_MAX_LENGTH    CASIC_MAX_PAYLOAD
+
+typedef enum {
+    CASIC_STATE_SYNC_1,
+    CASIC_STATE_SYNC_2,
+    CASIC_STATE_LENGTH_1,
+    CASIC_STATE_LENGTH_2,
+    CASIC_STATE_CLASS,
+    CASIC_STATE_ID,
+    CASIC_STATE_PAYLOAD,
+    CASIC_STATE_CHECKSUM
+} casic_state;
+
+casic_stats_t  casic_stats  = { 0 };
+casic_config_t casic_config = { 0 };
+
+static casic_state casic_rx_state = CASIC_STATE_SYNC_1;
+static uint8_t     casic_rx_class;
+static uint8_t     casic_rx_id;
+static uint16_t    casic_rx_length;
+static uint16_t    casic_rx_count;
+static uint32_t    casic_rx_checksum;
+static uint32_t    casic_rx_expected;
+static uint8_t     casic_rx_payload[CASIC_MAX_PAYLOAD];
+
+static inline uint16_t casic_u16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+static inline uint32_t casic_u32(const uint8_t* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+static inline void     casic_put_u16(uint8_t* p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static inline void     casic_put_u32(uint8_t* p, uint32_t v) { p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24; }
+
+static void casic_handle_frame()
+{
+    const uint8_t* p = casic_rx_payload;
+    switch (casic_rx_class) {
+        case CASIC_CLASS_ACK:
+            if (casic_rx_id == CASIC_ACK_ACK) {
+                casic_stats.acks++;
+            } else if (casic_rx_id == CASIC_ACK_NAK) {
+                casic_stats.naks++;
+            }
+            // clsID U1, msgID U1 of the acknowledged message
+            if (casic_rx_length >= 2) {
+                gps_command_acknowledged(p[0], p[1], casic_rx_id == CASIC_ACK_ACK);
+            }
+            break;
+        case CASIC_CLASS_TIM:
+            if (casic_rx_id == CASIC_TIM_TP) {
+                casic_stats.tim_tp++;
+            }
+            break;
+        case CASIC_CLASS_CFG:
+            // Poll answers
+            if (casic_rx_id == CASIC_CFG_PRT && casic_rx_length >= 8) {
+                // portID U1, protoMask U1, mode U2, baudRate U4
+                casic_config.proto_mask = p[1];
+                casic_config.baudrate   = casic_u32(p + 4);
+            } else if (casic_rx_id == CASIC_CFG_TP && casic_rx_length >= 16) {
+                // interval U4 (us), width U4 (us), enable U1, polar I1, timeRef U1, timeSource U1, userDelay R4
+                casic_config.tp_interval = casic_u32(p);
+                casic_config.tp_width    = casic_u32(p + 4);
+                casic_config.tp_enable   = p[8];
+            } else if (casic_rx_id == CASIC_CFG_MSG && casic_rx_length >= 4) {
+                // clsID U1, msgID U1, rate U2
+                if (p[0] == CASIC_CLASS_NMEA && p[1] < CASIC_NMEA_MAX) {
+                    uint16_t rate                 = casic_u16(p + 2);
+                    casic_config.nmea_rate[p[1]] = (rate > 0xFF) ? 0xFF : rate;
+                }
+            }
+            break;
+    }
+}
+
+bool casic_ingest(uint8_t c)
+{
+    switch (casic_rx_state) {
+        case CASIC_STATE_SYNC_1:
+            // A sync byte inside a UBX frame is UBX data
+            if (c != CASIC_SYNC_1 || !ubx_idle()) {
+                return false;
+            }
+            casic_rx_state = CASIC_STATE_SYNC_2;
+            return true;
+        case CASIC_STATE_SYNC_2:
+            if (c != CASIC_SYNC_2) {
+                // Not a CASIC frame, let NMEA have this byte
+                casic_rx_state = CASIC_STATE_SYNC_1;
+                return false;
+            }
+            casic_rx_state = CASIC_STATE_LENGTH_1;
+            break;
+        case CASIC_STATE_LENGTH_1:
+            casic_rx_length = c;
+            casic_rx_state  = CASIC_STATE_LENGTH_2;
+            break;
+        case CASIC_STATE_LENGTH_2:
+            casic_rx_length |= c << 8;
+            if (casic_rx_length > CASIC_MAX_LENGTH) {
+                casic_stats.overlong++;
+                casic_rx_state = CASIC_STATE_SYNC_1;
+                break;
+            }
+            casic_rx_state = CASIC_STATE_CLASS;
+            break;
+        case CASIC_STATE_CLASS:
+            casic_rx_class = c;
+            casic_rx_state = CASIC_STATE_ID;
+            break;
+        case CASIC_STATE_ID:
+            casic_rx_id = c;
+            // Checksum starts with (id << 24) + (class << 16) + length, then adds the payload as little endian 32 bit words
+            casic_rx_checksum = ((uint32_t)casic_rx_id << 24) + ((uint32_t)casic_rx_class << 16) + casic_rx_length;
+            casic_rx_count    = 0;
+            casic_rx_expected = 0;
+            casic_rx_state    = casic_rx_length ? CASIC_STATE_PAYLOAD : CASIC_STATE_CHECKSUM;
+            break;
+        case CASIC_STATE_PAYLOAD:
+            casic_rx_payload[casic_rx_count] = c;
+            casic_rx_checksum += (uint32_t)c << (8 * (casic_rx_count & 3));
+            if (++casic_rx_count == casic_rx_length) {
+                casic_rx_count = 0;
+                casic_rx_state = CASIC_STATE_CHECKSUM;
+            }
+            break;
+        case CASIC_STATE_CHECKSUM:
+            casic_rx_expected |= (uint32_t)c << (8 * casic_rx_count);
+            if (++casic_rx_count < 4) {
+                break;
+            }
+            casic_rx_state = CASIC_STATE_SYNC_1;
+            if (casic_rx_expected != casic_rx_checksum) {
+                casic_stats.bad_checksum++;
+            } else {
+                casic_stats.good++;
+                casic_handle_frame();
+            }
+            break;
+    }
+    return true;
+}
+
+void casic_reset() { casic_rx_state = CASIC_STATE_SYNC_1; }
+
+bool casic_idle() { return casic_rx_state == CASIC_STATE_SYNC_1; }
+
+// An empty payload polls the current value of a configuration message
+bool casic_send(uint8_t msg_class, uint8_t msg_id, const uint8_t* payload, uint16_t len)
+{
+    uint8_t frame[CASIC_MAX_PAYLOAD + 10];
+    // Payload is made of 32 bit words
+    if (len > CASIC_MAX_PAYLOAD || (len & 3)) {
+        return false;
+    }
+    frame[0] = CASIC_SYNC_1;
+    frame[1] = CASIC_SYNC_2;
+    casic_put_u16(frame + 2, len);
+    frame[4] = msg_class;
+    frame[5] = msg_id;
+    if (len) {
+        memcpy(frame + 6, payload, len);
+    }
+    uint32_t checksum = ((uint32_t)msg_id << 24) + ((uint32_t)msg_class << 16) + len;
+    for (uint16_t i = 0; i < len; i += 4) {
+        checksum += casic_u32(payload + i);
+    }
+    casic_put_u32(frame + 6 + len, checksum);
+    return bridge_send_to_gps(frame, len + 10);
+}
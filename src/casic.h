@@ -0,0 +1,56 @@
+#ifndef _CASIC_H_
+#define _CASIC_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// CASIC binary protocol (ATGM336H / AT6558), parsed from the same byte stream as NMEA
+
+#define CASIC_CLASS_TIM     0x02
+#define CASIC_CLASS_ACK     0x05
+#define CASIC_CLASS_CFG     0x06
+#define CASIC_CLASS_NMEA    0x4E
+
+#define CASIC_TIM_TP        0x00
+#define CASIC_ACK_NAK       0x00
+#define CASIC_ACK_ACK       0x01
+#define CASIC_CFG_PRT       0x00
+#define CASIC_CFG_MSG       0x01
+#define CASIC_CFG_TP        0x03
+
+// NMEA message ids in CASIC_CLASS_NMEA, same order as the $PCAS03 fields
+typedef enum { CASIC_NMEA_GGA, CASIC_NMEA_GLL, CASIC_NMEA_GSA, CASIC_NMEA_GSV, CASIC_NMEA_RMC, CASIC_NMEA_VTG, CASIC_NMEA_ZDA, CASIC_NMEA_MAX } casic_nmea_id;
+
+typedef struct {
+    uint32_t good;
+    uint32_t bad_checksum;
+    uint32_t overlong;
+    uint32_t acks;
+    uint32_t naks;
+    uint32_t tim_tp;
+} casic_stats_t;
+
+// Module configuration, as read back with CFG polls
+typedef struct {
+    uint32_t baudrate;
+    uint8_t  proto_mask;
+    uint32_t tp_interval;
+    uint32_t tp_width;
+    uint8_t  tp_enable;
+    uint8_t  nmea_rate[CASIC_NMEA_MAX];
+} casic_config_t;
+
+extern casic_stats_t  casic_stats;
+extern casic_config_t casic_config;
+
+// Feed one received byte, returns true when the byte belongs to a CASIC frame and must not be given to the NMEA framer.
+// A frame only starts while the UBX framer is idle, the framer in the middle of a frame gets all its bytes
+bool casic_ingest(uint8_t c);
+// Drop a partly received frame (UART restart or baudrate change)
+void casic_reset();
+// True when no frame is being received
+bool casic_idle();
+
+bool casic_send(uint8_t msg_class, uint8_t msg_id, const uint8_t* payload, uint16_t len);
+
+#endif
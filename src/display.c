@@ -0,0 +1,181 @@
+#include "display.h"
+#include "main.h"
+#include <string.h>
+
+// HD44780 commands, in 4 bit mode (set by LCD_Init)
+#define DISPLAY_SET_CGRAM   0x40
+#define DISPLAY_SET_DDRAM   0x80
+#define DISPLAY_ROW_ADDRESS 0x40
+// Queue entries: one byte for the controller, RS set for data
+#define DISPLAY_QUEUE_SIZE  128
+#define DISPLAY_DATA        0x100
+
+// Wanted content, and content of the LCD as of the last flush
+static uint8_t display_cells[DISPLAY_ROWS][DISPLAY_COLUMNS];
+static uint8_t display_lcd_cells[DISPLAY_ROWS][DISPLAY_COLUMNS];
+static uint8_t display_glyphs[DISPLAY_GLYPHS][DISPLAY_GLYPH_SIZE];
+static uint8_t display_lcd_glyphs[DISPLAY_GLYPHS][DISPLAY_GLYPH_SIZE];
+// Use stamp of each glyph slot, for least recently used replacement
+static uint32_t display_glyph_use[DISPLAY_GLYPHS];
+static uint32_t display_glyph_clock = 0;
+// False until the LCD content is known
+static bool    display_synced = false;
+
+// Filled by display_flush(), drained by the SysTick interrupt one byte per ms (the controller needs 37 us per byte)
+static uint16_t          display_queue[DISPLAY_QUEUE_SIZE];
+static volatile uint32_t display_queue_head = 0;
+static volatile uint32_t display_queue_tail = 0;
+
+void display_init()
+{
+    // Write only
+    HAL_GPIO_WritePin(LCD_RW_GPIO_Port, LCD_RW_Pin, GPIO_PIN_RESET);
+    display_synced = false;
+    display_clear();
+}
+
+void display_clear() { memset(display_cells, ' ', sizeof(display_cells)); }
+
+void display_puts(uint8_t x, uint8_t y, const char* str)
+{
+    if (y >= DISPLAY_ROWS) {
+        return;
+    }
+    while (*str && x < DISPLAY_COLUMNS) {
+        display_cells[y][x++] = *str++;
+    }
+}
+
+void display_put_custom(uint8_t x, uint8_t y, uint8_t code)
+{
+    if (x < DISPLAY_COLUMNS && y < DISPLAY_ROWS) {
+        display_cells[y][x] = code;
+    }
+}
+
+uint8_t display_get(uint8_t x, uint8_t y) { return (x < DISPLAY_COLUMNS && y < DISPLAY_ROWS) ? display_cells[y][x] : ' '; }
+
+static bool display_glyph_shown(uint8_t code)
+{
+    return memchr(display_cells, code, sizeof(display_cells)) != NULL;
+}
+
+bool display_put_glyph(uint8_t x, uint8_t y, const uint8_t* bitmap, char fallback)
+{
+    if (x >= DISPLAY_COLUMNS || y >= DISPLAY_ROWS) {
+        return false;
+    }
+    // The replaced cell doesn't hold its slot any more
+    display_cells[y][x] = ' ';
+    uint8_t slot        = DISPLAY_GLYPHS;
+    for (uint8_t code = 0; code < DISPLAY_GLYPHS; code++) {
+        if (memcmp(display_glyphs[code], bitmap, DISPLAY_GLYPH_SIZE) == 0) {
+            slot = code;
+            break;
+        }
+        if (!display_glyph_shown(code) && (slot == DISPLAY_GLYPHS || display_glyph_use[code] < display_glyph_use[slot])) {
+            slot = code;
+        }
+    }
+    if (slot == DISPLAY_GLYPHS) {
+        display_cells[y][x] = fallback;
+        return false;
+    }
+    // Only a changed bitmap is sent by the next flush
+    memcpy(display_glyphs[slot], bitmap, DISPLAY_GLYPH_SIZE);
+    display_glyph_use[slot] = ++display_glyph_clock;
+    display_cells[y][x]     = slot;
+    return true;
+}
+
+// Enable pulse and hold time (> 450 ns)
+static inline void display_delay()
+{
+    for (volatile int i = 0; i < 8; i++) { }
+}
+
+// D4 to D7 share a port
+static void display_write_nibble(uint8_t nibble)
+{
+    uint32_t set   = ((nibble & 1) ? LCD_D4_Pin : 0) | ((nibble & 2) ? LCD_D5_Pin : 0) | ((nibble & 4) ? LCD_D6_Pin : 0) | ((nibble & 8) ? LCD_D7_Pin : 0);
+    uint32_t reset = (LCD_D4_Pin | LCD_D5_Pin | LCD_D6_Pin | LCD_D7_Pin) & ~set;
+    LCD_D4_GPIO_Port->BSRR = set | (reset << 16);
+    LCD_EN_GPIO_Port->BSRR = LCD_EN_Pin;
+    display_delay();
+    LCD_EN_GPIO_Port->BRR = LCD_EN_Pin;
+    display_delay();
+}
+
+void display_tick()
+{
+    uint32_t tail = display_queue_tail;
+    if (tail == display_queue_head) {
+        return;
+    }
+    // The slot must not be read before the head that publishes it
+    __DMB();
+    uint16_t entry = display_queue[tail % DISPLAY_QUEUE_SIZE];
+    if (entry & DISPLAY_DATA) {
+        LCD_RS_GPIO_Port->BSRR = LCD_RS_Pin;
+    } else {
+        LCD_RS_GPIO_Port->BRR = LCD_RS_Pin;
+    }
+    display_write_nibble(entry >> 4);
+    display_write_nibble(entry);
+    display_queue_tail = tail + 1;
+}
+
+static void display_enqueue(uint16_t entry)
+{
+    uint32_t head = display_queue_head;
+    if (head - display_queue_tail >= DISPLAY_QUEUE_SIZE) {
+        // Can't happen with a flush per empty queue, send everything again next time
+        display_synced = false;
+        return;
+    }
+    display_queue[head % DISPLAY_QUEUE_SIZE] = entry;
+    // The slot must be written before the head publishes it (display_tick() runs from the SysTick interrupt)
+    __DMB();
+    display_queue_head = head + 1;
+}
+
+static inline void display_enqueue_cursor(uint8_t x, uint8_t y) { display_enqueue(DISPLAY_SET_DDRAM | (y ? DISPLAY_ROW_ADDRESS : 0) | x); }
+
+bool display_busy() { return display_queue_head != display_queue_tail; }
+
+static inline bool display_cell_changed(uint8_t x, uint8_t y, bool resend) { return resend || display_cells[y][x] != display_lcd_cells[y][x]; }
+
+void display_flush()
+{
+    // Changes made while the previous flush is being sent are coalesced in the shadow, the queue never holds more than one update
+    if (display_busy()) {
+        return;
+    }
+    bool resend    = !display_synced;
+    display_synced = true;
+    // Glyphs first: cells showing a redefined custom char change without being written again
+    for (uint8_t code = 0; code < DISPLAY_GLYPHS; code++) {
+        if (resend || memcmp(display_glyphs[code], display_lcd_glyphs[code], DISPLAY_GLYPH_SIZE) != 0) {
+            memcpy(display_lcd_glyphs[code], display_glyphs[code], DISPLAY_GLYPH_SIZE);
+            display_enqueue(DISPLAY_SET_CGRAM | (code << 3));
+            for (uint8_t row = 0; row < DISPLAY_GLYPH_SIZE; row++) {
+                display_enqueue(DISPLAY_DATA | display_glyphs[code][row]);
+            }
+        }
+    }
+    for (uint8_t y = 0; y < DISPLAY_ROWS; y++) {
+        uint8_t x = 0;
+        while (x < DISPLAY_COLUMNS) {
+            if (!display_cell_changed(x, y, resend)) {
+                x++;
+            } else {
+                // Run of changed cells, sent after a single cursor move
+                display_enqueue_cursor(x, y);
+                while (x < DISPLAY_COLUMNS && display_cell_changed(x, y, resend)) {
+                    display_lcd_cells[y][x] = display_cells[y][x];
+                    display_enqueue(DISPLAY_DATA | display_cells[y][x++]);
+                }
+            }
+        }
+    }
+}
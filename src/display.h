@@ -0,0 +1,32 @@
+#ifndef _DISPLAY_H_
+#define _DISPLAY_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// RAM shadow of the LCD: screens are drawn in RAM, display_flush() only queues the cells and custom chars that changed,
+// the queue is sent to the controller from the SysTick interrupt so that the main loop never waits for the LCD.
+// Custom chars are cached: callers give bitmaps, CGRAM slots are assigned on demand and a bitmap already loaded is never sent again
+
+#define DISPLAY_COLUMNS     8
+#define DISPLAY_ROWS        2
+#define DISPLAY_GLYPHS      8
+#define DISPLAY_GLYPH_SIZE  8
+
+// LCD content is unknown (after LCD_Init): next flush sends everything
+void display_init();
+void display_clear();
+// Text is clipped at the end of the row
+void display_puts(uint8_t x, uint8_t y, const char* str);
+void display_put_custom(uint8_t x, uint8_t y, uint8_t code);
+// Show a custom char: uses the slot already holding that bitmap, or loads it in the least recently used slot not on screen,
+// 'fallback' is shown when all slots are on screen. Returns false in that case
+bool display_put_glyph(uint8_t x, uint8_t y, const uint8_t* bitmap, char fallback);
+uint8_t display_get(uint8_t x, uint8_t y);
+void display_flush();
+// True while a flush is being sent
+bool display_busy();
+// Send the next queued byte, called every ms
+void display_tick();
+
+#endif
@@ -28,6 +28,12 @@ typedef struct
     uint8_t  correction_algorithm;
     uint32_t correction_factor;
     uint32_t warmup_time_seconds;
+    uint32_t survey_minutes;
+    int32_t  survey_latitude;   // 1e-7 degrees
+    int32_t  survey_longitude;  // 1e-7 degrees
+    int32_t  survey_height;     // Ellipsoid height, cm
+    uint32_t survey_accuracy;   // cm, 0xFFFFFFFF when no position has been surveyed
+    uint8_t  trend_source;
 } ee_storage_t;
 
 extern ee_storage_t ee_storage;
@@ -0,0 +1,108 @@
+#include "format.h"
+
+// Largest uint32_t has 10 digits
+#define FORMAT_MAX_DIGITS   10
+
+char* format_char(char* out, const char* end, char c)
+{
+    if (out == NULL) {
+        return NULL;
+    }
+    if (out + 1 >= end) {
+        // No room left for the char and the terminating 0
+        if (out < end) {
+            *out = '\0';
+        }
+        return NULL;
+    }
+    *out++ = c;
+    *out   = '\0';
+    return out;
+}
+
+char* format_string(char* out, const char* end, const char* str)
+{
+    if (out != NULL && out < end) {
+        *out = '\0';
+    }
+    while (*str) {
+        out = format_char(out, end, *str++);
+    }
+    return out;
+}
+
+// Digits of 'value' in reverse order, returns their count
+static uint8_t format_digits(char* digits, uint32_t value)
+{
+    uint8_t count = 0;
+    do {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    return count;
+}
+
+static char* format_number(char* out, const char* end, uint32_t magnitude, bool negative, uint8_t width, char pad)
+{
+    char    digits[FORMAT_MAX_DIGITS];
+    uint8_t count  = format_digits(digits, magnitude);
+    uint8_t length = count + (negative ? 1 : 0);
+    if (negative && pad == '0') {
+        out      = format_char(out, end, '-');
+        negative = false;
+    }
+    for (; width > length; width--) {
+        out = format_char(out, end, pad);
+    }
+    if (negative) {
+        out = format_char(out, end, '-');
+    }
+    while (count) {
+        out = format_char(out, end, digits[--count]);
+    }
+    return out;
+}
+
+char* format_int(char* out, const char* end, int32_t value, uint8_t width, char pad)
+{
+    return format_number(out, end, value < 0 ? -(uint32_t)value : (uint32_t)value, value < 0, width, pad);
+}
+
+char* format_uint(char* out, const char* end, uint32_t value, uint8_t width, char pad) { return format_number(out, end, value, false, width, pad); }
+
+char* format_fixed(char* out, const char* end, int32_t value, uint8_t scale, uint8_t decimals, uint8_t width)
+{
+    uint32_t divisor = 1;
+    for (uint8_t i = 0; i < scale; i++) {
+        divisor *= 10;
+    }
+    uint32_t magnitude = value < 0 ? -(uint32_t)value : (uint32_t)value;
+    uint32_t fraction  = magnitude % divisor;
+    // Drop the digits that are not shown
+    for (uint8_t i = decimals; i < scale; i++) {
+        fraction /= 10;
+    }
+    uint8_t length = decimals ? decimals + 1 : 0;
+    out            = format_number(out, end, magnitude / divisor, value < 0, width > length ? width - length : 0, ' ');
+    if (decimals) {
+        char    digits[FORMAT_MAX_DIGITS];
+        uint8_t count = format_digits(digits, fraction);
+        out           = format_char(out, end, '.');
+        for (uint8_t i = count; i < decimals; i++) {
+            out = format_char(out, end, '0');
+        }
+        while (count) {
+            out = format_char(out, end, digits[--count]);
+        }
+    }
+    return out;
+}
+
+char* format_hex(char* out, const char* end, uint32_t value, uint8_t digits)
+{
+    while (digits) {
+        uint8_t nibble = (value >> (--digits * 4)) & 0xF;
+        out            = format_char(out, end, nibble < 10 ? '0' + nibble : 'A' + nibble - 10);
+    }
+    return out;
+}
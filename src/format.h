@@ -0,0 +1,32 @@
+#ifndef _FORMAT_H_
+#define _FORMAT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// printf replacement for the display and telemetry paths, built around the fixed point values of the project
+// (PPB x100, millis x1e4, degrees x1e7). Each function writes at 'out' without going past 'end' (end of the buffer),
+// always terminates the text and returns the position of the terminating 0, so that calls can be chained.
+// NULL is returned when the text had to be truncated and a NULL 'out' is ignored: a chain stops at the first overflow
+
+#define FORMAT_END(buffer)  ((buffer) + sizeof(buffer))
+
+char* format_string(char* out, const char* end, const char* str);
+char* format_char(char* out, const char* end, char c);
+// Right aligned on 'width' chars, padded with 'pad' ('0' padding goes after the sign)
+char* format_int(char* out, const char* end, int32_t value, uint8_t width, char pad);
+char* format_uint(char* out, const char* end, uint32_t value, uint8_t width, char pad);
+// 'value' / 10^scale with 'decimals' digits after the point (truncated, decimals <= scale), right aligned on 'width' chars
+char* format_fixed(char* out, const char* end, int32_t value, uint8_t scale, uint8_t decimals, uint8_t width);
+// Upper case hexadecimal on 'digits' digits
+char* format_hex(char* out, const char* end, uint32_t value, uint8_t digits);
+
+// PPB and other x100 values
+static inline char* format_hundredths(char* out, const char* end, int32_t value) { return format_fixed(out, end, value, 2, 2, 0); }
+// Milliseconds x1e4
+static inline char* format_millis(char* out, const char* end, int32_t value) { return format_fixed(out, end, value, 4, 4, 0); }
+// Degrees x1e7
+static inline char* format_degrees(char* out, const char* end, int32_t value, uint8_t decimals) { return format_fixed(out, end, value, 7, decimals, 0); }
+
+#endif
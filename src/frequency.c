@@ -12,17 +12,27 @@
 volatile circbuf_t circular_buffer = {0};
 
 // Quick and dirty circular buffer
-void circbuf_add(volatile circbuf_t* circbuf, int32_t val)
+void circbuf_add(volatile circbuf_t* circbuf, int32_t val, uint16_t weight)
 {
-    circbuf->buf[circbuf->write] = val;
-    circbuf->write               = (circbuf->write + 1) % CIRCULAR_BUFFER_LEN;
+    circbuf->buf[circbuf->write]    = val;
+    circbuf->weight[circbuf->write] = weight;
+    circbuf->write                  = (circbuf->write + 1) % CIRCULAR_BUFFER_LEN;
 }
 
 int32_t circbuf_sum(volatile circbuf_t* circbuf)
 {
     int32_t sum = 0;
     for (size_t i = 0; i < CIRCULAR_BUFFER_LEN; i++) {
-        sum += circbuf->buf[i];
+        sum += circbuf->buf[i] * circbuf->weight[i];
+    }
+    return sum;
+}
+
+uint32_t circbuf_weight(volatile circbuf_t* circbuf)
+{
+    uint32_t sum = 0;
+    for (size_t i = 0; i < CIRCULAR_BUFFER_LEN; i++) {
+        sum += circbuf->weight[i];
     }
     return sum;
 }
@@ -58,14 +68,15 @@ int32_t frequency_get_error()
 
 int32_t frequency_get_ppb()
 {
-    if (num_samples == 0) {
+    uint32_t weight = circbuf_weight(&circular_buffer);
+    if (num_samples == 0 || weight == 0) {
         return 0xFFFF;
     }
 
     // Get ratio of cumulative error / expected number of cycles. Multiply by 1e9 for PPB and by
     // 100 to get additional digits without using floats.
-    // This will be a running average over 128 seconds of the error in PPB*100
-    return (int64_t)circbuf_sum(&circular_buffer) * 1000000000 * 100 / ((int64_t)HAL_RCC_GetHCLKFreq() * num_samples);
+    // This will be a running average over 128 seconds of the error in PPB*100, samples taken with a poor GPS fix count less
+    return (int64_t)circbuf_sum(&circular_buffer) * 1000000000 * 100 / ((int64_t)HAL_RCC_GetHCLKFreq() * weight);
 }
 
 bool frequency_is_stable(int32_t threshold)
@@ -8,14 +8,18 @@
 #define CIRCULAR_BUFFER_LEN 128
 
 typedef struct circbuf_t {
-    size_t  write;
-    int32_t buf[CIRCULAR_BUFFER_LEN];
+    size_t   write;
+    int32_t  buf[CIRCULAR_BUFFER_LEN];
+    // Quality weight of each sample, GPS_WEIGHT_FULL for a sample taken with a good fix
+    uint16_t weight[CIRCULAR_BUFFER_LEN];
 } circbuf_t;
 
 extern volatile circbuf_t circular_buffer;
 
-void    circbuf_add(volatile circbuf_t* circbuf, int32_t val);
-int32_t circbuf_sum(volatile circbuf_t* circbuf);
+void     circbuf_add(volatile circbuf_t* circbuf, int32_t val, uint16_t weight);
+// Sum of the samples multiplied by their weight
+int32_t  circbuf_sum(volatile circbuf_t* circbuf);
+uint32_t circbuf_weight(volatile circbuf_t* circbuf);
 
 void    frequency_start();
 int32_t frequency_get();
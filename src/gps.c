@@ -1,9 +1,16 @@
 #include "gps.h"
+#include "bridge.h"
+#include "casic.h"
 #include "LCD.h"
 #include "main.h"
+#include "satellites.h"
+#include "menu.h"
 #include "stm32f1xx_hal_uart.h"
 #include "usart.h"
 #include "eeprom.h"
+#include "survey.h"
+#include "ubx.h"
+#include "utc.h"
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -11,7 +18,8 @@
 #include <string.h>
 #include <math.h>
 
-#define MAX_GPS_LINE        512
+// NMEA 0183 caps sentences at 82 characters, anything longer than this is garbage
+#define MAX_GPS_LINE        128
 #define GPS_LOCATOR_SIZE    8
 
 char     gps_line[MAX_GPS_LINE];
@@ -25,107 +33,354 @@ double   gps_msl_altitude;
 double   gps_geoid_separation;
 double   gps_latitude_double  = 0;
 double   gps_longitude_double = 0;
+int32_t  gps_latitude_e7      = 0;
+int32_t  gps_longitude_e7     = 0;
 char     gps_locator[GPS_LOCATOR_SIZE+1];
 
 char     gps_hdop[9]      = { '\0' };
 char     gps_last_frame[9]= { '\0' };
 bool     gps_last_frame_changed = false;
 uint8_t  num_sats         = 0;
+uint8_t  gps_fix_quality  = 0;
+uint16_t gps_hdop_tenths  = 0;
 uint32_t gga_frames       = 0;
-size_t   gps_line_len     = 0;
+uint32_t gps_rx_bytes     = 0;
+uint32_t gps_gga_delay    = 0;
+nmea_stats_t nmea_sentence_stats[NMEA_SENTENCE_MAX] = { 0 };
+nmea_stats_t nmea_talker_stats[NMEA_TALKER_MAX]     = { 0 };
+nmea_stats_t nmea_total_stats                       = { 0 };
 gps_model_type  gps_model       = GPS_MODEL_UNKNOWN;
 date_format     gps_date_format = DATE_FORMAT_UTC;
 
 // Store last frame receive time
 uint32_t last_frame_receive_time = 0;
+// PPS quantization error reported by the GPS module for the next pulse
+volatile int32_t gps_pps_qerr       = 0;
+volatile bool    gps_pps_qerr_valid = false;
+// Start trusting PPS as before until a GGA tells otherwise
+volatile uint16_t gps_pps_weight    = GPS_WEIGHT_FULL;
+// A weight older than this is not applied to PPS samples any more (ms)
+#define GPS_GGA_TIMEOUT         3000
+static uint32_t gps_last_gga_time   = 0;
 
+// PPS sample weighting: no fix or less than 4 satellites rejects the sample, then the weight grows with the satellite count
+// up to 8 satellites and decreases with HDOP above 2.0, samples with a HDOP above 10.0 are rejected
+#define GPS_WEIGHT_MIN_SATS     4
+#define GPS_WEIGHT_FULL_SATS    8
+#define GPS_WEIGHT_GOOD_HDOP    20  // HDOP * 10
+#define GPS_WEIGHT_MAX_HDOP     100 // HDOP * 10
 
-#define FIFO_BUFFER_SIZE 256
 
-typedef struct {
-    uint8_t buffer[FIFO_BUFFER_SIZE];
-    size_t  read;
-    size_t  write;
-} fifo_buffer_t;
-
-typedef enum { FIFO_WRITE, FIFO_READ } fifo_operation;
+// GPS reception uses a circular DMA ring that is never stopped: half transfer, transfer complete and
+// UART idle line events publish the DMA write position, and gps_read() parses the data where it lies.
+// Ring must hold more than what is received during the longest main loop stall (~11ms at 921600 bauds)
+#define GPS_RX_BUFFER_SIZE  1024
 
-volatile fifo_buffer_t fifo_buffer_gps  = { 0 };
-volatile fifo_buffer_t fifo_buffer_comm = { 0 };
+static uint8_t gps_rx_ring[GPS_RX_BUFFER_SIZE];
+// Total number of bytes written by DMA / consumed by the parser, they only wrap at 2^32
+static volatile uint32_t gps_rx_written   = 0;
+static uint32_t          gps_rx_read      = 0;
+static uint16_t          gps_rx_last_pos  = 0;
+static volatile bool     gps_rx_restart   = false;
+uint32_t                 gps_rx_overruns  = 0;
+// Total number of bytes forwarded to the host port
+static uint32_t          gps_rx_forwarded = 0;
 
-size_t fifo_next(volatile const fifo_buffer_t* fifo, fifo_operation op)
+static void gps_start_gps_rx()
 {
-    if (op == FIFO_WRITE) {
-        return (fifo->write + 1) % FIFO_BUFFER_SIZE;
-    } else {
-        return (fifo->read + 1) % FIFO_BUFFER_SIZE;
+    gps_rx_written  = 0;
+    gps_rx_read     = 0;
+    gps_rx_forwarded = 0;
+    gps_rx_last_pos = 0;
+    gps_rx_restart  = false;
+    // Bytes of a frame started at the previous baudrate must not be taken for the rest of it
+    ubx_reset();
+    casic_reset();
+    if (HAL_UARTEx_ReceiveToIdle_DMA(&huart3, gps_rx_ring, GPS_RX_BUFFER_SIZE) != HAL_OK) {
+        Error_Handler();
     }
 }
 
-bool fifo_write(volatile fifo_buffer_t* fifo, const uint8_t c)
+// ATGM336H set baudrate commands
+static const char*	atgm336h_baudcommands[] = {
+    "$PCAS01,1*1D\r\n",     // 9600bps
+    "$PCAS01,2*1E\r\n",     // 19200bps
+    "$PCAS01,3*1F\r\n",     // 38400bps
+    "$PCAS01,4*18\r\n",     // 57600bps
+    "$PCAS01,5*19\r\n"      // 115200bps
+};
+
+// ATGM336H save configuration command
+const char*	atgm336h_savecommand = "$PCAS00*01\r\n";
+
+static void gps_sendcommand(const char* cmd, size_t len)
 {
-    size_t next = fifo_next(fifo, FIFO_WRITE);
-    if (next == fifo->read) {
-        return false;
-    }
-    fifo->buffer[fifo->write] = c;
-    fifo->write               = next;
-    return true;
+    // Queued behind any host traffic, sent by DMA
+    bridge_send_to_gps((const uint8_t*)cmd, len);
 }
 
-bool fifo_read(volatile fifo_buffer_t* fifo, uint8_t* c)
+// Module configuration profiles: only the sentences gps_parse() consumes (GGA for position and sats, RMC for date and UTC,
+// GSA for satellites used in the fix, GSV every 5 fixes for signal levels) are enabled, plus the PPS timing messages. TXT is only sent at module startup and does not need to be configured.
+typedef enum { GPS_COMMAND_UBX, GPS_COMMAND_CASIC } gps_command_protocol;
+
+typedef struct {
+    gps_command_protocol protocol;
+    uint8_t              msg_class;
+    uint8_t              msg_id;
+    const uint8_t*       payload;
+    uint16_t             len;
+} gps_command_t;
+
+typedef struct {
+    const gps_command_t* commands;
+    uint8_t              count;
+} gps_profile_t;
+
+#define UBX_NMEA_CLASS  0xF0
+#define UBX_MSG_RATE(msg_class, msg_id, rate)   { GPS_COMMAND_UBX, UBX_CLASS_CFG, UBX_CFG_MSG, (const uint8_t[]) { msg_class, msg_id, rate }, 3 }
+#define CASIC_MSG_RATE(msg_class, msg_id, rate) { GPS_COMMAND_CASIC, CASIC_CLASS_CFG, CASIC_CFG_MSG, (const uint8_t[]) { msg_class, msg_id, rate, 0 }, 4 }
+#define CASIC_POLL(msg_class, msg_id)           { GPS_COMMAND_CASIC, msg_class, msg_id, NULL, 0 }
+// CFG-VALSET key / U1 value pair, little endian
+#define UBX_KEY_U1(key, value)                  (key) & 0xFF, ((key) >> 8) & 0xFF, ((key) >> 16) & 0xFF, ((key) >> 24) & 0xFF, value
+
+static const gps_command_t atgm336h_profile[] = {
+    CASIC_MSG_RATE(CASIC_CLASS_NMEA, CASIC_NMEA_GGA, 1),
+    CASIC_MSG_RATE(CASIC_CLASS_NMEA, CASIC_NMEA_GLL, 0),
+    CASIC_MSG_RATE(CASIC_CLASS_NMEA, CASIC_NMEA_GSA, 1),
+    CASIC_MSG_RATE(CASIC_CLASS_NMEA, CASIC_NMEA_GSV, 5),
+    CASIC_MSG_RATE(CASIC_CLASS_NMEA, CASIC_NMEA_RMC, 1),
+    CASIC_MSG_RATE(CASIC_CLASS_NMEA, CASIC_NMEA_VTG, 0),
+    CASIC_MSG_RATE(CASIC_CLASS_NMEA, CASIC_NMEA_ZDA, 0),
+    CASIC_MSG_RATE(CASIC_CLASS_TIM, CASIC_TIM_TP, 1),
+    // Read back the resulting configuration
+    CASIC_POLL(CASIC_CLASS_CFG, CASIC_CFG_PRT),
+    CASIC_POLL(CASIC_CLASS_CFG, CASIC_CFG_TP),
+    CASIC_POLL(CASIC_CLASS_CFG, CASIC_CFG_MSG),
+};
+
+static const gps_command_t neo6m_profile[] = {
+    UBX_MSG_RATE(UBX_NMEA_CLASS, 0x00, 1), // GGA
+    UBX_MSG_RATE(UBX_NMEA_CLASS, 0x01, 0), // GLL
+    UBX_MSG_RATE(UBX_NMEA_CLASS, 0x02, 1), // GSA
+    UBX_MSG_RATE(UBX_NMEA_CLASS, 0x03, 5), // GSV
+    UBX_MSG_RATE(UBX_NMEA_CLASS, 0x04, 1), // RMC
+    UBX_MSG_RATE(UBX_NMEA_CLASS, 0x05, 0), // VTG
+    // CFG-TP5 for TIMEPULSE: 1 Hz rising edge aligned to the top of second, 100 ms pulse only when locked so that PPS loss is detected
+    { GPS_COMMAND_UBX, UBX_CLASS_CFG, UBX_CFG_TP5,
+      (const uint8_t[]) { 0, 0, 0, 0,                    // tpIdx, version, reserved
+                          0, 0, 0, 0,                    // antCableDelay, rfGroupDelay
+                          0x40, 0x42, 0x0F, 0x00,        // freqPeriod 1000000 us
+                          0x40, 0x42, 0x0F, 0x00,        // freqPeriodLock 1000000 us
+                          0x00, 0x00, 0x00, 0x00,        // pulseLenRatio 0 us
+                          0xA0, 0x86, 0x01, 0x00,        // pulseLenRatioLock 100000 us
+                          0, 0, 0, 0,                    // userConfigDelay
+                          0x77, 0x00, 0x00, 0x00 },      // active, lockGpsFreq, lockedOtherSet, isLength, alignToTow, polarity
+      32 },
+    UBX_MSG_RATE(UBX_CLASS_TIM, UBX_TIM_TP, 1),
+};
+
+static const gps_command_t neom9n_profile[] = {
+    // Legacy CFG-MSG is replaced by configuration keys on generation 9 receivers, all set at once in RAM
+    { GPS_COMMAND_UBX, UBX_CLASS_CFG, UBX_CFG_VALSET,
+      (const uint8_t[]) { 0, 0x01, 0, 0,
+                          UBX_KEY_U1(UBX_KEY_MSGOUT_GGA_UART1, 1),
+                          UBX_KEY_U1(UBX_KEY_MSGOUT_GLL_UART1, 0),
+                          UBX_KEY_U1(UBX_KEY_MSGOUT_GSA_UART1, 1),
+                          UBX_KEY_U1(UBX_KEY_MSGOUT_GSV_UART1, 5),
+                          UBX_KEY_U1(UBX_KEY_MSGOUT_RMC_UART1, 1),
+                          UBX_KEY_U1(UBX_KEY_MSGOUT_VTG_UART1, 0),
+                          UBX_KEY_U1(UBX_KEY_MSGOUT_TIM_TP_UART1, 1) },
+      4 + 7 * 5 },
+};
+
+#define GPS_PROFILE(commands) { commands, sizeof(commands) / sizeof(commands[0]) }
+// Indexed by gps_model_type
+static const gps_profile_t gps_profiles[GPS_MODEL_UNKNOWN] = {
+    GPS_PROFILE(atgm336h_profile),
+    GPS_PROFILE(neo6m_profile),
+    GPS_PROFILE(neom9n_profile),
+};
+
+// Module link management: baudrate changes and configuration are stepped from gps_read() without ever blocking the main loop.
+// Configuration commands are sent one at a time and the next one waits for the module ACK (or a timeout and retries).
+// A new baudrate is only kept once a valid sentence has been received, else the UARTs fall back to the last known good one.
+#define GPS_LINK_DRAIN_TIMEOUT      50      // Time given to pending commands to leave at the current baudrate (ms)
+#define GPS_LINK_SETTLE_TIME        50      // Time given to the module to switch baudrate (ms)
+#define GPS_LINK_ACK_TIMEOUT        250     // Time to wait for a command ACK (ms)
+#define GPS_LINK_RETRIES            3
+#define GPS_LINK_VERIFY_TIMEOUT     2500    // Time to wait for a valid sentence after a baudrate change (ms)
+#define GPS_LINK_SAVE_DELAY         50      // Time given to the module to apply its configuration before saving it (ms)
+// Baudrate detection: a link that gets UART errors or garbage but no valid sentence is scanned for the module baudrate
+#define GPS_LINK_CHECK_PERIOD       1000    // Link health check period (ms)
+#define GPS_LINK_SCAN_ERRORS        4       // UART errors without a valid sentence that make a baudrate wrong
+#define GPS_LINK_SCAN_GARBAGE       (2 * MAX_GPS_LINE)  // Bytes without a valid sentence that make a baudrate wrong
+#define GPS_LINK_SCAN_LISTEN        1100    // Time to listen at a candidate baudrate, a bit more than the module output period (ms)
+#define GPS_LINK_SCAN_BACKOFF       10000   // Time before scanning again after a failed scan (ms)
+// Send the configured baudrate again to a module found at another one (e.g. module that lost its saved settings)
+#define GPS_LINK_RESTORE_BAUDRATE   1
+
+typedef enum { GPS_LINK_IDLE, GPS_LINK_DRAIN, GPS_LINK_SETTLE, GPS_LINK_CONFIGURE, GPS_LINK_VERIFY, GPS_LINK_SAVE, GPS_LINK_SCAN } gps_link_state;
+typedef enum { GPS_ACK_NONE, GPS_ACK_PENDING, GPS_ACK_RECEIVED, GPS_ACK_REJECTED } gps_ack_state;
+
+uint32_t         gps_good_baudrate  = 0;
+gps_link_stats_t gps_link_stats     = { 0 };
+gps_baud_stats_t gps_baud_stats[BAUDRATE_MAX] = { 0 };
+
+static gps_link_state         gps_link          = GPS_LINK_IDLE;
+static uint32_t               gps_link_deadline = 0;
+static uint32_t               gps_link_baudrate = 0;
+// Persist the baudrate in ee_storage and on the module once it has been verified
+static bool                   gps_link_save     = false;
+static bool                   gps_link_fallback = false;
+static uint8_t                gps_link_command  = 0;
+static uint8_t                gps_link_tries    = 0;
+static uint32_t               gps_link_good     = 0;
+static const gps_command_t*   gps_ack_command   = NULL;
+static volatile gps_ack_state gps_ack           = GPS_ACK_NONE;
+// Baudrate the GPS UART runs at, as a baudrate enum for the statistics (CubeMX starts it at GPS_DEFAULT_BAUDRATE)
+static volatile baudrate      gps_rx_baudrate   = BAUDRATE_9600;
+// Candidate baudrates of the current scan, most likely first
+static baudrate               gps_scan_candidates[BAUDRATE_MAX];
+static uint8_t                gps_scan_count    = 0;
+static uint8_t                gps_scan_index    = 0;
+static bool                   gps_link_scanning = false;
+static uint32_t               gps_scan_retry    = 0;
+// Reception counters at the start of the current observation window
+static uint32_t               gps_window_good   = 0;
+static uint32_t               gps_window_bytes  = 0;
+static uint32_t               gps_window_errors = 0;
+
+static inline bool gps_link_expired() { return (int32_t)(HAL_GetTick() - gps_link_deadline) >= 0; }
+
+static void gps_link_set_state(gps_link_state state, uint32_t delay)
 {
-    if (fifo->read == fifo->write) {
-        return false;
-    }
-    *c         = fifo->buffer[fifo->read];
-    fifo->read = fifo_next(fifo, FIFO_READ);
+    gps_link          = state;
+    gps_link_deadline = HAL_GetTick() + delay;
+}
 
-    return true;
+static uint32_t gps_baud_errors(baudrate index)
+{
+    const gps_baud_stats_t* stats = &gps_baud_stats[index];
+    return stats->framing + stats->noise + stats->overrun;
 }
 
-#define GPS_RX_BUFFER_SIZE  20
-#define COMM_RX_BUFFER_SIZE 1
+static void gps_link_window_start(gps_link_state state, uint32_t duration)
+{
+    gps_window_good   = nmea_total_stats.good;
+    gps_window_bytes  = gps_rx_bytes;
+    gps_window_errors = gps_baud_errors(gps_rx_baudrate);
+    gps_link_set_state(state, duration);
+}
 
-volatile uint8_t gps_it_buf[GPS_RX_BUFFER_SIZE];
-volatile uint8_t comm_it_buf[COMM_RX_BUFFER_SIZE];
+// True when errors or garbage have been received, but no valid sentence, since the window start
+static bool gps_link_window_garbled()
+{
+    return nmea_total_stats.good == gps_window_good
+        && (gps_baud_errors(gps_rx_baudrate) - gps_window_errors >= GPS_LINK_SCAN_ERRORS || gps_rx_bytes - gps_window_bytes > GPS_LINK_SCAN_GARBAGE);
+}
 
-static void gps_start_gps_rx()
+static void gps_link_idle() { gps_link_window_start(GPS_LINK_IDLE, GPS_LINK_CHECK_PERIOD); }
+
+static void gps_uart_init(UART_HandleTypeDef* huart, USART_TypeDef* instance, uint32_t baudrate)
 {
-    if (HAL_UART_Receive_DMA(&huart3, (uint8_t*)gps_it_buf, GPS_RX_BUFFER_SIZE) != HAL_OK) {
-        Error_Handler();
+    HAL_UART_DeInit(huart);
+    huart->Instance = instance;
+    huart->Init.BaudRate = baudrate;
+    huart->Init.WordLength = UART_WORDLENGTH_8B;
+    huart->Init.StopBits = UART_STOPBITS_1;
+    huart->Init.Parity = UART_PARITY_NONE;
+    huart->Init.Mode = UART_MODE_TX_RX;
+    huart->Init.HwFlowCtl = UART_HWCONTROL_NONE;
+    huart->Init.OverSampling = UART_OVERSAMPLING_16;
+    if (HAL_UART_Init(huart) != HAL_OK)
+    {
+      Error_Handler();
     }
 }
-static void gps_start_comm_rx()
+
+// Switch both UARTs to the link baudrate, pending transmissions are lost
+static void gps_link_switch()
 {
-    if (HAL_UART_Receive_DMA(&huart2, (uint8_t*)comm_it_buf, COMM_RX_BUFFER_SIZE) != HAL_OK) {
-        Error_Handler();
-    }
+    bridge_stop();
+    gps_uart_init(&huart2, USART2, gps_link_baudrate);
+    gps_uart_init(&huart3, USART3, gps_link_baudrate);
+    // Receptions are restarted by gps_read() and bridge_run()
+    gps_rx_restart = true;
+    gps_rx_baudrate = menu_get_baudrate_enum(gps_link_baudrate);
+    bridge_start();
+    gps_link_stats.switches++;
+    gps_link_set_state(GPS_LINK_SETTLE, GPS_LINK_SETTLE_TIME);
 }
 
-// ATGM336H set baudrate commands
-static const char*	atgm336h_baudcommands[] = {
-    "$PCAS01,1*1D\r\n",     // 9600bps
-    "$PCAS01,2*1E\r\n",     // 19200bps
-    "$PCAS01,3*1F\r\n",     // 38400bps
-    "$PCAS01,4*18\r\n",     // 57600bps
-    "$PCAS01,5*19\r\n"      // 115200bps
-};
+static void gps_link_start_configure()
+{
+    gps_link_command = 0;
+    gps_link_tries   = 0;
+    gps_ack          = GPS_ACK_NONE;
+    gps_link_set_state(GPS_LINK_CONFIGURE, 0);
+}
 
-// ATGM336H save configuration command
-const char*	atgm336h_savecommand = "$PCAS00*01\r\n";
+void gps_command_acknowledged(uint8_t msg_class, uint8_t msg_id, bool ack)
+{
+    if (gps_ack == GPS_ACK_PENDING && gps_ack_command != NULL && gps_ack_command->msg_class == msg_class && gps_ack_command->msg_id == msg_id) {
+        gps_ack = ack ? GPS_ACK_RECEIVED : GPS_ACK_REJECTED;
+    }
+}
 
-static void gps_sendcommand(const char* cmd, size_t len)
+// Send the configuration profile of the current module model, one command per call
+static void gps_link_configure_step()
 {
-    while (huart3.gState != HAL_UART_STATE_READY);
-    HAL_UART_Transmit_IT(&huart3, (const uint8_t*)cmd, len);
-    // wait for transfer completed
-    while (huart3.gState != HAL_UART_STATE_READY);
+    const gps_profile_t* profile = (gps_model < GPS_MODEL_UNKNOWN) ? &gps_profiles[gps_model] : NULL;
+    if (gps_ack == GPS_ACK_PENDING) {
+        if (!gps_link_expired()) {
+            return;
+        }
+        if (gps_link_tries < GPS_LINK_RETRIES) {
+            // Lost command or lost ACK, send it again
+            gps_link_stats.retries++;
+            gps_ack = GPS_ACK_NONE;
+        } else {
+            gps_link_stats.timeouts++;
+            gps_ack = GPS_ACK_REJECTED;
+        }
+    }
+    if (gps_ack == GPS_ACK_REJECTED) {
+        gps_link_stats.rejected++;
+    }
+    if (gps_ack == GPS_ACK_RECEIVED || gps_ack == GPS_ACK_REJECTED) {
+        gps_link_command++;
+        gps_link_tries = 0;
+        gps_ack        = GPS_ACK_NONE;
+    }
+    if (profile != NULL && gps_link_command < profile->count) {
+        const gps_command_t* command = &profile->commands[gps_link_command];
+        bool sent;
+        if (command->protocol == GPS_COMMAND_UBX) {
+            sent = ubx_send(command->msg_class, command->msg_id, command->payload, command->len);
+        } else {
+            sent = casic_send(command->msg_class, command->msg_id, command->payload, command->len);
+        }
+        if (sent && command->len == 0) {
+            // Polls are answered with the polled message, not acknowledged
+            gps_link_command++;
+            return;
+        }
+        // A command that could not be queued (TX ring full) is retried like an unacknowledged one
+        gps_ack_command = command;
+        gps_ack         = GPS_ACK_PENDING;
+        gps_link_tries++;
+        gps_link_set_state(GPS_LINK_CONFIGURE, GPS_LINK_ACK_TIMEOUT);
+        return;
+    }
+    // Surveyed position is kept in fixed position timing mode
+    survey_apply();
+    gps_link_good = nmea_total_stats.good;
+    gps_link_set_state(GPS_LINK_VERIFY, GPS_LINK_VERIFY_TIMEOUT);
 }
 
-int	gps_configure_module_uart(uint32_t baudrate)
+static bool gps_send_baudrate_command(uint32_t baudrate)
 {
-    const char*	command = NULL;
+    const char* command = NULL;
     switch(gps_model)
     {
         case GPS_MODEL_ATGM336H:
@@ -146,108 +401,269 @@ int	gps_configure_module_uart(uint32_t baudrate)
                     command = atgm336h_baudcommands[4];
                     break;
                 default:
-                    return -1;  // error
+                    return false;
             }
+            gps_sendcommand(command, strlen(command));
             break;
         case GPS_MODEL_NEO6M:
-            // TODO
+            ubx_set_baudrate(baudrate);
+            break;
         case GPS_MODEL_NEOM9N:
-            // TODO
+            // Legacy CFG-PRT is not supported by generation 9 receivers
+            ubx_valset_u32(UBX_KEY_UART1_BAUDRATE, baudrate);
+            break;
         case GPS_MODEL_UNKNOWN:
+            // Model is not known yet, only the UARTs can be switched
             break;
     }
+    return true;
+}
 
-    size_t len;
-    if (command != NULL) {
-        len = strlen(command);
-        gps_sendcommand(command, len);
+static void gps_save_config()
+{
+    switch(gps_model)
+    {
+        case GPS_MODEL_ATGM336H:
+            gps_sendcommand(atgm336h_savecommand, strlen(atgm336h_savecommand));
+            break;
+        case GPS_MODEL_NEO6M:
+        case GPS_MODEL_NEOM9N:
+            ubx_save_config();
+            break;
+        case GPS_MODEL_UNKNOWN:
+            break;
     }
+}
 
-    return	0;
+static void gps_link_verified()
+{
+    gps_good_baudrate = gps_link_baudrate;
+    gps_link_fallback = false;
+    menu_update_gps_baudrate(gps_link_baudrate);
+    if (!gps_link_save) {
+        gps_link_idle();
+        return;
+    }
+    if (ee_storage.gps_baudrate != gps_link_baudrate) {
+        ee_storage.gps_baudrate = gps_link_baudrate;
+        EE_Write();
+    }
+    // Give some time for the module to reconfigure before sending the save command
+    gps_link_set_state(GPS_LINK_SAVE, GPS_LINK_SAVE_DELAY);
 }
 
-void gps_reconfigure_uart(uint32_t baudrate)
+static void gps_link_failed()
 {
-    HAL_UART_DeInit(&huart2);
-    HAL_UART_DeInit(&huart3);
-    // Wait for buffers to be consumed
-    HAL_Delay(50);
-
-    huart2.Instance = USART2;
-    huart2.Init.BaudRate = baudrate;
-    huart2.Init.WordLength = UART_WORDLENGTH_8B;
-    huart2.Init.StopBits = UART_STOPBITS_1;
-    huart2.Init.Parity = UART_PARITY_NONE;
-    huart2.Init.Mode = UART_MODE_TX_RX;
-    huart2.Init.HwFlowCtl = UART_HWCONTROL_NONE;
-    huart2.Init.OverSampling = UART_OVERSAMPLING_16;
-    if (HAL_UART_Init(&huart2) != HAL_OK)
-    {
-      Error_Handler();
+    gps_link_stats.failures++;
+    if (!gps_link_fallback && gps_good_baudrate != 0 && gps_good_baudrate != gps_link_baudrate) {
+        // Module did not follow, go back to the baudrate it was last heard at
+        gps_link_fallback = true;
+        gps_link_save     = false;
+        gps_link_baudrate = gps_good_baudrate;
+        menu_update_gps_baudrate(gps_link_baudrate);
+        gps_link_set_state(GPS_LINK_DRAIN, 0);
+        return;
     }
+    // Nothing else to try, baudrate detection takes over if the module is heard at another baudrate
+    gps_link_fallback = false;
+    gps_link_idle();
+}
 
-    huart3.Instance = USART3;
-    huart3.Init.BaudRate = baudrate;
-    huart3.Init.WordLength = UART_WORDLENGTH_8B;
-    huart3.Init.StopBits = UART_STOPBITS_1;
-    huart3.Init.Parity = UART_PARITY_NONE;
-    huart3.Init.Mode = UART_MODE_TX_RX;
-    huart3.Init.HwFlowCtl = UART_HWCONTROL_NONE;
-    huart3.Init.OverSampling = UART_OVERSAMPLING_16;
-    if (HAL_UART_Init(&huart3) != HAL_OK)
-    {
-      Error_Handler();
+static void gps_scan_add(baudrate candidate)
+{
+    if (candidate == gps_rx_baudrate) {
+        // Current baudrate is the one that does not work
+        return;
     }
-    // Wait Uarts to init
-    HAL_Delay(50);
-    gps_start_gps_rx();
-    gps_start_comm_rx();
+    for (uint8_t i = 0; i < gps_scan_count; i++) {
+        if (gps_scan_candidates[i] == candidate) {
+            return;
+        }
+    }
+    gps_scan_candidates[gps_scan_count++] = candidate;
 }
 
-void gps_save_config()
+static void gps_link_scan_start()
 {
-    const char* save_command = NULL;
-    switch(gps_model)
-    {
-        case GPS_MODEL_ATGM336H:
-            // Give some time for the module to reconfigure before sending the save command
-            HAL_Delay(50);
-            save_command = atgm336h_savecommand;
+    gps_link_stats.scans++;
+    gps_scan_count = 0;
+    gps_scan_index = 0;
+    // Module default (lost settings) first, then configured and last good baudrates, then all others
+    gps_scan_add(menu_get_baudrate_enum(GPS_DEFAULT_BAUDRATE));
+    gps_scan_add(menu_get_baudrate_enum(ee_storage.gps_baudrate));
+    if (gps_good_baudrate != 0) {
+        gps_scan_add(menu_get_baudrate_enum(gps_good_baudrate));
+    }
+    for (baudrate candidate = 0; candidate < BAUDRATE_MAX; candidate++) {
+        gps_scan_add(candidate);
+    }
+    gps_link_scanning = true;
+    gps_link_baudrate = menu_get_baudrate_value(gps_scan_candidates[0]);
+    gps_link_switch();
+}
+
+static void gps_link_scan_next()
+{
+    if (++gps_scan_index < gps_scan_count) {
+        gps_link_baudrate = menu_get_baudrate_value(gps_scan_candidates[gps_scan_index]);
+        gps_link_switch();
+        return;
+    }
+    // Module not found, go back to the configured baudrate and wait before trying again
+    gps_link_scanning = false;
+    gps_scan_retry    = HAL_GetTick() + GPS_LINK_SCAN_BACKOFF;
+    gps_link_baudrate = ee_storage.gps_baudrate;
+    gps_link_switch();
+}
+
+static void gps_link_scan_found()
+{
+    gps_link_stats.detections++;
+    gps_link_scanning = false;
+    gps_good_baudrate = gps_link_baudrate;
+    menu_update_gps_baudrate(gps_link_baudrate);
+#if GPS_LINK_RESTORE_BAUDRATE
+    if (gps_link_baudrate != ee_storage.gps_baudrate && gps_set_baudrate(ee_storage.gps_baudrate, true)) {
+        // Falls back to the detected baudrate if the module does not follow
+        return;
+    }
+#endif
+    // Module may have lost its whole configuration, not only its baudrate
+    gps_link_start_configure();
+}
+
+void gps_link_run()
+{
+    switch (gps_link) {
+        case GPS_LINK_IDLE:
+            if (gps_link_expired()) {
+                if (gps_link_window_garbled() && (int32_t)(HAL_GetTick() - gps_scan_retry) >= 0) {
+                    gps_link_scan_start();
+                } else {
+                    gps_link_idle();
+                }
+            }
             break;
-        case GPS_MODEL_NEO6M:
-            // TODO
-        case GPS_MODEL_NEOM9N:
-            // TODO
-        case GPS_MODEL_UNKNOWN:
+        case GPS_LINK_DRAIN:
+            // Let pending commands (e.g. the baudrate change) leave at the current baudrate
+            if (bridge_gps_tx_idle() || gps_link_expired()) {
+                if (huart3.Init.BaudRate != gps_link_baudrate) {
+                    gps_link_switch();
+                } else {
+                    gps_link_start_configure();
+                }
+            }
+            break;
+        case GPS_LINK_SETTLE:
+            if (gps_link_expired()) {
+                if (gps_link_scanning) {
+                    gps_link_window_start(GPS_LINK_SCAN, GPS_LINK_SCAN_LISTEN);
+                } else {
+                    gps_link_start_configure();
+                }
+            }
+            break;
+        case GPS_LINK_SCAN:
+            if (nmea_total_stats.good != gps_window_good) {
+                gps_link_scan_found();
+            } else if (gps_link_window_garbled() || gps_link_expired()) {
+                gps_link_scan_next();
+            }
+            break;
+        case GPS_LINK_CONFIGURE:
+            gps_link_configure_step();
+            break;
+        case GPS_LINK_VERIFY:
+            if (nmea_total_stats.good != gps_link_good) {
+                gps_link_verified();
+            } else if (gps_link_expired()) {
+                gps_link_failed();
+            }
             break;
+        case GPS_LINK_SAVE:
+            if (gps_link_expired()) {
+                gps_save_config();
+                gps_link_idle();
+            }
+            break;
+    }
+}
+
+bool gps_link_busy() { return gps_link != GPS_LINK_IDLE; }
+
+bool gps_set_baudrate(uint32_t baudrate, bool save)
+{
+    // Sent at the current baudrate, the UARTs follow once it has left
+    if (!gps_send_baudrate_command(baudrate)) {
+        return false;
+    }
+    gps_link_baudrate = baudrate;
+    gps_link_save     = save;
+    gps_link_fallback = false;
+    gps_link_scanning = false;
+    gps_link_set_state(GPS_LINK_DRAIN, GPS_LINK_DRAIN_TIMEOUT);
+    return true;
+}
+
+void gps_reconfigure_uart(uint32_t baudrate)
+{
+    if (gps_link_busy()) {
+        return;
     }
+    // Restart the UARTs without touching the module baudrate
+    gps_link_baudrate = baudrate;
+    gps_link_save     = false;
+    gps_link_fallback = false;
+    gps_link_switch();
+}
 
-    size_t len;
-    if (save_command != NULL) {
-        len = strlen(save_command);
-        gps_sendcommand(save_command, len);
+// Queue the configuration of the module at the current baudrate
+static void gps_configure_module()
+{
+    if (gps_link == GPS_LINK_IDLE || gps_link == GPS_LINK_VERIFY) {
+        gps_link_baudrate = huart3.Init.BaudRate;
+        gps_link_start_configure();
     }
 }
 
-void HAL_UART_RxCpltCallback(UART_HandleTypeDef* huart)
+// Half transfer, transfer complete and idle line events for the GPS ring, pos is the DMA write position
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef* huart, uint16_t pos)
 {
     if (huart == &huart3) {
-        for (size_t i = 0; i < GPS_RX_BUFFER_SIZE; i++) {
-            fifo_write(&fifo_buffer_gps, gps_it_buf[i]);
-        }
-        gps_start_gps_rx();
+        uint16_t received = (pos >= gps_rx_last_pos) ? (pos - gps_rx_last_pos) : (pos + GPS_RX_BUFFER_SIZE - gps_rx_last_pos);
+        gps_rx_written += received;
+        gps_rx_last_pos = (pos >= GPS_RX_BUFFER_SIZE) ? 0 : pos;
     } else if (huart == &huart2) {
-        for (size_t i = 0; i < COMM_RX_BUFFER_SIZE; i++) {
-            fifo_write(&fifo_buffer_comm, comm_it_buf[i]);
+        bridge_host_rx_event(pos);
+    }
+}
+
+void HAL_UART_ErrorCallback(UART_HandleTypeDef* huart)
+{
+    if (huart == &huart3) {
+        // Errors are counted per baudrate: a burst of framing errors is the sign of a module at another baudrate
+        gps_baud_stats_t* stats = &gps_baud_stats[gps_rx_baudrate];
+        if (huart->ErrorCode & HAL_UART_ERROR_FE) {
+            stats->framing++;
+        }
+        if (huart->ErrorCode & HAL_UART_ERROR_NE) {
+            stats->noise++;
         }
-        gps_start_comm_rx();
+        if (huart->ErrorCode & HAL_UART_ERROR_ORE) {
+            stats->overrun++;
+        }
+        // Framing, noise or overrun error aborted the DMA transfer, let gps_read() restart it
+        gps_rx_restart = true;
+    } else if (huart == &huart2) {
+        bridge_host_rx_error();
     }
 }
 
 void gps_start_it()
 {
-    gps_start_gps_rx();
-    gps_start_comm_rx();
+    gps_rx_restart = true;
+    bridge_start();
+    gps_configure_module();
 }
 
 static double gps_parse_coordinate(char* nmea_string, char* coord_string, size_t size)
@@ -315,7 +731,7 @@ static void gps_compute_locator(double lat, double lon) {
     gps_locator[i*2]=0;
 }
 
-static bool change_time(char* time_source, char* time_dest, int correction, int max_value)
+static bool change_time(const char* time_source, char* time_dest, int correction, int max_value)
 {
     bool overlap = false;
     int value = (10*(time_source[0]-'0')) + (time_source[1]-'0') + correction;
@@ -328,203 +744,215 @@ static bool change_time(char* time_source, char* time_dest, int correction, int
     time_dest[1] = (char)((value%10)+'0');
     return overlap;
 }
-// Function to convert GPS date and time strings to a timestamp (seconds since epoch)
-// Assumes the date format is "dd/mm/yyyy" or "mm/dd/yyyy" and time is "hh:mm:ss"
-//  You'll need to adjust the date parsing logic based on your specific date format.
-// uint32_t gps_to_timestamp() {
-//     uint32_t timestamp = 0;
-//     int year = 0, month = 0, day = 0;
-//     int hour = 0, minute = 0, second = 0;
-
-//     // Parse Date
-//     if (sscanf(gps_date, "%d/%d/%d", &day, &month, &year) != 3) {
-//         // Handle parsing error.  Return 0 or some error value.
-//         printf("Error parsing date: %s\n", gps_date);
-//         return 0;
-//     }
-
-//     // Parse Time
-//     if (sscanf(gps_time, "%d:%d:%d", &hour, &minute, &second) != 3) {
-//         // Handle parsing error
-//         printf("Error parsing time: %s\n", gps_time);
-//         return 0;
-//     }
-
-//     // Adjust for year 1970.  This is important for timestamp calculation.
-//     year -= 1970;
-
-//     // Calculate the number of days since 1970.
-//     // This is a simplified calculation and does not account for leap years correctly.
-//     //  For more accurate calculations, you'll need to account for leap years.
-//     uint32_t days = (year * 365) + (year / 4);  // Approximate leap year calculation
-//     days += (month - 1) * 30;
-//     days += day;
-
-//     // Calculate total seconds
-//     timestamp = (days * 24 * 60 * 60) + (hour * 60 * 60) + (minute * 60) + second;
-
-//     return timestamp;
-// }
-// Improved leap year calculation
-bool is_leap_year(int year) {
-    return (year % 4 == 0 && year % 100 != 0) || (year % 400 == 0);
-}
-
-uint32_t gps_to_timestamp_accurate() {
-    int year = 0, month = 0, day = 0;
-    int hour = 0, minute = 0, second = 0;
-
-    if (sscanf(gps_date, "%d/%d/%d", &day, &month, &year) != 3) {
-        // printf("Error parsing date: %s\n", gps_date);
-        return 0;
+// Pointer to the start of field 'index' of a sentence (field 0 is the address), or NULL
+// Unlike strtok() empty fields are preserved, and the line is left untouched
+static const char* gps_field(const char* line, int index)
+{
+    while (index > 0) {
+        line = strchr(line, ',');
+        if (line == NULL) {
+            return NULL;
+        }
+        line++;
+        index--;
     }
+    return line;
+}
 
-    if (sscanf(gps_time, "%d:%d:%d", &hour, &minute, &second) != 3) {
-        // printf("Error parsing time: %s\n", gps_time);
-        return 0;
+// Copy a field up to the next separator, truncated to 'size' - 1 chars (empty for a missing field)
+static void gps_copy_field(const char* field, char* dest, size_t size)
+{
+    size_t len = 0;
+    while (field != NULL && field[len] != ',' && field[len] != '*' && field[len] != '\0' && len < size - 1) {
+        dest[len] = field[len];
+        len++;
     }
+    dest[len] = '\0';
+}
 
-    // Calculate days since 1970.
-    int days = 0;
-    for (int y = 1970; y < year; ++y) {
-        if (is_leap_year(y)) {
-            days += 366;
-        } else {
-            days += 365;
+// Numeric fields, 0 when missing or empty (atoi() and atof() stop at the separator)
+static int gps_field_int(const char* line, int index)
+{
+    const char* field = gps_field(line, index);
+    return field != NULL ? atoi(field) : 0;
+}
+
+static double gps_field_double(const char* line, int index)
+{
+    const char* field = gps_field(line, index);
+    return field != NULL ? atof(field) : 0;
+}
+
+static bool gps_parse_digits(const char* field, int count, uint32_t* value)
+{
+    *value = 0;
+    for (int i = 0; i < count; i++) {
+        if (field[i] < '0' || field[i] > '9') {
+            return false;
         }
+        *value = *value * 10 + (field[i] - '0');
     }
+    return true;
+}
 
-    // Add days for the current year
-    int days_in_month[] = {0, 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
-    if (is_leap_year(year)) {
-        days_in_month[2] = 29;
+// Set UTC time base from RMC (hhmmss.ss, status, ..., ddmmyy in field 9) or ZDA (hhmmss.ss, dd, mm, yyyy)
+static void gps_update_utc(const char* line, bool zda)
+{
+    uint32_t    hour, minute, second, day, month, year;
+    const char* time = gps_field(line, 1);
+    if (time == NULL || !gps_parse_digits(time, 2, &hour) || !gps_parse_digits(time + 2, 2, &minute) || !gps_parse_digits(time + 4, 2, &second)) {
+        return;
     }
-    for (int m = 1; m < month; ++m) {
-        days += days_in_month[m];
+    if (zda) {
+        const char* pch = gps_field(line, 2);
+        if (pch == NULL || !gps_parse_digits(pch, 2, &day)) return;
+        pch = gps_field(line, 3);
+        if (pch == NULL || !gps_parse_digits(pch, 2, &month)) return;
+        pch = gps_field(line, 4);
+        if (pch == NULL || !gps_parse_digits(pch, 4, &year)) return;
+    } else {
+        const char* status = gps_field(line, 2);
+        const char* date   = gps_field(line, 9);
+        if (status == NULL || *status != 'A' || date == NULL || !gps_parse_digits(date, 2, &day) || !gps_parse_digits(date + 2, 2, &month)
+            || !gps_parse_digits(date + 4, 2, &year)) {
+            return;
+        }
+        year += 2000;
     }
-    days += day;
-
-    // Calculate total seconds
-    uint32_t timestamp = (days * 24 * 60 * 60) + (hour * 60 * 60) + (minute * 60) + second;
+    utc_set(year, month, day, hour, minute, second);
+}
 
-    return timestamp;
+// Quality weight of the PPS edges that follow a GGA sentence
+static uint16_t gps_compute_pps_weight(uint8_t fix_quality, uint8_t sats, uint32_t hdop)
+{
+    switch (fix_quality) {
+        case 0: // Invalid
+        case 6: // Estimated (dead reckoning)
+        case 8: // Simulation
+            return 0;
+        default:
+            break;
+    }
+    if (sats < GPS_WEIGHT_MIN_SATS || hdop > GPS_WEIGHT_MAX_HDOP) {
+        return 0;
+    }
+    uint32_t weight = GPS_WEIGHT_FULL * ((sats < GPS_WEIGHT_FULL_SATS) ? sats : GPS_WEIGHT_FULL_SATS) / GPS_WEIGHT_FULL_SATS;
+    if (hdop > GPS_WEIGHT_GOOD_HDOP) {
+        weight = weight * GPS_WEIGHT_GOOD_HDOP / hdop;
+    }
+    return weight;
 }
+
 // Maybe use X-CUBE-GNSS here?
 void gps_parse(char* line)
 {
     if (strstr(line, "GGA") == line+3) 
     {
-        char* pch = strtok(line, ",");
-
-        pch = strtok(NULL, ","); // Time
-
-        // GPSDO screen is updated once every second, when receiving the PPS signal
-        // BUT, the GGA frame is received a fraction of second AFTER the PPS pulse
-        // To achieve accurate time display, we will add one second to the received time
-        // to compensate this delay
+        // Fields are read in place: a GGA without fix has empty fields that strtok() would skip
+        const char* pch = gps_field(line, 1); // Time
+        uint32_t    hhmmss;
+        if (pch != NULL && gps_parse_digits(pch, 6, &hhmmss)) {
+            // GPSDO screen is updated once every second, when receiving the PPS signal
+            // BUT, the GGA frame is received a fraction of second AFTER the PPS pulse
+            // To achieve accurate time display, we will add one second to the received time
+            // to compensate this delay
 
-        // Let's start with seconds value, to propagate overlap to minutes and hours if needed
-        bool overlap = change_time(pch+4,gps_time+6,1,59);
-        if(overlap)
-        {   // Need to propagate overlap to minutes
-            overlap = change_time(pch+2,gps_time+3,1,59);
-        }
-        else
-        {
-            gps_time[3] = pch[2];
-            gps_time[4] = pch[3];
-        }
-
-        if (gps_time_offset == 0 && !overlap) 
-        {   // Leave hour unchanged
-	        gps_time[0] = pch[0];
-	        gps_time[1] = pch[1];
-		} 
-        else 
-        {   // Need to fix hour
-			char p0 = pch[0] - '0';
-			char p1 = pch[1] - '0';
-			int hour = p0 * 10 + p1;
-            int relative_hour = (hour + (int)gps_time_offset);
+            // Let's start with seconds value, to propagate overlap to minutes and hours if needed
+            bool overlap = change_time(pch+4,gps_time+6,1,59);
             if(overlap)
-            {   // Propagate second / minute overlap
-                relative_hour+=1;
+            {   // Need to propagate overlap to minutes
+                overlap = change_time(pch+2,gps_time+3,1,59);
             }
-            if(relative_hour >= 24)
+            else
             {
-                hour = relative_hour - 24;
-                gps_day_offset = 1;
+                gps_time[3] = pch[2];
+                gps_time[4] = pch[3];
             }
-            else if(relative_hour < 0)
-            {
-                hour = relative_hour + 24;
-                gps_day_offset = -1;
+
+            if (gps_time_offset == 0 && !overlap) 
+            {   // Leave hour unchanged
+                gps_time[0] = pch[0];
+                gps_time[1] = pch[1];
             }
-            else
-            {
-                hour = relative_hour;
-                gps_day_offset = 0;
+            else 
+            {   // Need to fix hour
+                char p0 = pch[0] - '0';
+                char p1 = pch[1] - '0';
+                int hour = p0 * 10 + p1;
+                int relative_hour = (hour + (int)gps_time_offset);
+                if(overlap)
+                {   // Propagate second / minute overlap
+                    relative_hour+=1;
+                }
+                if(relative_hour >= 24)
+                {
+                    hour = relative_hour - 24;
+                    gps_day_offset = 1;
+                }
+                else if(relative_hour < 0)
+                {
+                    hour = relative_hour + 24;
+                    gps_day_offset = -1;
+                }
+                else
+                {
+                    hour = relative_hour;
+                    gps_day_offset = 0;
+                }
+                gps_time[0] = (char)((hour / 10) + '0');
+                gps_time[1] = (char)((hour % 10) + '0');
             }
-	        gps_time[0] = (char)((hour / 10) + '0');
-	        gps_time[1] = (char)((hour % 10) + '0');
-		}
-        // Add separators
-        gps_time[2] = ':';
-        gps_time[5] = ':';
-        // Terminaute time string
-        gps_time[8] = '\0';
-
-        pch = strtok(NULL, ","); // Latitude
-        gps_latitude_double = gps_parse_coordinate(pch,gps_latitude,sizeof(gps_latitude));
-        pch = strtok(NULL, ","); // N/S
-        if(strlen(pch)<sizeof(gps_n_s))
-        {
-            strcpy(gps_n_s,pch);
-            if(gps_n_s[0] == 'S')
-                gps_latitude_double*=-1;
-        }
-        pch = strtok(NULL, ","); // Longitude
-        gps_longitude_double = gps_parse_coordinate(pch,gps_longitude,sizeof(gps_longitude));
-        pch = strtok(NULL, ","); // E/W
-        if(strlen(pch)<sizeof(gps_e_w))
-        {
-            strcpy(gps_e_w,pch);
-            if(gps_e_w[0] == 'W')
-                gps_longitude_double*=-1;
+            // Add separators
+            gps_time[2] = ':';
+            gps_time[5] = ':';
+            // Terminaute time string
+            gps_time[8] = '\0';
         }
+
+        char coordinate[16];
+        gps_copy_field(gps_field(line, 2), coordinate, sizeof(coordinate)); // Latitude
+        gps_latitude_double = gps_parse_coordinate(coordinate,gps_latitude,sizeof(gps_latitude));
+        gps_copy_field(gps_field(line, 3), gps_n_s, sizeof(gps_n_s)); // N/S
+        if(gps_n_s[0] == 'S')
+            gps_latitude_double*=-1;
+        gps_copy_field(gps_field(line, 4), coordinate, sizeof(coordinate)); // Longitude
+        gps_longitude_double = gps_parse_coordinate(coordinate,gps_longitude,sizeof(gps_longitude));
+        gps_copy_field(gps_field(line, 5), gps_e_w, sizeof(gps_e_w)); // E/W
+        if(gps_e_w[0] == 'W')
+            gps_longitude_double*=-1;
+        gps_latitude_e7  = lround(gps_latitude_double * 1e7);
+        gps_longitude_e7 = lround(gps_longitude_double * 1e7);
         gps_compute_locator(gps_latitude_double,gps_longitude_double);
-        strtok(NULL, ","); // Fix
+        gps_fix_quality = gps_field_int(line, 6); // Fix
 
-        num_sats = atoi(strtok(NULL, ",")); // Num sats used
+        num_sats = gps_field_int(line, 7); // Num sats used
 
-        pch = strtok(NULL, ","); // HDOP
-        if(strlen(pch)<sizeof(gps_hdop))
-        {
-            strcpy(gps_hdop,pch);
+        gps_copy_field(gps_field(line, 8), gps_hdop, sizeof(gps_hdop)); // HDOP
+
+        gps_msl_altitude = gps_field_double(line, 9); // MSL Elevation
+        gps_geoid_separation = gps_field_double(line, 11); // Geoid Separation
+
+        gps_hdop_tenths = lround(atof(gps_hdop) * 10);
+        gps_pps_weight  = gps_compute_pps_weight(gps_fix_quality, num_sats, gps_hdop_tenths);
+        gps_last_gga_time = HAL_GetTick();
+
+        if (gps_fix_quality > 0) {
+            survey_add_position(gps_latitude_e7, gps_longitude_e7,
+                                lround((gps_msl_altitude + gps_geoid_separation) * 100));
         }
-        
-        gps_msl_altitude = atof(strtok(NULL, ",")); // MSL Elevation
-        strtok(NULL, ","); // Unit
-        gps_geoid_separation = atof(strtok(NULL, ",")); // Geoid Separation
-        // strtok(NULL, ","); // Unit
 
         gga_frames++;
+        // Time from the PPS edge to the parsed GGA, in us
+        gps_gga_delay = now().nanos / 1000;
     } 
     else if (strstr(line, "RMC") == line+3) 
     {
-        char* pch = strtok(line, ",");
-
-        pch = strtok(NULL, ","); // Time
-        pch = strtok(NULL, ","); // Alert
-        pch = strtok(NULL, ","); // Latitude
-        pch = strtok(NULL, ","); // N/S
-        pch = strtok(NULL, ","); // Longitude
-        pch = strtok(NULL, ","); // E/W
-        pch = strtok(NULL, ","); // Speed
-        pch = strtok(NULL, ","); // Orientation
-        pch = strtok(NULL, ","); // Date
-
-        if(strlen(pch)>=6)
+        gps_update_utc(line, false);
+        // Time, status, latitude, N/S, longitude, E/W, speed and course come first, all empty without a fix
+        const char* pch = gps_field(line, 9); // Date
+        uint32_t    ddmmyy;
+
+        if (pch != NULL && gps_parse_digits(pch, 6, &ddmmyy))
         {   // Ignore empty dates
             char day0;
             char day1;
@@ -652,6 +1080,18 @@ void gps_parse(char* line)
             gps_date[8] = '\0';
         }
     } 
+    else if (strstr(line, "ZDA") == line+3)
+    {
+        gps_update_utc(line, true);
+    }
+    else if (strstr(line, "GSV") == line+3)
+    {
+        satellites_parse_gsv(line);
+    }
+    else if (strstr(line, "GSA") == line+3)
+    {
+        satellites_parse_gsa(line);
+    }
     else if ((gps_model == GPS_MODEL_UNKNOWN) && strstr(line, "TXT") == line+3) 
     {
         bool model_found = false;
@@ -674,6 +1114,7 @@ void gps_parse(char* line)
         {   // Save changes
             ee_storage.gps_model = gps_model;
             EE_Write();
+            gps_configure_module();
         }
     }
     // Store last received frame for debug purpose
@@ -682,54 +1123,254 @@ void gps_parse(char* line)
         strncpy(gps_last_frame,line+3,sizeof(gps_last_frame)-1);
         gps_last_frame_changed = true;
     }
-    // Get reception time
-    uint32_t timestamp = gps_to_timestamp_accurate();
-    HAL_UART_Transmit_IT(&huart2, (uint8_t *)timestamp, sizeof(line));
     last_frame_receive_time = HAL_GetTick();
 }
 
-#define	SEND_BUFFER_SIZE	FIFO_BUFFER_SIZE
-uint8_t send_buf[SEND_BUFFER_SIZE];
-uint8_t gps_send_buf[SEND_BUFFER_SIZE];
-uint8_t comm_send_buf[SEND_BUFFER_SIZE];
-size_t  send_size;
+static const char* nmea_sentence_names[NMEA_SENTENCE_MAX] = { "GGA", "RMC", "TXT", "GSV", "GSA", "VTG", "GLL", "ZDA", "---" };
+static const char* nmea_talker_names[NMEA_TALKER_MAX]     = { "GP", "GL", "GA", "BD", "GN", "--" };
 
-void gps_read()
+const char* gps_nmea_sentence_name(nmea_sentence_type type) { return nmea_sentence_names[type < NMEA_SENTENCE_MAX ? type : NMEA_SENTENCE_OTHER]; }
+
+const char* gps_nmea_talker_name(nmea_talker_type talker) { return nmea_talker_names[talker < NMEA_TALKER_MAX ? talker : NMEA_TALKER_OTHER]; }
+
+// Checksum of an outgoing sentence: XOR of all chars between '$' and '*' (or end of string)
+uint8_t gps_nmea_checksum(const char* sentence)
+{
+    uint8_t checksum = 0;
+    if (*sentence == '$') {
+        sentence++;
+    }
+    while (*sentence != '\0' && *sentence != '*') {
+        checksum ^= (uint8_t)*sentence++;
+    }
+    return checksum;
+}
+
+// NMEA framer state, the checksum is accumulated while bytes arrive so a complete line can be accepted or rejected without a second pass
+typedef enum { NMEA_STATE_IDLE, NMEA_STATE_BODY, NMEA_STATE_CHECKSUM_HI, NMEA_STATE_CHECKSUM_LO, NMEA_STATE_END } nmea_state;
+typedef enum { NMEA_RESULT_GOOD, NMEA_RESULT_BAD_CHECKSUM, NMEA_RESULT_OVERLONG, NMEA_RESULT_TRUNCATED } nmea_result;
+
+static nmea_state         nmea_rx_state    = NMEA_STATE_IDLE;
+static uint8_t            nmea_rx_checksum = 0;
+static uint8_t            nmea_rx_expected = 0;
+static nmea_sentence_type nmea_rx_sentence = NMEA_SENTENCE_OTHER;
+static nmea_talker_type   nmea_rx_talker   = NMEA_TALKER_OTHER;
+// Ring position of the current sentence '$'
+static uint32_t           nmea_rx_start    = 0;
+
+static void nmea_stats_add(nmea_stats_t* stats, nmea_result result)
+{
+    switch (result) {
+        case NMEA_RESULT_GOOD:
+            stats->good++;
+            break;
+        case NMEA_RESULT_BAD_CHECKSUM:
+            stats->bad_checksum++;
+            break;
+        case NMEA_RESULT_OVERLONG:
+            stats->overlong++;
+            break;
+        case NMEA_RESULT_TRUNCATED:
+            stats->truncated++;
+            break;
+    }
+}
+
+static void gps_end_line(nmea_result result)
+{
+    nmea_stats_add(&nmea_sentence_stats[nmea_rx_sentence], result);
+    nmea_stats_add(&nmea_talker_stats[nmea_rx_talker], result);
+    nmea_stats_add(&nmea_total_stats, result);
+    if (result == NMEA_RESULT_GOOD) {
+        gps_baud_stats[gps_rx_baudrate].valid++;
+    }
+    nmea_rx_state = NMEA_STATE_IDLE;
+}
+
+static inline uint8_t gps_rx_at(uint32_t position) { return gps_rx_ring[position % GPS_RX_BUFFER_SIZE]; }
+
+// Called once the address field ($ttsss) has been received
+static void gps_classify_line()
 {
-    send_size = 0;
-    uint8_t c;
-    while (fifo_read(&fifo_buffer_gps, &c)) {
-        gps_line[gps_line_len++] = c;
-        send_buf[send_size++]    = c;
-        if (c == '\n') {
-            gps_line[gps_line_len] = '\0';
-            gps_parse(gps_line);
-            gps_line_len = 0;
-            continue;
+    char address[5];
+    for (int i = 0; i < 5; i++) {
+        address[i] = gps_rx_at(nmea_rx_start + 1 + i);
+    }
+    nmea_rx_talker = NMEA_TALKER_OTHER;
+    for (int i = 0; i < NMEA_TALKER_OTHER; i++) {
+        if (address[0] == nmea_talker_names[i][0] && address[1] == nmea_talker_names[i][1]) {
+            nmea_rx_talker = i;
+            break;
         }
-        if (gps_line_len >= MAX_GPS_LINE) {
-            gps_line_len = 0;
-            return;
+    }
+    if (address[0] == 'G' && address[1] == 'B') {
+        // Beidou has two talker ids
+        nmea_rx_talker = NMEA_TALKER_BD;
+    }
+    nmea_rx_sentence = NMEA_SENTENCE_OTHER;
+    for (int i = 0; i < NMEA_SENTENCE_OTHER; i++) {
+        if (strncmp(address + 2, nmea_sentence_names[i], 3) == 0) {
+            nmea_rx_sentence = i;
+            break;
+        }
+    }
+}
+
+static int8_t gps_hex_value(uint8_t c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+// Feed the byte at ring position 'position' to the NMEA framer
+// Returns true when a complete sentence with a valid checksum ends with this byte
+static bool gps_ingest(uint8_t c, uint32_t position)
+{
+    if (c == '$') {
+        if (nmea_rx_state != NMEA_STATE_IDLE) {
+            // Previous sentence has been cut short
+            gps_end_line(NMEA_RESULT_TRUNCATED);
         }
+        nmea_rx_start    = position;
+        nmea_rx_checksum = 0;
+        nmea_rx_sentence = NMEA_SENTENCE_OTHER;
+        nmea_rx_talker   = NMEA_TALKER_OTHER;
+        nmea_rx_state    = NMEA_STATE_BODY;
+        return false;
+    }
+
+    switch (nmea_rx_state) {
+        case NMEA_STATE_IDLE:
+            // Wait for next start of sentence
+            return false;
+        case NMEA_STATE_BODY:
+            if (c == '*') {
+                nmea_rx_state = NMEA_STATE_CHECKSUM_HI;
+            } else if (c == '\r' || c == '\n') {
+                // End of line without checksum
+                gps_end_line(NMEA_RESULT_TRUNCATED);
+                return false;
+            } else {
+                nmea_rx_checksum ^= c;
+            }
+            break;
+        case NMEA_STATE_CHECKSUM_HI:
+        case NMEA_STATE_CHECKSUM_LO: {
+            int8_t value = gps_hex_value(c);
+            if (value < 0) {
+                gps_end_line(NMEA_RESULT_TRUNCATED);
+                return false;
+            }
+            if (nmea_rx_state == NMEA_STATE_CHECKSUM_HI) {
+                nmea_rx_expected = value << 4;
+                nmea_rx_state    = NMEA_STATE_CHECKSUM_LO;
+            } else {
+                nmea_rx_expected |= value;
+                nmea_rx_state = NMEA_STATE_END;
+            }
+            break;
+        }
+        case NMEA_STATE_END:
+            if (c == '\n') {
+                bool valid = (nmea_rx_checksum == nmea_rx_expected);
+                gps_end_line(valid ? NMEA_RESULT_GOOD : NMEA_RESULT_BAD_CHECKSUM);
+                return valid;
+            } else if (c != '\r') {
+                gps_end_line(NMEA_RESULT_TRUNCATED);
+                return false;
+            }
+            break;
+    }
+
+    uint32_t len = position - nmea_rx_start + 1;
+    if (len >= MAX_GPS_LINE) {
+        gps_end_line(NMEA_RESULT_OVERLONG);
+        return false;
     }
+    if (len == 6) {
+        gps_classify_line();
+    }
+    return false;
+}
+
+// Get the sentence from nmea_rx_start to end (the '\n' position) as a string
+// It is terminated in place in the ring, and only copied to gps_line when it wraps around the end of the ring
+static char* gps_rx_line(uint32_t end)
+{
+    size_t start_index = nmea_rx_start % GPS_RX_BUFFER_SIZE;
+    size_t end_index   = end % GPS_RX_BUFFER_SIZE;
+    if (end_index >= start_index) {
+        // Replace '\n' by string terminator, DMA won't write there before next ring lap
+        gps_rx_ring[end_index] = '\0';
+        return (char*)gps_rx_ring + start_index;
+    }
+    size_t first_part = GPS_RX_BUFFER_SIZE - start_index;
+    memcpy(gps_line, gps_rx_ring + start_index, first_part);
+    memcpy(gps_line + first_part, gps_rx_ring, end_index);
+    gps_line[first_part + end_index] = '\0';
+    return gps_line;
+}
 
-    // if (send_size) {
-    //     while (huart2.gState != HAL_UART_STATE_READY)
-    //         ;
-    //     memcpy(gps_send_buf, send_buf, SEND_BUFFER_SIZE);
-    //     HAL_UART_Transmit_IT(&huart2, gps_send_buf, send_size);
-    // }
+// Forward the received bytes up to (excluding) 'end' to the host, this must happen before a sentence is terminated in place
+static void gps_rx_forward(uint32_t end)
+{
+    while (gps_rx_forwarded != end) {
+        uint32_t index = gps_rx_forwarded % GPS_RX_BUFFER_SIZE;
+        uint32_t len   = end - gps_rx_forwarded;
+        if (index + len > GPS_RX_BUFFER_SIZE) {
+            len = GPS_RX_BUFFER_SIZE - index;
+        }
+        bridge_to_host(gps_rx_ring + index, len);
+        gps_rx_forwarded += len;
+    }
+}
 
-    send_size = 0;
-    while (fifo_read(&fifo_buffer_comm, &c)) {
-        send_buf[send_size++] = c;
+void gps_read()
+{
+    gps_link_run();
+    if (gps_last_gga_time != 0 && HAL_GetTick() - gps_last_gga_time > GPS_GGA_TIMEOUT) {
+        // GGA lost: the last weight says nothing about the next PPS samples
+        gps_pps_weight = 0;
+    }
+    if (gps_rx_restart) {
+        // Reception was aborted by an UART error or the UART has been reconfigured
+        if (nmea_rx_state != NMEA_STATE_IDLE) {
+            gps_end_line(NMEA_RESULT_TRUNCATED);
+        }
+        gps_start_gps_rx();
+    }
+    uint32_t written = gps_rx_written;
+    if (written - gps_rx_read > GPS_RX_BUFFER_SIZE) {
+        // DMA has lapped the parser, drop what has been overwritten
+        gps_rx_overruns++;
+        if (nmea_rx_state != NMEA_STATE_IDLE) {
+            gps_end_line(NMEA_RESULT_TRUNCATED);
+        }
+        gps_rx_read      = written;
+        gps_rx_forwarded = written;
+    }
+    gps_rx_bytes += written - gps_rx_read;
+    while (gps_rx_read != written) {
+        // UBX and CASIC frames are interleaved with NMEA sentences, binary bytes never reach the NMEA framer.
+        // A framer only syncs while the other one is idle, so sync bytes inside a frame stay with that frame
+        uint8_t c = gps_rx_at(gps_rx_read);
+        if (!ubx_ingest(c) && !casic_ingest(c) && gps_ingest(c, gps_rx_read)) {
+            // Sentence is complete: pass it on untouched, then the boundary is a safe place for telemetry
+            gps_rx_forward(gps_rx_read + 1);
+            bridge_flush_injected();
+            gps_parse(gps_rx_line(gps_rx_read));
+        }
+        gps_rx_read++;
     }
-    
-    if (send_size) {
-        while (huart3.gState != HAL_UART_STATE_READY)
-            ;
-        memcpy(comm_send_buf, send_buf, SEND_BUFFER_SIZE);
-        HAL_UART_Transmit_IT(&huart3, comm_send_buf, send_size);
+    // Forward everything else as is (partial sentences, binary protocol frames)
+    gps_rx_forward(gps_rx_read);
+    if (nmea_rx_state == NMEA_STATE_IDLE) {
+        bridge_flush_injected();
     }
-    
 }
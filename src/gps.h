@@ -6,6 +6,9 @@
 
 #define GPS_DEFAULT_BAUDRATE    9600
 
+// Possible baudrate values
+typedef enum { BAUDRATE_9600, BAUDRATE_19200, BAUDRATE_38400, BAUDRATE_57600, BAUDRATE_115200, BAUDRATE_230400, BAUDRATE_460800, BAUDRATE_921600, BAUDRATE_MAX} baudrate;
+
 extern char     gps_time[];
 extern char     gps_date[];
 extern char     gps_latitude[];
@@ -14,6 +17,9 @@ extern char     gps_n_s[];
 extern char     gps_e_w[];
 extern double   gps_latitude_double;
 extern double   gps_longitude_double;
+// Same position in 1e-7 degrees
+extern int32_t  gps_latitude_e7;
+extern int32_t  gps_longitude_e7;
 extern char     gps_locator[];
 extern double   gps_msl_altitude;
 extern double   gps_geoid_separation;
@@ -21,7 +27,25 @@ extern char     gps_hdop[];
 extern char     gps_last_frame[];
 extern bool     gps_last_frame_changed;
 extern uint8_t  num_sats;
+extern uint8_t  gps_fix_quality;
+extern uint16_t gps_hdop_tenths;
 extern uint32_t gga_frames;
+extern uint32_t gps_rx_overruns;
+// Link load measurement: total received bytes and delay from PPS to the parsed GGA sentence (us)
+extern uint32_t gps_rx_bytes;
+extern uint32_t gps_gga_delay;
+// NMEA reception statistics, per sentence type and per talker
+typedef enum { NMEA_SENTENCE_GGA, NMEA_SENTENCE_RMC, NMEA_SENTENCE_TXT, NMEA_SENTENCE_GSV, NMEA_SENTENCE_GSA, NMEA_SENTENCE_VTG, NMEA_SENTENCE_GLL, NMEA_SENTENCE_ZDA, NMEA_SENTENCE_OTHER, NMEA_SENTENCE_MAX } nmea_sentence_type;
+typedef enum { NMEA_TALKER_GP, NMEA_TALKER_GL, NMEA_TALKER_GA, NMEA_TALKER_BD, NMEA_TALKER_GN, NMEA_TALKER_OTHER, NMEA_TALKER_MAX } nmea_talker_type;
+typedef struct {
+    uint32_t good;
+    uint32_t bad_checksum;
+    uint32_t overlong;
+    uint32_t truncated;
+} nmea_stats_t;
+extern nmea_stats_t nmea_sentence_stats[NMEA_SENTENCE_MAX];
+extern nmea_stats_t nmea_talker_stats[NMEA_TALKER_MAX];
+extern nmea_stats_t nmea_total_stats;
 // GPS module models
 typedef enum { GPS_MODEL_ATGM336H,  GPS_MODEL_NEO6M, GPS_MODEL_NEOM9N, GPS_MODEL_UNKNOWN } gps_model_type;
 extern gps_model_type   gps_model;
@@ -32,13 +56,50 @@ extern int8_t   gps_time_offset;
 extern int8_t   gps_day_offset;
 // Last tiem a frame was received
 extern uint32_t last_frame_receive_time;
+// Quality weight of the PPS samples, from the fix type, satellite count and HDOP of the last GGA (0 = reject sample)
+#define GPS_WEIGHT_FULL 256
+extern volatile uint16_t gps_pps_weight;
+// Quantization error (ps) of the next PPS edge, as reported by the GPS module, consumed by the capture interrupt
+extern volatile int32_t gps_pps_qerr;
+extern volatile bool    gps_pps_qerr_valid;
 
 void gps_start_it();
 void gps_parse(char* line);
 void gps_read();
 
-int	 gps_configure_module_uart(uint32_t baudrate);
+uint8_t     gps_nmea_checksum(const char* sentence);
+const char* gps_nmea_sentence_name(nmea_sentence_type type);
+const char* gps_nmea_talker_name(nmea_talker_type talker);
+
+// Module link state machine, stepped by gps_read()
+typedef struct {
+    uint32_t switches;  // UART baudrate changes
+    uint32_t retries;   // Commands sent again after an ACK timeout
+    uint32_t timeouts;  // Commands given up after all retries
+    uint32_t rejected;  // Commands NAKed or given up
+    uint32_t failures;  // Baudrate changes not followed by a valid sentence
+    uint32_t scans;     // Baudrate detections started
+    uint32_t detections;// Module found at another baudrate
+} gps_link_stats_t;
+extern gps_link_stats_t gps_link_stats;
+// Reception statistics per GPS UART baudrate: valid sentences and USART framing / noise / overrun errors
+typedef struct {
+    uint32_t valid;
+    uint32_t framing;
+    uint32_t noise;
+    uint32_t overrun;
+} gps_baud_stats_t;
+extern gps_baud_stats_t gps_baud_stats[BAUDRATE_MAX];
+// Last baudrate a valid sentence was received at after a change, 0 if unknown
+extern uint32_t         gps_good_baudrate;
+
+void gps_link_run();
+bool gps_link_busy();
+// Change the module and UART baudrate, save stores it in ee_storage and on the module once verified. Returns false if the module does not support it
+bool gps_set_baudrate(uint32_t baudrate, bool save);
+// Restart the UARTs at the given baudrate without reconfiguring the module baudrate
 void gps_reconfigure_uart(uint32_t baudrate);
-void gps_save_config();
+// Called by the UBX / CASIC parsers on ACK-ACK and ACK-NAK
+void gps_command_acknowledged(uint8_t msg_class, uint8_t msg_id, bool ack);
 
 #endif
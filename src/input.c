@@ -0,0 +1,112 @@
+#include "input.h"
+#include "main.h"
+
+// Power of 2, so that the free running indexes wrap cleanly
+#define INPUT_QUEUE_SIZE    16
+
+// Filled by the SysTick interrupt only, read by the main loop only
+static input_event_t     input_queue[INPUT_QUEUE_SIZE];
+static volatile uint32_t input_queue_head = 0;
+static volatile uint32_t input_queue_tail = 0;
+
+// Press edges seen by the EXTI, so that a press shorter than a tick is still noticed
+static volatile uint32_t input_press_edges     = 0;
+static uint32_t          input_last_press_edges = 0;
+
+// Button state, only used by input_tick()
+static bool     input_down           = false;
+static bool     input_long_sent      = false;
+static uint32_t input_down_time      = 0;
+static uint32_t input_up_time        = 0;   // Last time the button was seen released while down
+static uint32_t input_release_time   = 0;
+static uint32_t input_last_click     = 0;   // Press time of the last click, 0 once used by a double click
+static uint16_t input_encoder_count  = 0;
+
+bool input_get_event(input_event_t* event)
+{
+    uint32_t tail = input_queue_tail;
+    if (tail == input_queue_head) {
+        return false;
+    }
+    // The slot must not be read before the head that publishes it
+    __DMB();
+    *event = input_queue[tail % INPUT_QUEUE_SIZE];
+    // Nor released to the producer before it is read
+    __DMB();
+    input_queue_tail = tail + 1;
+    return true;
+}
+
+static bool input_push(input_event_type type, int16_t detents, uint32_t time)
+{
+    uint32_t head = input_queue_head;
+    if (head - input_queue_tail >= INPUT_QUEUE_SIZE) {
+        return false;
+    }
+    input_queue[head % INPUT_QUEUE_SIZE] = (input_event_t) { .type = type, .detents = detents, .time = time };
+    // The slot must be written before the head publishes it
+    __DMB();
+    input_queue_head = head + 1;
+    return true;
+}
+
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
+{
+    if (GPIO_Pin == ROTARY_PRESS_Pin && HAL_GPIO_ReadPin(ROTARY_PRESS_GPIO_Port, ROTARY_PRESS_Pin) == GPIO_PIN_RESET) {
+        input_press_edges++;
+    }
+}
+
+static void input_sample_button(uint32_t now)
+{
+    uint32_t edges   = input_press_edges;
+    bool     pressed = edges != input_last_press_edges || HAL_GPIO_ReadPin(ROTARY_PRESS_GPIO_Port, ROTARY_PRESS_Pin) == GPIO_PIN_RESET;
+    input_last_press_edges = edges;
+
+    if (!input_down) {
+        // Bounces of the last release are not a new press
+        if (pressed && now - input_release_time >= INPUT_DEBOUNCE_TIME) {
+            input_down      = true;
+            input_long_sent = false;
+            input_down_time = now;
+            input_up_time   = now;
+        }
+        return;
+    }
+    if (pressed) {
+        input_up_time = now;
+        if (!input_long_sent && now - input_down_time >= INPUT_LONG_PRESS_TIME) {
+            input_long_sent = input_push(INPUT_LONG_PRESS, 0, now);
+        }
+    } else if (now - input_up_time >= INPUT_DEBOUNCE_TIME) {
+        input_down         = false;
+        input_release_time = now;
+        if (!input_long_sent) {
+            // A full queue drops the click, it would take more than a second of stalled main loop to fill it with clicks
+            input_push(INPUT_CLICK, 0, input_down_time);
+            if (input_last_click != 0 && input_down_time - input_last_click <= INPUT_DOUBLE_CLICK_TIME) {
+                input_push(INPUT_DOUBLE_CLICK, 0, input_down_time);
+                input_last_click = 0;
+            } else {
+                input_last_click = input_down_time;
+            }
+        }
+    }
+}
+
+static void input_sample_encoder(uint32_t now)
+{
+    // 2 counts per detent, an odd count is kept for next time
+    int16_t detents = (int16_t)(TIM3->CNT - input_encoder_count) / 2;
+    // Turns are left in the hardware counter while the queue is full
+    if (detents != 0 && input_push(INPUT_ROTATE, detents, now)) {
+        input_encoder_count += detents * 2;
+    }
+}
+
+void input_tick()
+{
+    uint32_t now = HAL_GetTick();
+    input_sample_button(now);
+    input_sample_encoder(now);
+}
@@ -0,0 +1,28 @@
+#ifndef _INPUT_H_
+#define _INPUT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Rotary encoder and push button events: the button EXTI only counts press edges, the SysTick interrupt samples the button
+// and the encoder counter, turns them into timestamped events and pushes them in a queue read by the main loop.
+// Nothing is lost while the main loop is stalled (flash write, UART reconfiguration...), events keep their own time
+
+#define INPUT_DEBOUNCE_TIME     50      // ms the button must stay released before a release is accepted
+#define INPUT_LONG_PRESS_TIME   1000    // ms held down for a long press (no click is sent on release)
+#define INPUT_DOUBLE_CLICK_TIME 400     // ms between the two presses of a double click
+
+typedef enum { INPUT_CLICK, INPUT_LONG_PRESS, INPUT_DOUBLE_CLICK, INPUT_ROTATE } input_event_type;
+
+typedef struct {
+    input_event_type type;
+    int16_t          detents;   // INPUT_ROTATE: signed number of detents
+    uint32_t         time;      // HAL tick of the event
+} input_event_t;
+
+// Next event, returns false when the queue is empty. A double click comes after the click of its second press
+bool input_get_event(input_event_t* event);
+// Sample the button and the encoder, called every ms
+void input_tick();
+
+#endif
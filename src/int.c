@@ -3,6 +3,8 @@
 #include "frequency.h"
 #include "tim.h"
 #include "menu.h"
+#include "gps.h"
+#include "utc.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -33,6 +35,9 @@ volatile int32_t  pps_error        = 0;
 volatile int32_t  pps_millis       = 0;
 volatile uint32_t pps_shift_count  = 0;
 volatile uint32_t pps_sync_count   = 0;
+// Quality weight of the last PPS sample and number of samples rejected for a poor GPS fix
+volatile uint16_t pps_weight       = GPS_WEIGHT_FULL;
+volatile uint32_t pps_rejected     = 0;
 // Icon to shwow at the top right corner of the screen
 volatile uint8_t  current_state_icon = ' ';
 volatile bool     refresh_screen   = false;
@@ -99,6 +104,9 @@ static int32_t compute_square_adjustment(int32_t error, uint32_t factor, uint32_
     return result;
 }
 
+// Samples taken with a poor GPS fix move the OCXO less
+static int32_t weight_adjustment(int32_t adjustment) { return adjustment * pps_weight / GPS_WEIGHT_FULL; }
+
 static void apply_adjustment(int32_t adjustment)
 {
     if ((TIM1->CCR2 + adjustment) > 0xFFFF)
@@ -130,6 +138,7 @@ void dankar_correction_algo(int32_t current_error)
         } else {
             adjustment = current_error;
         }
+        adjustment = weight_adjustment(adjustment);
         // Apply it
         apply_adjustment(-adjustment);
         ppb_correction = -adjustment;
@@ -152,6 +161,7 @@ void fredzo_correction_algo(int32_t current_error)
         } else {
             adjustment = current_error;
         }
+        adjustment = weight_adjustment(adjustment);
         // Apply it
         apply_adjustment(-adjustment);
         ppb_correction = -adjustment;
@@ -194,12 +204,25 @@ void eric_h_correction_algo()
     ppb_correction = adjustment;
 }
 
+// GPS receivers place the PPS edge on their own clock grid, the reported quantization error (sawtooth) of this edge is removed from the capture
+// qErr is in ps, one TIM1 tick is 1e12 / 70e6 = 100000 / 7 ps
+static int32_t pps_qerr_ticks()
+{
+    if (!gps_pps_qerr_valid) {
+        return 0;
+    }
+    gps_pps_qerr_valid = false;
+    int32_t qerr = gps_pps_qerr;
+    return (qerr * 7 + ((qerr >= 0) ? 50000 : -50000)) / 100000;
+}
+
 // This gets run each time PPS goes high
 void HAL_TIM_IC_CaptureCallback(TIM_HandleTypeDef* htim)
 {
     if (htim->Channel == HAL_TIM_ACTIVE_CHANNEL_1) {
 
-        capture = HAL_TIM_ReadCapturedValue(htim, TIM_CHANNEL_1);
+        uint32_t raw_capture = HAL_TIM_ReadCapturedValue(htim, TIM_CHANNEL_1);
+        capture = raw_capture - pps_qerr_ticks();
 
         uint32_t current_tick = HAL_GetTick();
         // Ignore first capture and do a sanity check on elapsed time since previous PPS
@@ -227,8 +250,14 @@ void HAL_TIM_IC_CaptureCallback(TIM_HandleTypeDef* htim)
 
             int32_t current_error = frequency_get_error();
 
-            if (allow_adjustment) 
-            {   // No crrection during warmup
+            // Weight of this sample, from the GGA received after the previous PPS
+            pps_weight = gps_pps_weight;
+            if (pps_weight == 0) {
+                pps_rejected++;
+            }
+
+            if (allow_adjustment && pps_weight > 0) 
+            {   // No crrection during warmup or with a poor GPS fix
 
                 // Choos from 3 correction algorithms :
                 // - Dankar (original code from Dankar + added correction factor defaulted to values that match the original code)
@@ -248,6 +277,10 @@ void HAL_TIM_IC_CaptureCallback(TIM_HandleTypeDef* htim)
                         break;
                 }
             }
+            else
+            {
+                ppb_correction = 0;
+            }
 
             // Save values for ppb and pps display
             ppb_frequency = frequency;
@@ -255,14 +288,17 @@ void HAL_TIM_IC_CaptureCallback(TIM_HandleTypeDef* htim)
             ppb_millis = current_tick - last_pps - 1000;
             pps_millis = (pps_error/7); // Clock is 70 MHz and we want the value in 10s of microseconds so 10 0000 000 / 70 000 000 = 1/7
 
-            if (allow_adjustment) 
-            {   // Also remove warmup samples from circular buffer
-                circbuf_add(&circular_buffer, current_error);
+            if (allow_adjustment && pps_weight > 0) 
+            {   // Also remove warmup and rejected samples from circular buffer
+                circbuf_add(&circular_buffer, current_error, pps_weight);
                 if (num_samples < CIRCULAR_BUFFER_LEN)
                     num_samples++;
             }
         }
 
+        // Advance UTC time base
+        utc_pps(raw_capture, timer_overflows);
+
         previous_capture = capture;
         timer_overflows  = 0;
         first            = 0;
@@ -288,6 +324,11 @@ void update_contrast()
     TIM1->CCR3 = pwm_value;
 }
 
+void restart_pps_measurement()
+{   // Next capture is handled like the first one
+    first = 1;
+}
+
 uint32_t get_default_correction_factor(correction_algo_type algo)
 {
     switch(algo)
@@ -329,12 +370,12 @@ uint32_t increment_correction_factor_value(correction_algo_type algo, uint32_t v
             incFactor = 1;
             break;
     }
-    uint32_t new_factor = value + (incFactor*increment);
-    if(new_factor < minVal)
+    int32_t new_factor = (int32_t)value + (int32_t)incFactor*increment;
+    if(new_factor < (int32_t)minVal)
     {
         new_factor = minVal;
     }
-    else if(new_factor > maxVal)
+    else if(new_factor > (int32_t)maxVal)
     {
         new_factor = maxVal;
     }
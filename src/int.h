@@ -6,8 +6,10 @@
 
 extern volatile bool     allow_adjustment;
 extern volatile uint32_t frequency;
+extern volatile uint32_t timer_overflows;
 extern volatile uint32_t num_samples;
 extern volatile uint32_t device_uptime;
+extern volatile uint32_t last_pps;
 extern volatile uint32_t last_pps_out;
 extern volatile bool     pps_out_up;
 extern volatile int8_t   contrast;
@@ -21,6 +23,8 @@ extern volatile int32_t  ppb_millis;
 extern volatile int32_t  pps_error;
 extern volatile int32_t  pps_millis;
 extern volatile uint32_t pps_sync_count;
+extern volatile uint16_t pps_weight;
+extern volatile uint32_t pps_rejected;
 extern volatile uint8_t  current_state_icon;
 extern volatile bool     refresh_screen;
 extern volatile bool     sync_pps_out;
@@ -42,6 +46,9 @@ extern uint32_t warmup_time_seconds;
 
 void update_contrast();
 
+// Drop the next PPS period measurement (timer overflows have been missed while the CPU was stalled)
+void restart_pps_measurement();
+
 uint32_t get_default_correction_factor(correction_algo_type algo);
 
 uint32_t increment_correction_factor_value(correction_algo_type algo, uint32_t value, int increment);
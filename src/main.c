@@ -1,10 +1,16 @@
 #include "main.h"
 #include "LCD.h"
+#include "bridge.h"
+#include "display.h"
 #include "eeprom.h"
 #include "frequency.h"
 #include "gps.h"
 #include "menu.h"
+#include "survey.h"
 #include "int.h"
+#include "telemetry.h"
+#include "trend.h"
+#include "trend_log.h"
 #include "tim.h"
 #include <math.h>
 #include <stdbool.h>
@@ -89,6 +95,10 @@ void gpsdo(void)
         ee_storage.trend_h_scale = 1;
     }
     trend_h_scale = ee_storage.trend_h_scale;
+    if (ee_storage.trend_source >= TREND_CHANNEL_MAX) {
+        ee_storage.trend_source = TREND_CHANNEL_PPB;
+    }
+    trend_source = ee_storage.trend_source;
     // Boot menu
     if (ee_storage.boot_menu == 0xff) {
         ee_storage.boot_menu = 0; // Default to main screen
@@ -130,6 +140,8 @@ void gpsdo(void)
         ee_storage.warmup_time_seconds = get_default_warmup_time(ocxo_model);
     }
     warmup_time_seconds = ee_storage.warmup_time_seconds;
+    // Survey-in
+    survey_init();
 
 
     gps_start_it();
@@ -138,13 +150,15 @@ void gpsdo(void)
     menu_set_correction_algorithm(correction_algorithm);
 
     LCD_Init();
+    display_init();
 
-    lcd_create_chars();
-    init_trend_values();
+    trend_init();
+    trend_select_aux(trend_source);
+    trend_log_init();
 
     // warmup();
 
-    LCD_Clear();
+    display_clear();
 
     HAL_Delay(100);
     frequency_start();
@@ -154,7 +168,13 @@ void gpsdo(void)
 
     bool vco_adjust_allowed = false;
 
+    // Cycle counter, to measure the main loop latency
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
     while (1) {
+        uint32_t loop_start = DWT->CYCCNT;
         uint32_t now = HAL_GetTick();
         if(pps_out_up && now-last_pps_out >= PPS_PULSE_WIDTH)
         {
@@ -173,6 +193,10 @@ void gpsdo(void)
         }
         
         gps_read();
+        bridge_run();
         menu_run();
+        trend_log_run();
+        telemetry_run();
+        telemetry_loop_time(DWT->CYCCNT - loop_start);
     }
 }
@@ -1,58 +1,29 @@
 #include "frequency.h"
 
 #include <stdbool.h>
-#include <stdio.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 
-#include "LCD.h"
+#include "display.h"
 #include "eeprom.h"
+#include "format.h"
 #include "gps.h"
-#include "stm32f1xx_hal_gpio.h"
+#include "input.h"
 #include "int.h"
 #include "menu.h"
+#include "satellites.h"
+#include "survey.h"
+#include "trend.h"
 
 /// All times in ms
-#define DEBOUNCE_TIME           50
+#define ENCODER_IDLE_TIME       250     // Encoder considered stopped after this time without detent
 #define BOOT_MENU_SAVE_TIME     3*1000
 
 // Firmware version tag
 #define FIRMWARE_VERSION        "v0.1.16"
 
-volatile uint32_t rotary_down_time      = 0;
-volatile uint32_t rotary_up_time        = 0;
-volatile bool     rotary_press_detected = 0;
-
-
-
-bool rotary_is_down() { return rotary_down_time > rotary_up_time && (HAL_GetTick() - rotary_down_time) > DEBOUNCE_TIME; }
-
-bool rotary_get_click()
-{
-    bool is_down = rotary_is_down();
-
-    if (is_down && !rotary_press_detected) {
-        rotary_press_detected = true;
-        return true;
-    } else if (!is_down) {
-        rotary_press_detected = false;
-    }
-
-    return false;
-}
-
-void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
-{
-    if (GPIO_Pin == ROTARY_PRESS_Pin) {
-        if (HAL_GPIO_ReadPin(ROTARY_PRESS_GPIO_Port, ROTARY_PRESS_Pin) == GPIO_PIN_SET) {
-            rotary_up_time = HAL_GetTick();
-        } else {
-            rotary_down_time = HAL_GetTick();
-        }
-    }
-}
-
 uint8_t sat_icons[][8] =        {   { 0b00000, 0b00000, 0b00000, 0b00000, 0b00000, 0b10000, 0b00000, 0b00000 },
                                     { 0b00000, 0b00000, 0b00000, 0b11000, 0b00100, 0b10100, 0b00000, 0b00000 },
                                     { 0b00000, 0b11100, 0b00010, 0b11001, 0b00101, 0b10101, 0b00000, 0b00000 },
@@ -67,47 +38,56 @@ uint8_t sat_icons_lock[][8] =   {   { 0b00010, 0b00111, 0b00111, 0b00000, 0b0000
                                     { 0b00000, 0b11100, 0b00010, 0b11001, 0b00101, 0b10101, 0b00000, 0b00000 },
                                 };
 
-void lcd_create_chars()
+// ASCII replacement of the state icons, when no custom char is left
+static char menu_state_icon_fallback(uint8_t code)
 {
-    for (int i = 0; i < 5; i++) {
-        LCD_CreateChar(i+1, ppb_lock_status ? sat_icons_lock[i] : sat_icons[i]);
+    switch (code)
+    {
+        default:
+        case 1:
+            return SAT_ICON_1_CODE;
+        case 2:
+            return SAT_ICON_2_CODE;
+        case 3:
+            return SAT_ICON_3_CODE;
+        case 4:
+            return NO_SAT_STD_ICON_CODE;
     }
 }
 
-typedef enum { SCREEN_MAIN, SCREEN_DATE, SCREEN_DATE_TIME, SCREEN_TREND, SCREEN_PPB, SCREEN_PWM, SCREEN_GPS, SCREEN_UPTIME, SCREEN_FRAMES, SCREEN_CONTRAST, SCREEN_PPS, SCREEN_VERSION, SCREEN_MAX } menu_screen;
-typedef enum { SCREEN_TREND_MAIN, SCREEN_TREND_AUTO_V, SCREEN_TREND_AUTO_H, SCREEN_TREND_V_SCALE, SCREEN_TREND_H_SCALE, SCREEN_TREND_EXIT, SCREEN_TREND_MAX } menu_trend_screen;
-typedef enum { SCREEN_GPS_TIME, SCREEN_GPS_LATITUDE, SCREEN_GPS_LONGITUDE, SCREEN_GPS_LATITUDE_DEC, SCREEN_GPS_LONGITUDE_DEC, SCREEN_GPS_LOCATOR, SCREEN_GPS_ALTITUDE, SCREEN_GPS_GEOID, SCREEN_GPS_SATELITES, SCREEN_GPS_HDOP, SCREEN_GPS_BAUDRATE, SCREEN_GPS_TIME_OFFSET, SCREEN_GPS_DATE_FORMAT, SCREEN_GPS_MODEL, SCREEN_GPS_LAST_FRAME, SCREEN_GPS_EXIT, SCREEN_GPS_MAX } menu_gps_screen;
-typedef enum { SCREEN_PPB_MEAN, SCREEN_PPB_INST, SCREEN_PPB_FREQUENCY, SCREEN_PPB_ERROR, SCREEN_PPB_CORRECTION, SCREEN_PPB_PWM, SCREEN_PPB_OCXO_MODEL, SCREEN_PPB_WARMUP_TIME, SCREEN_PPB_ALGO, SCREEN_PPB_CORRECTION_FACTOR, SCREEN_PPB_MILLIS, SCREEN_PPB_AUTO_SAVE_PWM, SCREEN_PPB_AUTO_SYNC_PPS, SCREEN_PPB_LOCK_THRESHOLD, SCREEN_PPB_EXIT, SCREEN_PPB_MAX } menu_ppb_screen;
-typedef enum { SCREEN_PPS_SHIFT, SCREEN_PPS_SHIFT_MS, SCREEN_PPS_SYNC_COUNT, SCREEN_PPS_SYNC_MODE, SCREEN_PPS_SYNC_DELAY, SCREEN_PPS_SYNC_THRESHOLD, SCREEN_PPS_FORCE_SYNC, SCREEN_PPS_EXIT, SCREEN_PPS_MAX } menu_pps_screen;
+// State icon codes 1 to 5 are sat icons, drawn as cached custom chars
+static void menu_draw_state_icon(uint8_t code)
+{
+    if(code >= 1 && code <= 5)
+    {
+        display_put_glyph(0,0,ppb_lock_status ? sat_icons_lock[code-1] : sat_icons[code-1],menu_state_icon_fallback(code));
+    }
+    else
+    {
+        display_put_custom(0,0,code);
+    }
+}
 
-// Possible baudrate values
-typedef enum { BAUDRATE_9600, BAUDRATE_19200, BAUDRATE_38400, BAUDRATE_57600, BAUDRATE_115200, BAUDRATE_230400, BAUDRATE_460800, BAUDRATE_921600, BAUDRATE_MAX} baudrate;
+typedef enum { SCREEN_MAIN, SCREEN_DATE, SCREEN_DATE_TIME, SCREEN_TREND, SCREEN_SNR, SCREEN_PPB, SCREEN_PWM, SCREEN_GPS, SCREEN_UPTIME, SCREEN_FRAMES, SCREEN_CONTRAST, SCREEN_PPS, SCREEN_VERSION, SCREEN_MAX } menu_screen;
 
 static menu_screen current_menu_screen = SCREEN_MAIN;
-static menu_trend_screen current_menu_trend_screen = SCREEN_TREND_MAIN;
-static menu_gps_screen current_menu_gps_screen = SCREEN_GPS_TIME;
-static menu_ppb_screen current_menu_ppb_screen = SCREEN_PPB_MEAN;
-static menu_pps_screen current_menu_pps_screen = SCREEN_PPS_SHIFT;
+// Selected sub menu item of each screen
+static uint8_t      menu_item_index[SCREEN_MAX] = { 0 };
+// 0: main menu, 1: sub menu, 2: editing an item
 static uint8_t      menu_level          = 0;
-static uint32_t     last_encoder_value  = 0;
+static uint32_t     last_encoder_time   = 0;
+static uint16_t     encoder_speed       = 0;    // Detents per second, 0 when the encoder starts turning
+static bool         encoder_backward    = false;
 static uint32_t     last_menu_change    = 0;
 
 static bool         auto_save_pwm_done  = false;
 static bool         auto_sync_pps_done  = false;
 
-#define TREND_MAX_SIZE      7208 // 112 * 64 (TREND_MAX_H_SCALE) + 40 (TREND_SCREEN_SIZE)
-#define TREND_SCREEN_SIZE   40
-#define TREND_UNSET_VALUE   0xFFFF
-#define TREND_MAX_H_SCALE   64
-#define TREND_MAX_SHIFT     7168 // 7208 (TREND_MAX_SIZE) - 40 (TREND_SCREEN_SIZE)
-static uint16_t     ppb_trend_values[TREND_MAX_SIZE];
-static uint32_t     ppb_trend_position = 0;
-static uint32_t     ppb_trend_size = 0;
-
 uint32_t    trend_v_scale = 70; 
 uint32_t    trend_h_scale = 1;
 uint32_t    trend_shift = 0; 
 uint8_t     trend_arrow = TREND_LEFT_CODE;
+trend_channel trend_source = TREND_CHANNEL_PPB;
 
 bool        trend_auto_h = true;
 bool        trend_auto_v = true;
@@ -127,15 +107,7 @@ correction_algo_type displayed_correction_algorithm;
 
 static void menu_to_string_with_two_decimals(int value, char *buffer, size_t bufferSize)
 {
-    // Divide the value by 100 and keep the remainder.
-    int integerPart = abs(value / 100);
-    int decimalPart = abs(value % 100);
-
-    // Make sure negative values <0 are displayed correctly.
-    snprintf(buffer, bufferSize, "%s%d.%02d",
-             value < 0 ? "-" : "",
-             integerPart,
-             decimalPart);
+    format_hundredths(buffer, buffer + bufferSize, value);
 }
 
 uint32_t menu_get_baudrate_value(baudrate baudrate_enum)
@@ -216,11 +188,16 @@ void menu_set_gps_baudrate(uint32_t baudrate)
     {   // Baudrate changed
         gps_baudrate = baudrate;
         gps_baudrate_enum = menu_get_baudrate_enum(baudrate);
-        gps_configure_module_uart(gps_baudrate);
-        gps_reconfigure_uart(gps_baudrate);
+        gps_set_baudrate(gps_baudrate, false);
     }
 }
 
+void menu_update_gps_baudrate(uint32_t baudrate)
+{
+    gps_baudrate = baudrate;
+    gps_baudrate_enum = menu_get_baudrate_enum(baudrate);
+}
+
 void menu_set_correction_algorithm(correction_algo_type algo)
 {
     displayed_correction_algorithm = algo;
@@ -237,82 +214,12 @@ void menu_set_current_menu(uint8_t current_menu)
 
 static void menu_force_redraw() { refresh_screen = true; }
 
-void init_trend_values()
-{
-    for(int i = 0 ; i < TREND_MAX_SIZE ; i++)
-    {
-        ppb_trend_values[i] = TREND_UNSET_VALUE;
-    }
-}
-
-static uint32_t get_trend_data(uint32_t index)
-{
-    int32_t read_index = (ppb_trend_position + index);
-    if(read_index<0)
-    {   // Wrap around
-        read_index = TREND_MAX_SIZE + read_index;
-    }
-    return ppb_trend_values[read_index];
-}
-
-static uint32_t get_trend_value(uint32_t position, uint32_t shift, uint32_t h_scale)
-{
-    if(h_scale == 1)
-    {   // No h scaling
-        return get_trend_data(position-TREND_SCREEN_SIZE-shift);
-    }
-    else
-    {   // Compute mean value over h-scale size
-        uint32_t result = 0;
-        uint32_t new_value;
-        for(uint32_t i = 0 ; i < h_scale ; i ++)
-        {   // ' - (ppb_trend_position % h_scale)' : Use the same start position for each point in time within the given scale group
-            new_value = get_trend_data((position*h_scale) + i - (TREND_SCREEN_SIZE*h_scale) - (ppb_trend_position % h_scale) - shift);
-            if(new_value == TREND_UNSET_VALUE)
-            {   // Don't compte mean value if one value is unset
-                return TREND_UNSET_VALUE;
-            }
-            result += new_value;
-        }
-        return result/h_scale;
-    }
-}
-
-static uint32_t get_trend_peak_value(uint32_t shift)
-{
-    uint32_t peak_value = 0;
-    uint32_t cur_value;
-    for(int32_t pos = 0; pos < TREND_SCREEN_SIZE ; pos++)
-    {
-        cur_value = get_trend_value(pos,shift,trend_h_scale);
-        if((cur_value != TREND_UNSET_VALUE) && (cur_value > peak_value))
-        {
-            peak_value = cur_value;
-        }
-    }
-    return peak_value;
-}
-
-static void add_trend_value(uint32_t value)
-{
-    ppb_trend_values[ppb_trend_position]=value;
-    ppb_trend_position++;
-    if(ppb_trend_position>=TREND_MAX_SIZE)
-    {
-        ppb_trend_position = 0;
-    }
-    else
-    {
-        ppb_trend_size++;
-    }
-}
-
 static uint32_t menu_round_v_scale(uint32_t scale)
 {
     uint32_t rounded_scale;
-    if(scale < 70)
-    {   // 70 is the lower possible scale (0.1 ppb = 1px)
-        rounded_scale = 70;
+    if(scale < 40)
+    {   // 40 is the lower possible scale (0.1 ppb = 1px, 4px on each side of zero)
+        rounded_scale = 40;
     }
     else if(scale > 2000)
     {   // For large values round scale to 10 ppb
@@ -332,9 +239,9 @@ static uint32_t menu_round_v_scale(uint32_t scale)
 static uint32_t menu_roud_h_scale(uint32_t scale)
 {
     uint32_t rounded_scale = 0;
-    if(scale > TREND_MAX_H_SCALE)
+    if(scale > trend_max_h_scale(trend_source))
     {
-        rounded_scale = TREND_MAX_H_SCALE;
+        rounded_scale = trend_max_h_scale(trend_source);
     }
     else if(scale < 1)
     {
@@ -342,42 +249,139 @@ static uint32_t menu_roud_h_scale(uint32_t scale)
     }
     else
     {   // Only keep powers of 2
-        uint8_t shift = 6;
-        while(rounded_scale == 0)
+        rounded_scale = 1;
+        while(rounded_scale * 2 <= scale)
         {
-            rounded_scale = ((scale >> shift) << shift);
-            shift--;
+            rounded_scale *= 2;
         }
     }
     return rounded_scale;
 }
 
+// Pixel row of a trend value, 'top' is the value of the top row and 'bottom' the one below the bottom row
+static uint8_t menu_trend_row(int32_t value, int32_t top, int32_t bottom)
+{
+    int32_t row = (top - value) * 8 / (top - bottom);
+    return row < 0 ? 0 : row > 7 ? 7 : row;
+}
+
 static void menu_draw_trend(uint32_t shift)
 {   // Horizontal autoscale
     if(trend_auto_h)
     {   // Need to zoom horizontally
-        trend_h_scale = menu_roud_h_scale(ppb_trend_size/TREND_SCREEN_SIZE);
+        trend_h_scale = menu_roud_h_scale(trend_duration(trend_source)/TREND_SCREEN_SIZE);
     }
-    // Vertical auto-scale
-    if(trend_auto_v)
-    {   // Determine scale, to fit the screen
-        trend_v_scale = menu_round_v_scale(get_trend_peak_value(shift));
+    // The whole screen is read at once, only the points that scrolled in since the last redraw are read from the trend tiers
+    const trend_screen_t* screen = trend_get_screen(trend_source,shift,trend_h_scale);
+    if(screen == NULL)
+    {   // Can't happen, the aux store follows trend_source
+        return;
     }
+    int32_t min = screen->set ? screen->min : 0;
+    int32_t max = screen->set ? screen->max : 0;
+    int32_t peak = abs(min) > abs(max) ? abs(min) : abs(max);
+    int32_t top, bottom;
+    if(trend_source == TREND_CHANNEL_PPB)
+    {   // Vertical auto-scale
+        if(trend_auto_v)
+        {   // Determine scale, to fit the screen
+            trend_v_scale = menu_round_v_scale(peak);
+        }
+        top = trend_v_scale;
+        bottom = -trend_v_scale;
+    }
+    else if(trend_source == TREND_CHANNEL_PHASE)
+    {   // Phase error is centred on zero too, always auto-scaled
+        top = peak < 4 ? 4 : peak;
+        bottom = -top;
+    }
+    else
+    {   // Other sources are fitted to the displayed values
+        top = max + 1;
+        bottom = (max - min < 2) ? max - 1 : min;
+    }
+    // Release the glyphs of the previous graph, identical columns share a glyph
+    display_puts(0,1,"        ");
+    // Each pixel column spans from the min to the max value of its point
     for(int col_screen = 0 ; col_screen < 8 ; col_screen++)
     {
         uint8_t cust_char[8] = {0};
         for(int col_char = 0; col_char < 5 ; col_char++)
         {
-            uint32_t cur_ppb = get_trend_value(col_screen * 5 + col_char,shift,trend_h_scale);
+            const trend_screen_point_t* point = &screen->points[col_screen * 5 + col_char];
             // Ignore unset values
-            if(cur_ppb != TREND_UNSET_VALUE)
-            {   
-                uint8_t cur_val = cur_ppb >= trend_v_scale ? 7 : cur_ppb * 7 / trend_v_scale;
-                cust_char[7-cur_val]  |= (0b10000 >> col_char);
+            if(point->mean != TREND_UNSET_VALUE)
+            {
+                uint8_t top_row    = menu_trend_row(point->max,top,bottom);
+                uint8_t bottom_row = menu_trend_row(point->min,top,bottom);
+                for(uint8_t row = top_row ; row <= bottom_row ; row++)
+                {
+                    cust_char[row] |= (0b10000 >> col_char);
+                }
             }
         }
-        LCD_CreateChar(col_screen,cust_char);
-        LCD_PutCustom(col_screen,1,col_screen);
+        display_put_glyph(col_screen,1,cust_char,' ');
+    }
+}
+
+// Current value of a trend source
+static int32_t menu_trend_sample(trend_channel channel)
+{
+    switch(channel)
+    {
+        case TREND_CHANNEL_PWM:
+            return (int32_t)TIM1->CCR2 - TREND_PWM_OFFSET;
+        case TREND_CHANNEL_PHASE:
+            return pps_error;
+        case TREND_CHANNEL_SATS:
+            return num_sats;
+        case TREND_CHANNEL_HDOP:
+            return gps_hdop_tenths;
+        case TREND_CHANNEL_PPB:
+        default:
+            {
+                int32_t ppb = frequency_get_ppb();
+                return ppb == 0xFFFF ? TREND_UNSET_VALUE : ppb;
+            }
+    }
+}
+
+// C/N0 shown as a full height bar
+#define SNR_FULL_SCALE      50
+
+static void menu_draw_snr()
+{   // Tracked satellites by decreasing C/N0, two bars per custom char: 2 pixels wide if used in the fix, 1 pixel otherwise
+    uint8_t order[SATELLITES_MAX];
+    uint8_t count = 0;
+    for(uint8_t i = 0 ; i < satellites_count ; i++)
+    {
+        if(satellites[i].snr == 0) continue;
+        uint8_t pos = count++;
+        while(pos > 0 && satellites[order[pos-1]].snr < satellites[i].snr)
+        {
+            order[pos] = order[pos-1];
+            pos--;
+        }
+        order[pos] = i;
+    }
+    display_puts(0,1,"        ");
+    for(int col_screen = 0 ; col_screen < 8 ; col_screen++)
+    {
+        uint8_t cust_char[8] = {0};
+        for(int bar = 0; bar < 2 ; bar++)
+        {
+            uint8_t index = col_screen * 2 + bar;
+            if(index >= count) break;
+            const satellite_t* satellite = &satellites[order[index]];
+            uint8_t height = satellite->snr >= SNR_FULL_SCALE ? 8 : (satellite->snr * 8 + SNR_FULL_SCALE / 2) / SNR_FULL_SCALE;
+            if(height == 0) height = 1;
+            uint8_t pixels = (satellites_used(satellite) ? 0b11000 : 0b10000) >> (bar * 3);
+            for(int row = 8 - height; row < 8 ; row++)
+            {
+                cust_char[row] |= pixels;
+            }
+        }
+        display_put_glyph(col_screen,1,cust_char,' ');
     }
 }
 
@@ -393,1124 +397,912 @@ static void menu_format_ppb(char* ppb_string, int32_t ppb_value)
     } else if (ppb > 999999) {
         strcpy(ppb_string, ">10k");
     } else if (ppb > 9999) {
-        snprintf(ppb_string, PPB_STRING_SIZE, "%4ld", (ppb / 100));
+        format_int(ppb_string, ppb_string + PPB_STRING_SIZE, ppb / 100, 4, ' ');
     } else if (ppb > 999) {
-        snprintf(ppb_string, PPB_STRING_SIZE, "%ld.%01ld", ppb / 100, ((ppb % 100)/10));
+        format_fixed(ppb_string, ppb_string + PPB_STRING_SIZE, ppb, 2, 1, 0);
     } else {
-        snprintf(ppb_string, PPB_STRING_SIZE, "%ld.%02ld", ppb / 100, ppb % 100);
+        format_hundredths(ppb_string, ppb_string + PPB_STRING_SIZE, ppb);
     }
 }
 
-static void menu_draw()
+// Trend value of the selected source on 4 chars, large values are shown in thousands ("34k5")
+static void menu_format_trend_value(char* value_string, int32_t value)
 {
-    char    screen_buffer[SCREEN_BUFFER_SIZE];
-    char    ppb_string[PPB_STRING_SIZE];
-    int32_t ppb;
-
-    switch (current_menu_screen) {
-    default:
-    case SCREEN_MAIN:
-    case SCREEN_DATE:
-    case SCREEN_DATE_TIME:
-        // Main screen with satellites, ppb and UTC time
-        menu_format_ppb(ppb_string,frequency_get_ppb());
-        snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%02d %s", num_sats, ppb_string);
-        LCD_Puts(1, 0, screen_buffer);
-        if(current_menu_screen == SCREEN_MAIN)
-        {
-            LCD_Puts(0, 1, gps_time);
+    char* end = value_string + PPB_STRING_SIZE;
+    if(trend_source == TREND_CHANNEL_PPB || value == TREND_UNSET_VALUE)
+    {
+        menu_format_ppb(value_string, value == TREND_UNSET_VALUE ? 0xFFFF : value);
+        return;
+    }
+    if(trend_source == TREND_CHANNEL_PWM)
+    {
+        value += TREND_PWM_OFFSET;
+    }
+    if(trend_source == TREND_CHANNEL_HDOP)
+    {
+        format_fixed(value_string, end, value, 1, 1, 4);
+    }
+    else if(value >= -999 && value <= 9999)
+    {
+        format_int(value_string, end, value, 4, ' ');
+    }
+    else if(value > -10000 && value < 100000)
+    {
+        char* p = format_char(format_int(value_string, end, value / 1000, 0, ' '), end, 'k');
+        format_int(p, end, abs(value % 1000) / 100, 0, ' ');
+    }
+    else
+    {
+        format_char(format_int(value_string, end, value / 1000, 3, ' '), end, 'k');
+    }
+}
+
+// Source letter shown left of the current value on the trend screen
+static const char trend_source_tags[TREND_CHANNEL_MAX] = { ' ', 'W', 'P', 'S', 'H' };
+static const char* const trend_source_names[TREND_CHANNEL_MAX] = { "     PPB", "     PWM", "   Phase", "    Sats", "    HDOP" };
+
+// Sub menus are const tables (kept in flash) of items, browsed, drawn, edited and saved by a generic engine:
+// a new setting is a new table entry, with hooks only for what the engine can't do
+typedef enum { MENU_SHOW_NONE, MENU_SHOW_NUMBER, MENU_SHOW_HUNDREDTHS, MENU_SHOW_ON_OFF, MENU_SHOW_NAMES, MENU_SHOW_STRING, MENU_SHOW_CUSTOM } menu_show;
+
+// Item flags
+#define MENU_ITEM_EDIT          0x01    // Click enters edit mode
+#define MENU_ITEM_WRAP          0x02    // Value wraps around its range instead of stopping at the limits
+#define MENU_ITEM_ACTION        0x04    // Click runs the commit hook without entering edit mode
+#define MENU_ITEM_EXIT          0x08    // Click goes back to the main menu, on the first item
+
+typedef struct menu_item_s menu_item_t;
+// Edit increments are multiplied by the factor of the last curve step reached by the encoder speed
+typedef struct {
+    uint16_t    speed;      // Detents per second
+    uint16_t    factor;
+} menu_accel_step_t;
+
+struct menu_item_s {
+    const char*             label;      // Shown from column 1 of the first row, a trailing ':' becomes '?' while editing
+    uint8_t                 flags;
+    menu_show               show;
+    const volatile void*    value;      // Variable shown and edited (a string for MENU_SHOW_STRING), signed if min < 0
+    uint8_t                 size;
+    int32_t                 min;
+    int32_t                 max;
+    int32_t                 step;
+    uint8_t                 width;      // MENU_SHOW_NUMBER minimum width, padded with 'pad' (spaces if 0)
+    char                    pad;
+    const char* const*      names;      // MENU_SHOW_NAMES, from min to max
+    uint8_t                 ee_offset;  // ee_storage field saved when leaving edit mode, if ee_size is not 0
+    uint8_t                 ee_size;
+    const volatile bool*    lock;       // Can't be edited while true
+    void (*draw)(bool editing);                             // MENU_SHOW_CUSTOM: second row, and first one if there is no label
+    void (*edit)(const menu_item_t* item, int increment);   // Replaces the range based edit
+    void (*commit)();                                       // When leaving edit mode, before the ee field is saved
+    const menu_accel_step_t* accel;     // Acceleration curve of the edit increment, none for a constant one
+    uint8_t                 accel_count;
+};
+
+#define MENU_VALUE(variable)        .value = &(variable), .size = sizeof(variable)
+#define MENU_RANGE(low, high, inc)  .min = (low), .max = (high), .step = (inc)
+#define MENU_EE(field)              .ee_offset = offsetof(ee_storage_t, field), .ee_size = sizeof(ee_storage.field)
+#define MENU_ACCEL(curve)           .accel = (curve), .accel_count = sizeof(curve) / sizeof(curve[0])
+#define MENU_EXIT                   { .label = "Exit?", .flags = MENU_ITEM_EXIT }
+
+// Screen flags
+#define MENU_SCREEN_SUB_MENU    0x01    // Click opens the item list
+#define MENU_SCREEN_DIRECT      0x02    // Click edits the first item
+#define MENU_SCREEN_GRAPHIC     0x04    // May need all 8 custom chars
+#define MENU_SCREEN_BOOT        0x08    // Can be saved as boot screen
+
+typedef struct {
+    void                (*draw)();  // Main menu view, NULL to show the first item
+    const menu_item_t*  items;
+    uint8_t             item_count;
+    uint8_t             flags;
+} menu_screen_t;
+
+#define MENU_ITEMS(items)           items, sizeof(items) / sizeof(items[0])
+
+// A few hundred positions
+static const menu_accel_step_t menu_accel_medium[] = { { 8, 5 }, { 20, 20 } };
+// Trend history, up to 7168 points
+static const menu_accel_step_t menu_accel_scroll[] = { { 8, 4 }, { 20, 16 }, { 40, 64 } };
+// Settings going up to tens of thousands
+static const menu_accel_step_t menu_accel_large[] = { { 8, 10 }, { 20, 100 }, { 40, 1000 } };
+
+static int32_t menu_item_get(const menu_item_t* item)
+{
+    switch(item->size)
+    {
+        case 1:
+            return item->min < 0 ? *(const volatile int8_t*)item->value : *(const volatile uint8_t*)item->value;
+        case 2:
+            return item->min < 0 ? *(const volatile int16_t*)item->value : *(const volatile uint16_t*)item->value;
+        default:
+            return *(const volatile int32_t*)item->value;
+    }
+}
+
+static void menu_item_set(const menu_item_t* item, int32_t value)
+{
+    switch(item->size)
+    {
+        case 1:
+            *(volatile uint8_t*)item->value = value;
+            break;
+        case 2:
+            *(volatile uint16_t*)item->value = value;
+            break;
+        default:
+            *(volatile uint32_t*)item->value = value;
+            break;
+    }
+}
+
+// Range based edit
+static void menu_item_step(const menu_item_t* item, int increment)
+{
+    int64_t value = (int64_t)menu_item_get(item) + (int64_t)increment * item->step;
+    if(value < item->min || value > item->max)
+    {
+        if(item->flags & MENU_ITEM_WRAP)
+        {   // Several steps may go past the end of the range
+            int64_t span = (int64_t)item->max - item->min + item->step;
+            value = item->min + ((value - item->min) % span + span) % span;
         }
-        else if(current_menu_screen == SCREEN_DATE)
+        else
         {
-            LCD_Puts(0, 1, gps_date);
+            value = value < item->min ? item->min : item->max;
         }
-        else // SCREEN_DATE_TIME
-        {
-            uint32_t now = HAL_GetTick();
-            uint32_t duration = now - last_hour_date_screen_update;
-            if(duration <= DATE_TIME_DURATION)
-            {
-                LCD_Puts(0, 1, gps_time);
-            }
-            else
-            {
-                LCD_Puts(0, 1, gps_date);
-            }
-            if(duration >= 2*DATE_TIME_DURATION)
-            {
-                last_hour_date_screen_update = now;
-            }
+    }
+    menu_item_set(item, value);
+}
+
+static void menu_item_edit(const menu_item_t* item, int increment)
+{
+    uint16_t factor = 1;
+    for(uint8_t i = 0; i < item->accel_count && encoder_speed >= item->accel[i].speed; i++)
+    {
+        factor = item->accel[i].factor;
+    }
+    increment *= factor;
+    if(item->edit)
+    {
+        item->edit(item, increment);
+    }
+    else
+    {
+        menu_item_step(item, increment);
+    }
+}
+
+static void menu_item_commit(const menu_item_t* item)
+{
+    if(item->commit)
+    {
+        item->commit();
+    }
+    if(item->ee_size)
+    {   // Little endian: the first bytes of the value are the ones of a smaller field
+        uint32_t value = menu_item_get(item);
+        uint8_t* field = (uint8_t*)&ee_storage + item->ee_offset;
+        if(memcmp(field, &value, item->ee_size) != 0)
+        {   // Save changes
+            memcpy(field, &value, item->ee_size);
+            EE_Write();
         }
-        break;
-    case SCREEN_TREND:
-        // Trend screen 
-        if(menu_level == 0)
+    }
+}
+
+static void menu_draw_item(const menu_item_t* item, bool editing)
+{
+    char screen_buffer[SCREEN_BUFFER_SIZE];
+    if(item->label)
+    {
+        strncpy(screen_buffer, item->label, SCREEN_BUFFER_SIZE - 1);
+        screen_buffer[SCREEN_BUFFER_SIZE - 1] = '\0';
+        size_t length = strlen(screen_buffer);
+        if(editing && length > 0 && screen_buffer[length - 1] == ':')
         {
-            menu_format_ppb(ppb_string,frequency_get_ppb());
-            snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%02d %s", num_sats, ppb_string);
-            LCD_Puts(1, 0, screen_buffer);
-            menu_draw_trend(0);
+            screen_buffer[length - 1] = '?';
         }
-        else
-        {
-            switch (current_menu_trend_screen)
-            {
-                default:
-                case SCREEN_TREND_MAIN:
-                    if(menu_level == 1)
-                    {
-                        menu_format_ppb(ppb_string,frequency_get_ppb());
-                        snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%02d/%s", num_sats, ppb_string);
-                        LCD_Puts(1, 0, screen_buffer);
-                        menu_draw_trend(0);
-                    }
-                    else
-                    {   // Show value at the left of the screen
-                        menu_format_ppb(ppb_string,get_trend_value(TREND_SCREEN_SIZE-1,trend_shift,trend_h_scale));
-                        snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%03ld%c%s", trend_shift,trend_arrow,ppb_string);
-                        LCD_Puts(0, 0, screen_buffer);
-                        menu_draw_trend(trend_shift);
-                    }
-                    break;
-                case SCREEN_TREND_AUTO_V:
-                    LCD_Puts(1, 0, menu_level == 1 ? "Auto-V:":"Auto-V?");
-                    LCD_Puts(0, 1, "        ");
-                    LCD_Puts(0, 1, trend_auto_v ? "      ON" : "     OFF");
-                    break;
-                case SCREEN_TREND_AUTO_H:
-                    LCD_Puts(1, 0, menu_level == 1 ? "Auto-H:":"Auto-H?");
-                    LCD_Puts(0, 1, "        ");
-                    LCD_Puts(0, 1, trend_auto_h ? "      ON" : "     OFF");
-                    break;
-                case SCREEN_TREND_V_SCALE:
-                    LCD_Puts(1, 0, menu_level == 1 ? "V-Scal:":"V-Scal?");
-                    LCD_Puts(0, 1, "        ");
-                    snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%ld.%02ld", trend_v_scale / 100, trend_v_scale % 100);
-                    LCD_Puts(0, 1, screen_buffer);
-                    break;
-                case SCREEN_TREND_H_SCALE:
-                    LCD_Puts(1, 0, menu_level == 1 ? "H-Scal:":"H-Scal?");
-                    LCD_Puts(0, 1, "        ");
-                    snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%ld", trend_h_scale);
-                    LCD_Puts(0, 1, screen_buffer);
-                    break;
-                case SCREEN_TREND_EXIT:
-                    LCD_Puts(1, 0, "Exit?");
-                    LCD_Puts(0, 1, "        ");
-                    break;
-            }
+        display_puts(1, 0, screen_buffer);
+    }
+    // Clear line 2
+    display_puts(0, 1, "        ");
+    int32_t value = (item->show == MENU_SHOW_NONE || item->show == MENU_SHOW_STRING || item->show == MENU_SHOW_CUSTOM) ? 0 : menu_item_get(item);
+    switch(item->show)
+    {
+        case MENU_SHOW_NUMBER:
+            format_int(screen_buffer, FORMAT_END(screen_buffer), value, item->width, item->pad ? item->pad : ' ');
+            display_puts(0, 1, screen_buffer);
+            break;
+        case MENU_SHOW_HUNDREDTHS:
+            format_hundredths(screen_buffer, FORMAT_END(screen_buffer), value);
+            display_puts(0, 1, screen_buffer);
+            break;
+        case MENU_SHOW_ON_OFF:
+            display_puts(0, 1, value ? "      ON" : "     OFF");
+            break;
+        case MENU_SHOW_NAMES:
+            display_puts(0, 1, (value >= item->min && value <= item->max) ? item->names[value - item->min] : "?");
+            break;
+        case MENU_SHOW_STRING:
+            display_puts(0, 1, (const char*)item->value);
+            break;
+        case MENU_SHOW_CUSTOM:
+            item->draw(editing);
+            break;
+        default:
+            break;
+    }
+}
+
+/// Trend
+
+static void menu_draw_trend_main()
+{
+    char screen_buffer[SCREEN_BUFFER_SIZE];
+    char ppb_string[PPB_STRING_SIZE];
+    menu_format_trend_value(ppb_string,menu_trend_sample(trend_source));
+    char* p = format_uint(screen_buffer, FORMAT_END(screen_buffer), num_sats, 2, '0');
+    format_string(format_char(p, FORMAT_END(screen_buffer), trend_source_tags[trend_source]), FORMAT_END(screen_buffer), ppb_string);
+    display_puts(1, 0, screen_buffer);
+    menu_draw_trend(0);
+}
+
+static void menu_draw_trend_view(bool editing)
+{
+    char screen_buffer[SCREEN_BUFFER_SIZE];
+    char ppb_string[PPB_STRING_SIZE];
+    if(!editing)
+    {
+        menu_format_trend_value(ppb_string,menu_trend_sample(trend_source));
+        char* p = format_uint(screen_buffer, FORMAT_END(screen_buffer), num_sats, 2, '0');
+        format_string(format_char(p, FORMAT_END(screen_buffer), '/'), FORMAT_END(screen_buffer), ppb_string);
+        display_puts(1, 0, screen_buffer);
+        menu_draw_trend(0);
+    }
+    else
+    {   // Show value at the left of the screen, shift is shown in points since it can be days in seconds
+        trend_point_t point;
+        menu_format_trend_value(ppb_string,trend_get_point(trend_source,TREND_SCREEN_SIZE-1,trend_shift,trend_h_scale,&point) ? point.mean : TREND_UNSET_VALUE);
+        char* p = format_uint(screen_buffer, FORMAT_END(screen_buffer), trend_shift/trend_h_scale, 3, '0');
+        format_string(format_char(p, FORMAT_END(screen_buffer), trend_arrow), FORMAT_END(screen_buffer), ppb_string);
+        display_puts(0, 0, screen_buffer);
+        menu_draw_trend(trend_shift);
+    }
+}
+
+static void menu_edit_trend_shift(const menu_item_t* item, int increment)
+{   // Update position
+    int32_t new_trend_shift = trend_shift + (increment * trend_h_scale);
+    trend_arrow = increment < 0 ? TREND_LEFT_CODE : TREND_RIGHT_CODE;
+    if(new_trend_shift < 0)
+    {
+        trend_shift = 0;
+        trend_arrow = TREND_LEFT_CODE;
+    }
+    else if(new_trend_shift >= (int32_t)trend_max_shift(trend_source,trend_h_scale))
+    {
+        trend_shift = trend_max_shift(trend_source,trend_h_scale);
+        trend_arrow = TREND_RIGHT_CODE;
+    }
+    else
+    {
+        trend_shift = new_trend_shift;
+    }
+}
+
+static void menu_edit_trend_source(const menu_item_t* item, int increment)
+{   // Update source, the history of the previous one is lost unless it is PPB
+    menu_item_step(item, increment);
+    trend_select_aux(trend_source);
+    trend_shift = 0;
+    trend_h_scale = menu_roud_h_scale(trend_h_scale);
+}
+
+static void menu_edit_trend_v_scale(const menu_item_t* item, int increment)
+{
+    uint32_t multiplier;
+    if(trend_v_scale > 2000 || ((trend_v_scale == 2000) && (increment > 0)))
+    {
+        multiplier = 1000;
+    }
+    else if(trend_v_scale > 200 || ((trend_v_scale == 200) && (increment > 0)))
+    {
+        multiplier = 100;
+    }
+    else
+    {
+        multiplier = 10;
+    }
+    int32_t new_v_scale = (int32_t)trend_v_scale + (int32_t)multiplier*increment;
+    trend_v_scale = menu_round_v_scale(new_v_scale < 0 ? 0 : new_v_scale);
+}
+
+static void menu_edit_trend_h_scale(const menu_item_t* item, int increment)
+{
+    trend_h_scale = increment > 0 ? trend_h_scale * 2 : trend_h_scale/2;
+    trend_h_scale = menu_roud_h_scale(trend_h_scale);
+}
+
+static const menu_item_t menu_trend_items[] = {
+    { .flags = MENU_ITEM_EDIT, .show = MENU_SHOW_CUSTOM, .draw = menu_draw_trend_view, .edit = menu_edit_trend_shift, MENU_ACCEL(menu_accel_scroll) },
+    { .label = "Source:", .flags = MENU_ITEM_EDIT | MENU_ITEM_WRAP, .show = MENU_SHOW_NAMES, MENU_VALUE(trend_source), MENU_RANGE(TREND_CHANNEL_PPB, TREND_CHANNEL_MAX - 1, 1), .names = trend_source_names, MENU_EE(trend_source), .edit = menu_edit_trend_source },
+    { .label = "Auto-V:", .flags = MENU_ITEM_EDIT | MENU_ITEM_WRAP, .show = MENU_SHOW_ON_OFF, MENU_VALUE(trend_auto_v), MENU_RANGE(0, 1, 1), MENU_EE(trend_auto_v) },
+    { .label = "Auto-H:", .flags = MENU_ITEM_EDIT | MENU_ITEM_WRAP, .show = MENU_SHOW_ON_OFF, MENU_VALUE(trend_auto_h), MENU_RANGE(0, 1, 1), MENU_EE(trend_auto_h) },
+    // Scales can't be edited while auto-scaled
+    { .label = "V-Scal:", .flags = MENU_ITEM_EDIT, .show = MENU_SHOW_HUNDREDTHS, MENU_VALUE(trend_v_scale), MENU_EE(trend_v_scale), .lock = &trend_auto_v, .edit = menu_edit_trend_v_scale },
+    { .label = "H-Scal:", .flags = MENU_ITEM_EDIT, .show = MENU_SHOW_NUMBER, MENU_VALUE(trend_h_scale), MENU_EE(trend_h_scale), .lock = &trend_auto_h, .edit = menu_edit_trend_h_scale },
+    MENU_EXIT,
+};
+
+/// SNR
+
+static void menu_draw_snr_main()
+{   // Satellites used in the fix, mean C/N0 and signal bars
+    char screen_buffer[SCREEN_BUFFER_SIZE];
+    satellites_summary_t summary;
+    satellites_summary(&summary);
+    char* p = format_char(format_uint(screen_buffer, FORMAT_END(screen_buffer), summary.used, 2, '0'), FORMAT_END(screen_buffer), ' ');
+    format_string(format_uint(p, FORMAT_END(screen_buffer), summary.mean_snr, 2, ' '), FORMAT_END(screen_buffer), "dB");
+    display_puts(1, 0, screen_buffer);
+    menu_draw_snr();
+}
+
+/// PPB
+
+static void menu_draw_ppb_main()
+{
+    char screen_buffer[SCREEN_BUFFER_SIZE];
+    display_puts(1, 0, "PPB:   ");
+    display_puts(0, 1, "        ");
+    menu_to_string_with_two_decimals(frequency_get_ppb(), screen_buffer, SCREEN_BUFFER_SIZE);
+    display_puts(0, 1, screen_buffer);
+}
+
+static void menu_draw_ppb_mean(bool editing)
+{
+    char screen_buffer[SCREEN_BUFFER_SIZE];
+    menu_to_string_with_two_decimals(frequency_get_ppb(), screen_buffer, SCREEN_BUFFER_SIZE);
+    display_puts(0, 1, screen_buffer);
+}
+
+static void menu_draw_ppb_inst(bool editing)
+{
+    char screen_buffer[SCREEN_BUFFER_SIZE];
+    int32_t ppb_inst = (int64_t)ppb_error * 1000000000 * 100 / ((int64_t)HAL_RCC_GetHCLKFreq());
+    format_hundredths(screen_buffer, FORMAT_END(screen_buffer), ppb_inst);
+    display_puts(0, 1, screen_buffer);
+}
+
+static void menu_draw_ppb_correction(bool editing)
+{
+    char screen_buffer[SCREEN_BUFFER_SIZE];
+    if(frequency_adjustment_allowed())
+    {
+        format_int(screen_buffer, FORMAT_END(screen_buffer), ppb_correction, 0, ' ');
+        display_puts(0, 1, screen_buffer);
+    }
+    else
+    {
+        display_puts(0, 1, "Warm-up");
+    }
+}
+
+static void menu_edit_correction_factor(const menu_item_t* item, int increment)
+{
+    correction_factor = increment_correction_factor_value(correction_algorithm,correction_factor,increment);
+}
+
+static void menu_commit_ocxo_model()
+{
+    if(ee_storage.ocxo_model != ocxo_model)
+    {   // Also change warmup time accordingly
+        warmup_time_seconds = get_default_warmup_time(ocxo_model);
+        ee_storage.warmup_time_seconds = warmup_time_seconds;
+    }
+}
+
+static void menu_commit_correction_algorithm()
+{
+    if(ee_storage.correction_algorithm != displayed_correction_algorithm)
+    {   // Make sure correction algo and correction are consistant before activating new algo
+        // Reset correction factor to default value when algo is changed
+        correction_factor = get_default_correction_factor(displayed_correction_algorithm);
+        correction_algorithm = displayed_correction_algorithm;
+        ee_storage.correction_factor = correction_factor;
+    }
+}
+
+static const char* const menu_ocxo_model_names[] = { "ISOTEMP", "OX256B", "Unknown" };
+static const char* const menu_correction_algorithm_names[] = { "Dankar", "Fredzo", "Eric H" };
+
+static const menu_item_t menu_ppb_items[] = {
+    { .label = "Mean:", .show = MENU_SHOW_CUSTOM, .draw = menu_draw_ppb_mean },
+    { .label = "Inst:", .show = MENU_SHOW_CUSTOM, .draw = menu_draw_ppb_inst },
+    { .label = "Freq:", .show = MENU_SHOW_NUMBER, MENU_VALUE(ppb_frequency) },
+    { .label = "Error:", .show = MENU_SHOW_NUMBER, MENU_VALUE(ppb_error) },
+    { .label = "Corr.:", .show = MENU_SHOW_CUSTOM, .draw = menu_draw_ppb_correction },
+    { .label = "PWM:", .show = MENU_SHOW_NUMBER, MENU_VALUE(TIM1->CCR2) },
+    { .label = "OCXO:", .flags = MENU_ITEM_EDIT | MENU_ITEM_WRAP, .show = MENU_SHOW_NAMES, MENU_VALUE(ocxo_model), MENU_RANGE(0, OCXO_MODEL_UNKNOWN, 1), .names = menu_ocxo_model_names, MENU_EE(ocxo_model), .commit = menu_commit_ocxo_model },
+    { .label = "Warmup:", .flags = MENU_ITEM_EDIT, .show = MENU_SHOW_NUMBER, MENU_VALUE(warmup_time_seconds), MENU_RANGE(0, 1000, 1), MENU_EE(warmup_time_seconds), MENU_ACCEL(menu_accel_medium) },
+    // Edited apart from the running algorithm, which is only changed when leaving edit mode
+    { .label = "Algo.:", .flags = MENU_ITEM_EDIT | MENU_ITEM_WRAP, .show = MENU_SHOW_NAMES, MENU_VALUE(displayed_correction_algorithm), MENU_RANGE(0, CORRECTION_ALGO_ERIC_H, 1), .names = menu_correction_algorithm_names, MENU_EE(correction_algorithm), .commit = menu_commit_correction_algorithm },
+    { .label = "Corr.F:", .flags = MENU_ITEM_EDIT, .show = MENU_SHOW_NUMBER, MENU_VALUE(correction_factor), MENU_EE(correction_factor), .edit = menu_edit_correction_factor },
+    { .label = "Millis:", .show = MENU_SHOW_NUMBER, MENU_VALUE(ppb_millis) },
+    { .label = "PWM S.:", .flags = MENU_ITEM_EDIT | MENU_ITEM_WRAP, .show = MENU_SHOW_ON_OFF, MENU_VALUE(pwm_auto_save), MENU_RANGE(0, 1, 1), MENU_EE(pwm_auto_save) },
+    { .label = "PPS S.:", .flags = MENU_ITEM_EDIT | MENU_ITEM_WRAP, .show = MENU_SHOW_ON_OFF, MENU_VALUE(pps_ppm_auto_sync), MENU_RANGE(0, 1, 1), MENU_EE(pps_ppm_auto_sync) },
+    { .label = "PPB Lk:", .flags = MENU_ITEM_EDIT, .show = MENU_SHOW_HUNDREDTHS, MENU_VALUE(ppb_lock_threshold), MENU_RANGE(0, MAX_PPB_LOCK_THRESHOLD, 5), MENU_EE(ppb_lock_threshold), MENU_ACCEL(menu_accel_medium) },
+    MENU_EXIT,
+};
+
+/// PWM
+
+static void menu_draw_pwm(bool editing)
+{
+    char screen_buffer[SCREEN_BUFFER_SIZE];
+    if(editing)
+    {
+        display_puts(0, 0, " PRESS ");
+        display_puts(0, 1, "TO SAVE");
+    }
+    else
+    {
+        format_uint(screen_buffer, FORMAT_END(screen_buffer), TIM1->CCR2, 0, ' ');
+        display_puts(0, 1, screen_buffer);
+    }
+}
+
+static void menu_edit_pwm(const menu_item_t* item, int increment)
+{   // Go back to main menu without saving
+    menu_level = 0;
+}
+
+static void menu_commit_pwm()
+{
+    ee_storage.pwm = TIM1->CCR2;
+    EE_Write();
+}
+
+static const menu_item_t menu_pwm_items[] = {
+    { .label = "PWM:   ", .flags = MENU_ITEM_EDIT, .show = MENU_SHOW_CUSTOM, .draw = menu_draw_pwm, .edit = menu_edit_pwm, .commit = menu_commit_pwm },
+};
+
+/// GPS
+
+static void menu_draw_gps_main()
+{
+    char screen_buffer[SCREEN_BUFFER_SIZE];
+    format_uint(format_string(screen_buffer, FORMAT_END(screen_buffer), "GPS:"), FORMAT_END(screen_buffer), num_sats, 2, '0');
+    display_puts(1, 0, screen_buffer);
+    display_put_glyph(7, 0, sat_icons[4], ' ');
+    display_puts(0, 1, gps_time);
+}
+
+static void menu_draw_gps_latitude(bool editing)
+{
+    char screen_buffer[SCREEN_BUFFER_SIZE];
+    format_string(format_string(screen_buffer, FORMAT_END(screen_buffer), "Lat.: "), FORMAT_END(screen_buffer), gps_n_s);
+    display_puts(1, 0, screen_buffer);
+    display_puts(0, 1, gps_latitude);
+}
+
+static void menu_draw_gps_longitude(bool editing)
+{
+    char screen_buffer[SCREEN_BUFFER_SIZE];
+    format_string(format_string(screen_buffer, FORMAT_END(screen_buffer), "Long.:"), FORMAT_END(screen_buffer), gps_e_w);
+    display_puts(1, 0, screen_buffer);
+    display_puts(0, 1, gps_longitude);
+}
+
+// Degrees x1e7, 6 decimals
+static void menu_draw_degrees(int32_t degrees)
+{
+    char screen_buffer[SCREEN_BUFFER_SIZE];
+    format_degrees(screen_buffer, FORMAT_END(screen_buffer), degrees, 6);
+    display_puts(0, 1, screen_buffer);
+}
+
+static void menu_draw_gps_latitude_dec(bool editing) { menu_draw_degrees(gps_latitude_e7); }
+static void menu_draw_gps_longitude_dec(bool editing) { menu_draw_degrees(gps_longitude_e7); }
+
+// Meters with one decimal
+static void menu_draw_tenths(double value)
+{
+    char screen_buffer[SCREEN_BUFFER_SIZE];
+    format_fixed(screen_buffer, FORMAT_END(screen_buffer), lround(value * 10), 1, 1, 0);
+    display_puts(0, 1, screen_buffer);
+}
+
+static void menu_draw_gps_altitude(bool editing) { menu_draw_tenths(gps_msl_altitude); }
+static void menu_draw_gps_geoid(bool editing) { menu_draw_tenths(gps_geoid_separation); }
+
+static void menu_edit_gps_baudrate(const menu_item_t* item, int increment)
+{   // ATGM336H modules don't go above 115200 bauds
+    int max_baudrate = (gps_model == GPS_MODEL_ATGM336H) ? BAUDRATE_115200 + 1 : BAUDRATE_MAX;
+    gps_baudrate_enum = ((int)gps_baudrate_enum + max_baudrate + increment % max_baudrate) % max_baudrate;
+    gps_baudrate = menu_get_baudrate_value(gps_baudrate_enum);
+}
+
+static void menu_commit_gps_baudrate()
+{
+    if(ee_storage.gps_baudrate != gps_baudrate)
+    {   // Reconfigure module and uart, new baudrate is saved (in ee and on gps module) once the module has been heard at it
+        if(!gps_set_baudrate(gps_baudrate, true))
+        {   // Not supported by the module
+            menu_update_gps_baudrate(ee_storage.gps_baudrate);
         }
-        break;
-    case SCREEN_PPB:
-        // Screen with ppb
-        if(menu_level == 0)
+    }
+}
+
+static void menu_commit_gps_time_offset()
+{   // Saved as an unsigned offset from the minimum
+    if(ee_storage.gps_time_offset != ((uint32_t)(gps_time_offset-MIN_TIME_OFFSET)))
+    {
+        ee_storage.gps_time_offset = gps_time_offset-MIN_TIME_OFFSET;
+        EE_Write();
+    }
+}
+
+static const char* const menu_date_format_names[] = { "dd/mm/yy", "mm/dd/yy", "yy/mm/dd", "dd.mm.yy", "yy-mm-dd" };
+static const char* const menu_gps_model_names[] = { "ATGM336H", "NEO-6M", "NEO-M9N" };
+
+static void menu_draw_gps_model(bool editing)
+{   // Unknown model is auto-detected
+    display_puts(0, 1, gps_model < GPS_MODEL_UNKNOWN ? menu_gps_model_names[gps_model] : editing ? "Auto" : "Unknown");
+}
+
+static void menu_draw_gps_survey(bool editing)
+{
+    char screen_buffer[SCREEN_BUFFER_SIZE];
+    if(editing)
+    {   // Survey duration
+        if(survey_minutes == 0)
         {
-            ppb = frequency_get_ppb();
-            LCD_Puts(1, 0, "PPB:   ");
-            LCD_Puts(0, 1, "        ");
-            menu_to_string_with_two_decimals(ppb, screen_buffer, SCREEN_BUFFER_SIZE);
-            LCD_Puts(0, 1, screen_buffer);
+            display_puts(0, 1, "Off");
         }
         else
         {
-            // Clear line 2
-            LCD_Puts(0, 1, "        ");
-            switch (current_menu_ppb_screen)
-            {
-                default:
-                case SCREEN_PPB_MEAN:
-                    ppb = frequency_get_ppb();
-                    LCD_Puts(1, 0, "Mean:");
-                    menu_to_string_with_two_decimals(ppb, screen_buffer, SCREEN_BUFFER_SIZE);
-                    LCD_Puts(0, 1, screen_buffer);
-                    break;
-                case SCREEN_PPB_INST:
-                    {
-                    LCD_Puts(1, 0, "Inst:");
-                    int32_t ppb_inst = (int64_t)ppb_error * 1000000000 * 100 / ((int64_t)HAL_RCC_GetHCLKFreq());
-                    snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%ld.%02d", ppb_inst / 100, abs(ppb_inst) % 100);
-                    LCD_Puts(0, 1, screen_buffer);
-                    }
-                    break;
-                case SCREEN_PPB_FREQUENCY:
-                    LCD_Puts(1, 0, "Freq:");
-                    snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%ld", ppb_frequency);
-                    LCD_Puts(0, 1, screen_buffer);
-                    break;
-                case SCREEN_PPB_ERROR:
-                    LCD_Puts(1, 0, "Error:");
-                    snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%ld", ppb_error);
-                    LCD_Puts(0, 1, screen_buffer);
-                    break;
-                case SCREEN_PPB_CORRECTION:
-                    LCD_Puts(1, 0, "Corr.:");
-                    if(frequency_adjustment_allowed())
-                    {
-                        snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%ld", ppb_correction);
-                        LCD_Puts(0, 1, screen_buffer);
-                    }
-                    else
-                    {
-                        LCD_Puts(0, 1, "Warm-up");
-                    }
-                    break;
-                case SCREEN_PPB_PWM:
-                    LCD_Puts(1, 0, "PWM:");
-                    snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%ld", TIM1->CCR2);
-                    LCD_Puts(0, 1, screen_buffer);
-                    break;
-                case SCREEN_PPB_OCXO_MODEL:
-                    LCD_Puts(1, 0, menu_level == 1 ? "OCXO:":"OCXO?");
-                    switch(ocxo_model)
-                    {
-                        case OCXO_MODEL_ISOTEMP:
-                            LCD_Puts(0, 1, "ISOTEMP");
-                            break;
-                        case OCXO_MODEL_OX256B:
-                            LCD_Puts(0, 1, "OX256B");
-                            break;
-                        default:
-                        case OCXO_MODEL_UNKNOWN:
-                            LCD_Puts(0, 1, "Unknown");
-                            break;
-                    }
-                    break;
-                case SCREEN_PPB_WARMUP_TIME:
-                    LCD_Puts(1, 0, menu_level == 1 ? "Warmup:":"Warmup?");
-                    snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%ld", warmup_time_seconds);
-                    LCD_Puts(0, 1, screen_buffer);
-                    break;
-                case SCREEN_PPB_ALGO:
-                    LCD_Puts(1, 0, menu_level == 1 ? "Algo.:":"Algo?");
-                    switch(displayed_correction_algorithm)
-                    {
-                        case CORRECTION_ALGO_DANKAR:
-                            LCD_Puts(0, 1, "Dankar");
-                            break;
-                        case CORRECTION_ALGO_ERIC_H:
-                            LCD_Puts(0, 1, "Eric H");
-                            break;
-                        default:
-                        case CORRECTION_ALGO_FREDZO:
-                            LCD_Puts(0, 1, "Fredzo");
-                            break;
-                    }
-                    break;
-                case SCREEN_PPB_CORRECTION_FACTOR:
-                    LCD_Puts(1, 0, menu_level == 1 ? "Corr.F:":"Corr.F?");
-                    snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%ld", correction_factor);
-                    LCD_Puts(0, 1, screen_buffer);
-                    break;
-                case SCREEN_PPB_MILLIS:
-                    LCD_Puts(1, 0, "Millis:");
-                    snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%ld", ppb_millis);
-                    LCD_Puts(0, 1, screen_buffer);
-                    break;
-                case SCREEN_PPB_AUTO_SAVE_PWM:
-                    LCD_Puts(1, 0, menu_level == 1 ? "PWM S.:":"PWM S.?");
-                    LCD_Puts(0, 1, pwm_auto_save ? "      ON" : "     OFF");
-                    break;
-                case SCREEN_PPB_AUTO_SYNC_PPS:
-                    LCD_Puts(1, 0, menu_level == 1 ? "PPS S.:":"PPS S.?");
-                    LCD_Puts(0, 1, pps_ppm_auto_sync ? "      ON" : "     OFF");
-                    break;
-                case SCREEN_PPB_LOCK_THRESHOLD:
-                    LCD_Puts(1, 0, menu_level == 1 ? "PPB Lk:":"PPB Lk?");
-                    snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%ld.%02ld", ppb_lock_threshold / 100, ppb_lock_threshold % 100);
-                    LCD_Puts(0, 1, screen_buffer);
-                    break;
-                case SCREEN_PPB_EXIT:
-                    LCD_Puts(1, 0, "Exit?");
-                    LCD_Puts(0, 1, "        ");
-                    break;
-            }
+            format_string(format_uint(screen_buffer, FORMAT_END(screen_buffer), survey_minutes, 0, ' '), FORMAT_END(screen_buffer), "min");
+            display_puts(0, 1, screen_buffer);
         }
-        break;
-    case SCREEN_PWM:
-        // Screen with current PPM
-        LCD_Puts(1, 0, "PWM:   ");
-        LCD_Puts(0, 1, "        ");
-        snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%ld", TIM1->CCR2);
-        LCD_Puts(0, 1, screen_buffer);
-        break;
-    case SCREEN_GPS:
-        if(menu_level == 0)
+        return;
+    }
+    // Survey progress and position accuracy (3D standard deviation)
+    char accuracy_buffer[6];
+    uint32_t accuracy = survey_accuracy();
+    if(accuracy < 1000)
+    {
+        format_char(format_fixed(accuracy_buffer, FORMAT_END(accuracy_buffer), accuracy, 2, 1, 0), FORMAT_END(accuracy_buffer), 'm');
+    }
+    else
+    {
+        format_char(format_uint(accuracy_buffer, FORMAT_END(accuracy_buffer), (accuracy < 99900) ? accuracy / 100 : 999, 0, ' '), FORMAT_END(accuracy_buffer), 'm');
+    }
+    switch(survey_state)
+    {
+        default:
+        case SURVEY_IDLE:
+            display_puts(0, 1, "Off");
+            break;
+        case SURVEY_RUNNING:
+            format_string(format_string(format_uint(screen_buffer, FORMAT_END(screen_buffer), survey_progress(), 0, ' '), FORMAT_END(screen_buffer), "% "), FORMAT_END(screen_buffer), accuracy_buffer);
+            display_puts(0, 1, screen_buffer);
+            break;
+        case SURVEY_FIXED:
+            format_string(format_string(screen_buffer, FORMAT_END(screen_buffer), "Fix "), FORMAT_END(screen_buffer), accuracy_buffer);
+            display_puts(0, 1, screen_buffer);
+            break;
+    }
+}
+
+static void menu_commit_gps_survey()
+{   // Off leaves fixed position mode, a new duration starts a new survey (ee field is saved after this hook)
+    if(survey_minutes == ee_storage.survey_minutes && (survey_minutes == 0 || survey_state != SURVEY_IDLE))
+    {   // Unchanged: keep the running survey or the fixed position
+        return;
+    }
+    if(survey_minutes == 0)
+    {
+        survey_stop();
+    }
+    else
+    {
+        survey_start();
+    }
+}
+
+static void menu_draw_gps_lost(bool editing)
+{   // Overlong and truncated sentences
+    char screen_buffer[SCREEN_BUFFER_SIZE];
+    format_uint(screen_buffer, FORMAT_END(screen_buffer), nmea_total_stats.overlong + nmea_total_stats.truncated, 0, ' ');
+    display_puts(0, 1, screen_buffer);
+}
+
+static void menu_draw_gps_last_frame(bool editing)
+{
+    display_puts(0, 1, gps_last_frame);
+    if(gps_last_frame_changed)
+    {
+        menu_force_redraw();
+        gps_last_frame_changed = false;
+    }
+}
+
+static const menu_item_t menu_gps_items[] = {
+    { .label = "Time:", .show = MENU_SHOW_STRING, .value = gps_time },
+    { .show = MENU_SHOW_CUSTOM, .draw = menu_draw_gps_latitude },
+    { .show = MENU_SHOW_CUSTOM, .draw = menu_draw_gps_longitude },
+    { .label = "Lat.D:", .show = MENU_SHOW_CUSTOM, .draw = menu_draw_gps_latitude_dec },
+    { .label = "Long.D:", .show = MENU_SHOW_CUSTOM, .draw = menu_draw_gps_longitude_dec },
+    { .label = "Lcator:", .show = MENU_SHOW_STRING, .value = gps_locator },
+    { .label = "Alt.:", .show = MENU_SHOW_CUSTOM, .draw = menu_draw_gps_altitude },
+    { .label = "Geoid:", .show = MENU_SHOW_CUSTOM, .draw = menu_draw_gps_geoid },
+    { .label = "Sat. #:", .show = MENU_SHOW_NUMBER, MENU_VALUE(num_sats), .width = 2, .pad = '0' },
+    { .label = "HDOP:", .show = MENU_SHOW_STRING, .value = gps_hdop },
+    { .label = "Baud:", .flags = MENU_ITEM_EDIT, .show = MENU_SHOW_NUMBER, MENU_VALUE(gps_baudrate), .edit = menu_edit_gps_baudrate, .commit = menu_commit_gps_baudrate },
+    { .label = "TZ ofs:", .flags = MENU_ITEM_EDIT | MENU_ITEM_WRAP, .show = MENU_SHOW_NUMBER, MENU_VALUE(gps_time_offset), MENU_RANGE(MIN_TIME_OFFSET, MAX_TIME_OFFSET, 1), .width = 2, .commit = menu_commit_gps_time_offset },
+    { .label = "Dt Fmt:", .flags = MENU_ITEM_EDIT | MENU_ITEM_WRAP, .show = MENU_SHOW_NAMES, MENU_VALUE(gps_date_format), MENU_RANGE(DATE_FORMAT_UTC, DATE_FORMAT_ISO_DASH, 1), .names = menu_date_format_names, MENU_EE(gps_date_format) },
+    { .label = "Model:", .flags = MENU_ITEM_EDIT | MENU_ITEM_WRAP, .show = MENU_SHOW_CUSTOM, MENU_VALUE(gps_model), MENU_RANGE(0, GPS_MODEL_UNKNOWN, 1), MENU_EE(gps_model), .draw = menu_draw_gps_model },
+    { .label = "Survey:", .flags = MENU_ITEM_EDIT, .show = MENU_SHOW_CUSTOM, MENU_VALUE(survey_minutes), MENU_RANGE(0, MAX_SURVEY_MINUTES, SURVEY_MINUTES_STEP), MENU_EE(survey_minutes), .draw = menu_draw_gps_survey, .commit = menu_commit_gps_survey, MENU_ACCEL(menu_accel_medium) },
+    { .label = "NMEA ok", .show = MENU_SHOW_NUMBER, MENU_VALUE(nmea_total_stats.good) },
+    { .label = "Chk err", .show = MENU_SHOW_NUMBER, MENU_VALUE(nmea_total_stats.bad_checksum) },
+    { .label = "Lost:", .show = MENU_SHOW_CUSTOM, .draw = menu_draw_gps_lost },
+    { .label = "Frame:", .show = MENU_SHOW_CUSTOM, .draw = menu_draw_gps_last_frame },
+    MENU_EXIT,
+};
+
+/// PPS
+
+static void menu_draw_pps_main()
+{
+    char screen_buffer[SCREEN_BUFFER_SIZE];
+    display_puts(0, 1, "        ");
+    format_uint(format_string(screen_buffer, FORMAT_END(screen_buffer), "PPS:"), FORMAT_END(screen_buffer), pps_sync_count, 3, ' ');
+    display_puts(1, 0, screen_buffer);
+    format_int(screen_buffer, FORMAT_END(screen_buffer), pps_error, 0, ' ');
+    display_puts(0, 1, screen_buffer);
+}
+
+static void menu_draw_pps_shift(bool editing)
+{   // Check we have enough space for minus sign
+    char screen_buffer[SCREEN_BUFFER_SIZE];
+    format_int(screen_buffer, FORMAT_END(screen_buffer), (pps_error < -9999999) ? abs(pps_error) : pps_error, 0, ' ');
+    display_puts(0, 1, screen_buffer);
+}
+
+static void menu_draw_pps_shift_ms(bool editing)
+{
+    char screen_buffer[SCREEN_BUFFER_SIZE];
+    format_millis(screen_buffer, FORMAT_END(screen_buffer), pps_millis);
+    display_puts(0, 1, screen_buffer);
+}
+
+static void menu_draw_pps_force_sync(bool editing)
+{   // Shown as forced until the PPS output has been synced
+    display_puts(1, 0, sync_pps_out ? " Forced" : " Force ");
+    display_puts(0, 1, sync_pps_out ? "  sync !" : "  sync ?");
+}
+
+static void menu_commit_pps_force_sync() { sync_pps_out = true; }
+
+static const menu_item_t menu_pps_items[] = {
+    { .label = "Shift:", .show = MENU_SHOW_CUSTOM, .draw = menu_draw_pps_shift },
+    { .label = "Sft ms:", .show = MENU_SHOW_CUSTOM, .draw = menu_draw_pps_shift_ms },
+    { .label = "SynCnt:", .show = MENU_SHOW_NUMBER, MENU_VALUE(pps_sync_count) },
+    { .label = "Sync.:", .flags = MENU_ITEM_EDIT | MENU_ITEM_WRAP, .show = MENU_SHOW_ON_OFF, MENU_VALUE(pps_sync_on), MENU_RANGE(0, 1, 1), MENU_EE(pps_sync_on) },
+    { .label = "Delay:", .flags = MENU_ITEM_EDIT, .show = MENU_SHOW_NUMBER, MENU_VALUE(pps_sync_delay), MENU_RANGE(0, INT32_MAX, 1), MENU_EE(pps_sync_delay), MENU_ACCEL(menu_accel_large) },
+    { .label = "Thrsld:", .flags = MENU_ITEM_EDIT, .show = MENU_SHOW_NUMBER, MENU_VALUE(pps_sync_threshold), MENU_RANGE(0, INT32_MAX, 1), MENU_EE(pps_sync_threshold), MENU_ACCEL(menu_accel_large) },
+    { .flags = MENU_ITEM_ACTION, .show = MENU_SHOW_CUSTOM, .draw = menu_draw_pps_force_sync, .commit = menu_commit_pps_force_sync },
+    MENU_EXIT,
+};
+
+/// Single value screens
+
+static void menu_edit_contrast(const menu_item_t* item, int increment)
+{
+    menu_item_step(item, increment);
+    update_contrast();
+}
+
+static const menu_item_t menu_uptime_items[] = { { .label = "UPTIME:", .show = MENU_SHOW_NUMBER, MENU_VALUE(device_uptime) } };
+static const menu_item_t menu_frames_items[] = { { .label = "GGA FR:", .show = MENU_SHOW_NUMBER, MENU_VALUE(gga_frames) } };
+static const menu_item_t menu_contrast_items[] = {
+    { .label = "CNTRST:", .flags = MENU_ITEM_EDIT, .show = MENU_SHOW_NUMBER, MENU_VALUE(contrast), MENU_RANGE(0, 100, 1), MENU_EE(contrast), .edit = menu_edit_contrast },
+};
+static const menu_item_t menu_version_items[] = { { .label = "Vers.:", .show = MENU_SHOW_STRING, .value = FIRMWARE_VERSION } };
+
+/// Main menu
+
+static void menu_draw_main()
+{   // Main screen with satellites, ppb and UTC time
+    char screen_buffer[SCREEN_BUFFER_SIZE];
+    char ppb_string[PPB_STRING_SIZE];
+    menu_format_ppb(ppb_string,frequency_get_ppb());
+    char* p = format_char(format_uint(screen_buffer, FORMAT_END(screen_buffer), num_sats, 2, '0'), FORMAT_END(screen_buffer), ' ');
+    format_string(p, FORMAT_END(screen_buffer), ppb_string);
+    display_puts(1, 0, screen_buffer);
+    if(current_menu_screen == SCREEN_MAIN)
+    {
+        display_puts(0, 1, gps_time);
+    }
+    else if(current_menu_screen == SCREEN_DATE)
+    {
+        display_puts(0, 1, gps_date);
+    }
+    else // SCREEN_DATE_TIME
+    {
+        uint32_t now = HAL_GetTick();
+        uint32_t duration = now - last_hour_date_screen_update;
+        if(duration <= DATE_TIME_DURATION)
         {
-            snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "GPS:%02d\5", num_sats);
-            LCD_Puts(1, 0, screen_buffer);
-            LCD_Puts(0, 1, gps_time);
+            display_puts(0, 1, gps_time);
         }
         else
         {
-            // Clear line 2
-            LCD_Puts(0, 1, "        ");
-            switch (current_menu_gps_screen)
-            {
-                default:
-                case SCREEN_GPS_TIME:
-                    LCD_Puts(1, 0, "Time:");
-                    LCD_Puts(0, 1, gps_time);
-                    break;
-                case SCREEN_GPS_LATITUDE:
-                    snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "Lat.: %s", gps_n_s);
-                    LCD_Puts(1, 0, screen_buffer);
-                    LCD_Puts(0, 1, gps_latitude);
-                    break;
-                case SCREEN_GPS_LONGITUDE:
-                    snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "Long.:%s", gps_e_w);
-                    LCD_Puts(1, 0, screen_buffer);
-                    LCD_Puts(0, 1, gps_longitude);
-                    break;
-                case SCREEN_GPS_LATITUDE_DEC:
-                    {
-                    snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "Lat.D:");
-                    LCD_Puts(1, 0, screen_buffer);
-                    const char *fmt = "%d.%d";
-                    double gps_latitude_double_abs = gps_latitude_double;
-                    if (gps_latitude_double < 0.0)
-                    {
-                            gps_latitude_double_abs *= -1.0;
-                            fmt = "-%d.%d";
-                    }
-                    double coord_int = floor(gps_latitude_double_abs);
-                    double coord_frac = (gps_latitude_double_abs - coord_int)*1000000;
-                    snprintf(screen_buffer, SCREEN_BUFFER_SIZE, fmt, ((int)coord_int), ((int)coord_frac));
-                    LCD_Puts(0, 1, screen_buffer);
-                    }
-                break;
-                case SCREEN_GPS_LONGITUDE_DEC:
-                    {
-                    snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "Long.D:");
-                    LCD_Puts(1, 0, screen_buffer);
-                    const char *fmt = "%d.%d";
-                    double gps_longitude_double_abs = gps_longitude_double;
-                    if (gps_longitude_double < 0.0)
-                    {
-                            gps_longitude_double_abs *= -1.0;
-                            fmt = "-%d.%d";
-                    }
-                    double coord_int = floor(gps_longitude_double_abs);
-                    double coord_frac = (gps_longitude_double_abs - coord_int)*1000000;
-                    snprintf(screen_buffer, SCREEN_BUFFER_SIZE, fmt, ((int)coord_int), ((int)coord_frac));
-                    LCD_Puts(0, 1, screen_buffer);
-                    }
-                    break;
-                case SCREEN_GPS_LOCATOR:
-                    snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "Lcator:");
-                    LCD_Puts(1, 0, screen_buffer);
-                    LCD_Puts(0, 1, gps_locator);
-                    break;
-                case SCREEN_GPS_ALTITUDE:
-                    {
-                        double alt_int = floor(gps_msl_altitude);
-                        double alt_frac = (gps_msl_altitude - alt_int)*10;
-                        LCD_Puts(1, 0, "Alt.:");
-                        snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%d.%d", ((int)alt_int), ((int)alt_frac));
-                        LCD_Puts(0, 1, screen_buffer);
-                    }
-                    break;
-                case SCREEN_GPS_GEOID:
-                    {
-                        double geoid_int = floor(gps_geoid_separation);
-                        double geoid_frac = (gps_geoid_separation - geoid_int)*10;
-                        LCD_Puts(1, 0, "Geoid:");
-                        snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%d.%d", ((int)geoid_int), ((int)geoid_frac));
-                        LCD_Puts(0, 1, screen_buffer);
-                    }
-                    break;
-                case SCREEN_GPS_SATELITES:
-                    LCD_Puts(1, 0, "Sat. #:");
-                    snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%02d", num_sats);
-                    LCD_Puts(0, 1, screen_buffer);
-                    break;
-                case SCREEN_GPS_HDOP:
-                    LCD_Puts(1, 0, "HDOP:");
-                    LCD_Puts(0, 1, gps_hdop);
-                    break;
-                case SCREEN_GPS_BAUDRATE:
-                    LCD_Puts(1, 0, menu_level == 1 ? "Baud:":"Baud?");
-                    snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%ld", gps_baudrate);
-                    LCD_Puts(0, 1, screen_buffer);
-                    break;
-                case SCREEN_GPS_TIME_OFFSET:
-                    LCD_Puts(1, 0, menu_level == 1 ? "TZ ofs:":"TZ ofs?");
-                    snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%2d", (int)gps_time_offset);
-                    LCD_Puts(0, 1, screen_buffer);
-                    break;
-                case SCREEN_GPS_DATE_FORMAT:
-                    LCD_Puts(1, 0, menu_level == 1 ? "Dt Fmt:":"Dt fmt?");
-                    LCD_Puts(0, 1, (gps_date_format == DATE_FORMAT_UTC) ? "dd/mm/yy" : ((gps_date_format == DATE_FORMAT_US) ? "mm/dd/yy" : ((gps_date_format == DATE_FORMAT_ISO) ? "yy/mm/dd" : ((gps_date_format == DATE_FORMAT_UTC_DOT) ? "dd.mm.yy" : "yy-mm-dd"))));
-                    break;
-                case SCREEN_GPS_MODEL:
-                    LCD_Puts(1, 0, menu_level == 1 ? "Model:":"Model?");
-                    switch(gps_model)
-                    {
-                        case GPS_MODEL_ATGM336H:
-                            LCD_Puts(0, 1, "ATGM336H");
-                            break;
-                        case GPS_MODEL_NEO6M:
-                            LCD_Puts(0, 1, "NEO-6M");
-                            break;
-                        case GPS_MODEL_NEOM9N:
-                            LCD_Puts(0, 1, "NEO-M9N");
-                            break;
-                        default:
-                        case GPS_MODEL_UNKNOWN:
-                            LCD_Puts(0, 1, menu_level == 1 ? "Unknown":"Auto");
-                            break;
-                    }
-                    break;
-                case SCREEN_GPS_LAST_FRAME:
-                    LCD_Puts(1, 0, "Frame:");
-                    LCD_Puts(0, 1, gps_last_frame);
-                    if(gps_last_frame_changed)
-                    {
-                        menu_force_redraw();
-                        gps_last_frame_changed = false;
-                    }
-                    break;
-                case SCREEN_GPS_EXIT:
-                    LCD_Puts(1, 0, "Exit?");
-                    LCD_Puts(0, 1, "        ");
-                    break;
-            }
+            display_puts(0, 1, gps_date);
         }
-        break;
-    case SCREEN_UPTIME:
-        LCD_Puts(1, 0, "UPTIME:");
-        LCD_Puts(0, 1, "        ");
-        snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%ld", device_uptime);
-        LCD_Puts(0, 1, screen_buffer);
-        break;
-    case SCREEN_FRAMES:
-        LCD_Puts(1, 0, "GGA FR:");
-        LCD_Puts(0, 1, "        ");
-        snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%ld", gga_frames);
-        LCD_Puts(0, 1, screen_buffer);
-        break;
-    case SCREEN_CONTRAST:
-        LCD_Puts(1, 0, menu_level == 0 ? "CNTRST:":"CNTRST?");
-        LCD_Puts(0, 1, "        ");
-        snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%d", contrast);
-        LCD_Puts(0, 1, screen_buffer);
-        break;
-    case SCREEN_PPS:
-        // Screen with pps
-        // Clear line 2
-        LCD_Puts(0, 1, "        ");
-        if(menu_level == 0)
+        if(duration >= 2*DATE_TIME_DURATION)
         {
-            snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "PPS:%3ld", pps_sync_count);
-            LCD_Puts(1, 0, screen_buffer);
-            snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%ld", pps_error);
-            LCD_Puts(0, 1, screen_buffer);
-        }
-        else
-        {
-            switch (current_menu_pps_screen)
-            {
-                default:
-                case SCREEN_PPS_SHIFT:
-                    LCD_Puts(1, 0, "Shift:");
-                    // Check we have enough space for minus sign
-                    snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%ld", (pps_error < -9999999) ? abs(pps_error) : pps_error);
-                    LCD_Puts(0, 1, screen_buffer);
-                    break;
-                case SCREEN_PPS_SHIFT_MS:
-                    LCD_Puts(1, 0, "Sft ms:");
-                    snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%ld.%04d", pps_millis / 10000, abs(pps_millis) % 10000);
-                    LCD_Puts(0, 1, screen_buffer);
-                    break;
-                case SCREEN_PPS_SYNC_COUNT:
-                    LCD_Puts(1, 0, "SynCnt:");
-                    snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%ld", pps_sync_count);
-                    LCD_Puts(0, 1, screen_buffer);
-                    break;
-                case SCREEN_PPS_SYNC_MODE:
-                    LCD_Puts(1, 0, menu_level == 1 ? "Sync.:":"Sync.?");
-                    LCD_Puts(0, 1, pps_sync_on ? "      ON" : "     OFF");
-                    break;
-                case SCREEN_PPS_SYNC_DELAY:
-                    LCD_Puts(1, 0, menu_level == 1 ? "Delay:":"Delay?");
-                    snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%ld", pps_sync_delay);
-                    LCD_Puts(0, 1, screen_buffer);
-                    break;
-                case SCREEN_PPS_SYNC_THRESHOLD:
-                    LCD_Puts(1, 0, menu_level == 1 ? "Thrsld:":"Thrsld?");
-                    snprintf(screen_buffer, SCREEN_BUFFER_SIZE, "%ld", pps_sync_threshold);
-                    LCD_Puts(0, 1, screen_buffer);
-                    break;
-                case SCREEN_PPS_FORCE_SYNC:
-                    if(menu_level == 1)
-                    {
-                        LCD_Puts(1, 0,  " Force ");
-                        LCD_Puts(0, 1, "  sync ?");
-                    }
-                    else
-                    {
-                        LCD_Puts(1, 0,  " Forced");
-                        LCD_Puts(0, 1, "  sync !");
-                        sync_pps_out = true;
-                        menu_level = 1;
-                    }
-                    break;
-                case SCREEN_PPS_EXIT:
-                    LCD_Puts(1, 0, "Exit?");
-                    LCD_Puts(0, 1, "        ");
-                    break;
-            }
+            last_hour_date_screen_update = now;
         }
-        break;
-    case SCREEN_VERSION:
-        LCD_Puts(1, 0, "Vers.:");
-        LCD_Puts(0, 1, FIRMWARE_VERSION);
-        break;
     }
 }
 
-void menu_run()
+static const menu_screen_t menu_screens[SCREEN_MAX] = {
+    [SCREEN_MAIN]       = { menu_draw_main, NULL, 0, MENU_SCREEN_BOOT },
+    [SCREEN_DATE]       = { menu_draw_main, NULL, 0, MENU_SCREEN_BOOT },
+    [SCREEN_DATE_TIME]  = { menu_draw_main, NULL, 0, MENU_SCREEN_BOOT },
+    [SCREEN_TREND]      = { menu_draw_trend_main, MENU_ITEMS(menu_trend_items), MENU_SCREEN_SUB_MENU | MENU_SCREEN_GRAPHIC | MENU_SCREEN_BOOT },
+    [SCREEN_SNR]        = { menu_draw_snr_main, NULL, 0, MENU_SCREEN_GRAPHIC },
+    [SCREEN_PPB]        = { menu_draw_ppb_main, MENU_ITEMS(menu_ppb_items), MENU_SCREEN_SUB_MENU },
+    [SCREEN_PWM]        = { NULL, MENU_ITEMS(menu_pwm_items), MENU_SCREEN_DIRECT },
+    [SCREEN_GPS]        = { menu_draw_gps_main, MENU_ITEMS(menu_gps_items), MENU_SCREEN_SUB_MENU },
+    [SCREEN_UPTIME]     = { NULL, MENU_ITEMS(menu_uptime_items), 0 },
+    [SCREEN_FRAMES]     = { NULL, MENU_ITEMS(menu_frames_items), 0 },
+    [SCREEN_CONTRAST]   = { NULL, MENU_ITEMS(menu_contrast_items), MENU_SCREEN_DIRECT },
+    [SCREEN_PPS]        = { menu_draw_pps_main, MENU_ITEMS(menu_pps_items), MENU_SCREEN_SUB_MENU },
+    [SCREEN_VERSION]    = { NULL, MENU_ITEMS(menu_version_items), 0 },
+};
+
+// Trend and SNR screens may need all 8 custom chars for graphic display
+static bool menu_screen_is_graphic(menu_screen screen) { return menu_screens[screen].flags & MENU_SCREEN_GRAPHIC; }
+
+static const menu_item_t* menu_current_item() { return &menu_screens[current_menu_screen].items[menu_item_index[current_menu_screen]]; }
+
+static void menu_draw()
 {
+    const menu_screen_t* screen = &menu_screens[current_menu_screen];
+    if(menu_level == 0 && screen->draw)
+    {
+        screen->draw();
+    }
+    else
+    {
+        menu_draw_item(menu_current_item(), menu_level == 2);
+    }
+}
 
-    // Detect rotary encoder value change
-    uint32_t new_encoder_value = TIM3->CNT / 2;
-    if(new_encoder_value != last_encoder_value)
+// Turning speed from the time between detents, smoothed over the last ones and reset when the encoder stops or turns back
+static void menu_update_encoder_speed(int16_t increment, uint32_t now)
+{
+    uint32_t elapsed = now - last_encoder_time;
+    if(elapsed >= ENCODER_IDLE_TIME || (increment < 0) != encoder_backward)
     {
-        menu_screen previous_menu_screen = current_menu_screen;
-        int encoder_increment = (new_encoder_value < last_encoder_value)? -1 : +1;
-        // Handle overflow cases
-        if(new_encoder_value == 32767 && last_encoder_value == 0)
+        encoder_speed = 0;
+    }
+    else
+    {
+        uint32_t speed = (uint32_t)abs(increment) * 1000 / (elapsed ? elapsed : 1);
+        encoder_speed = (encoder_speed + (speed > UINT16_MAX ? UINT16_MAX : speed)) / 2;
+    }
+    encoder_backward = increment < 0;
+    last_encoder_time = now;
+}
+
+static void menu_rotate(int16_t encoder_increment, uint32_t time)
+{
+    const menu_screen_t* screen = &menu_screens[current_menu_screen];
+    menu_screen previous_menu_screen = current_menu_screen;
+    menu_update_encoder_speed(encoder_increment, time);
+    if(menu_level == 0)
+    {   // Main menu => change menu screen
+        current_menu_screen = (current_menu_screen + SCREEN_MAX + encoder_increment % SCREEN_MAX) % SCREEN_MAX;
+        uint32_t now = HAL_GetTick();
+        if(current_menu_screen != previous_menu_screen)
         {
-            encoder_increment = -1;
+            last_menu_change = now;
         }
-        else if (new_encoder_value == 0 && last_encoder_value == 32767)
+        // Reset counter for date/time screen
+        last_hour_date_screen_update = now;
+    }
+    else if(menu_level == 1)
+    {   // Sub menu => change item
+        uint8_t* index = &menu_item_index[current_menu_screen];
+        *index = (*index + screen->item_count + encoder_increment % screen->item_count) % screen->item_count;
+    }
+    else
+    {   // Edit the current item
+        menu_item_edit(menu_current_item(), encoder_increment);
+    }
+}
+
+static void menu_click()
+{
+    const menu_screen_t* screen = &menu_screens[current_menu_screen];
+    if (menu_level == 0) {
+        if(screen->flags & MENU_SCREEN_DIRECT)
         {
-            encoder_increment = +1;
-        }
-        if(menu_level == 0)
-        {   // Main menu => change menu screen
-            current_menu_screen =  (current_menu_screen + encoder_increment) % SCREEN_MAX;
-            if(current_menu_screen >= SCREEN_MAX) current_menu_screen = SCREEN_MAX-1; // Roll over for first sceen - 1
-            uint32_t now = HAL_GetTick();
-            if(current_menu_screen != previous_menu_screen)
-            {
-                last_menu_change = now;
-            }
-            // Reset counter for date/time screen
-            last_hour_date_screen_update = now;
-            LCD_Clear();
-            menu_force_redraw();
-        }
-        else if(menu_level == 1)
-        {   // Sub menu
-            switch(current_menu_screen)
-            {
-                case SCREEN_TREND:
-                    {
-                        // Trend view => change trend menu
-                        current_menu_trend_screen =  (current_menu_trend_screen + encoder_increment) % SCREEN_TREND_MAX;
-                        if(current_menu_trend_screen >= SCREEN_TREND_MAX) current_menu_trend_screen = SCREEN_TREND_MAX-1; // Roll over for first sceen - 1
-                        LCD_Clear();
-                        menu_force_redraw();
-                    }
-                    break;
-                case SCREEN_PWM:
-                    // Go back to main menu
-                    LCD_Clear();
-                    menu_force_redraw();
-                    menu_level = 0;
-                    break;
-                case SCREEN_PPB:
-                    {
-                        // PPB view => change ppb menu
-                        current_menu_ppb_screen =  (current_menu_ppb_screen + encoder_increment) % SCREEN_PPB_MAX;
-                        if(current_menu_ppb_screen >= SCREEN_PPB_MAX) current_menu_ppb_screen = SCREEN_PPB_MAX-1; // Roll over for first sceen - 1
-                        LCD_Clear();
-                        menu_force_redraw();
-                    }
-                    break;
-                case SCREEN_GPS:
-                    {
-                        // GPS view => change gps menu
-                        current_menu_gps_screen =  (current_menu_gps_screen + encoder_increment) % SCREEN_GPS_MAX;
-                        if(current_menu_gps_screen >= SCREEN_GPS_MAX) current_menu_gps_screen = SCREEN_GPS_MAX-1; // Roll over for first sceen - 1
-                        LCD_Clear();
-                        menu_force_redraw();
-                    }
-                    break;
-                case SCREEN_CONTRAST:
-                    // Update contrast
-                    contrast += encoder_increment;
-                    if(contrast < 0) contrast = 0;
-                    if(contrast > 100) contrast = 100;
-                    update_contrast();
-                    LCD_Clear();
-                    menu_force_redraw();
-                    break;
-                case SCREEN_PPS:
-                    {
-                        // PPB view => change ppb menu
-                        current_menu_pps_screen =  (current_menu_pps_screen + encoder_increment) % SCREEN_PPS_MAX;
-                        if(current_menu_pps_screen >= SCREEN_PPS_MAX) current_menu_pps_screen = SCREEN_PPS_MAX-1; // Roll over for first sceen - 1
-                        LCD_Clear();
-                        menu_force_redraw();
-                    }
-                    break;
-                default:
-                    break;
-            }
+            menu_level = 2;
         }
-        else if(menu_level == 2 && current_menu_screen == SCREEN_TREND)
-        {   // Sub-sub menu for TREND screen
-            switch(current_menu_trend_screen)
-            {
-                case SCREEN_TREND_MAIN:
-                    {
-                    // Update position
-                    int32_t new_trend_shift = trend_shift + (encoder_increment * trend_h_scale);
-                    trend_arrow = encoder_increment < 0 ? TREND_LEFT_CODE : TREND_RIGHT_CODE;
-                    if(new_trend_shift < 0)
-                    {
-                        trend_shift = 0;
-                        trend_arrow = TREND_LEFT_CODE;
-                    }
-                    else if(new_trend_shift >= TREND_MAX_SHIFT)
-                    {
-                        trend_shift = TREND_MAX_SHIFT;
-                        trend_arrow = TREND_RIGHT_CODE;
-                    }
-                    else
-                    {
-                        trend_shift = new_trend_shift;
-                    }
-                    LCD_Clear();
-                    menu_force_redraw();
-                    break;
-                    }
-                case SCREEN_TREND_AUTO_V:
-                    // Update mode
-                    trend_auto_v = !trend_auto_v;
-                    LCD_Clear();
-                    menu_force_redraw();
-                    break;
-                case SCREEN_TREND_AUTO_H:
-                    // Update mode
-                    trend_auto_h = !trend_auto_h;
-                    LCD_Clear();
-                    menu_force_redraw();
-                    break;
-                case SCREEN_TREND_V_SCALE:
-                    {
-                    // Update v scale
-                    uint32_t multiplier;
-                    if(trend_v_scale > 2000 || ((trend_v_scale == 2000) && (encoder_increment > 0)))
-                    {
-                        multiplier = 1000;
-                    }
-                    else if(trend_v_scale > 200 || ((trend_v_scale == 200) && (encoder_increment > 0)))
-                    {
-                        multiplier = 100;
-                    }
-                    else
-                    {
-                        multiplier = 10;
-                    }
-                    trend_v_scale += (multiplier*encoder_increment);
-                    trend_v_scale = menu_round_v_scale(trend_v_scale);
-                    LCD_Clear();
-                    menu_force_redraw();
-                    break;
-                    }
-                case SCREEN_TREND_H_SCALE:
-                    // Update v scale
-                    trend_h_scale = encoder_increment > 0 ? trend_h_scale * 2 : trend_h_scale/2;
-                    trend_h_scale = menu_roud_h_scale(trend_h_scale);
-                    LCD_Clear();
-                    menu_force_redraw();
-                    break;
-                default:
-                    break;
-            }
+        else if(screen->flags & MENU_SCREEN_SUB_MENU)
+        {
+            menu_level = 1;
         }
-        else if(menu_level == 2 && current_menu_screen == SCREEN_PPB)
-        {   // Sub-sub menu for PPB screen
-            switch(current_menu_ppb_screen)
-            {
-                case SCREEN_PPB_OCXO_MODEL:
-                    { // Update model
-                    ocxo_model =  (ocxo_model + encoder_increment) % (OCXO_MODEL_UNKNOWN+1);
-                    if(ocxo_model > OCXO_MODEL_UNKNOWN) ocxo_model = OCXO_MODEL_UNKNOWN;
-                    LCD_Clear();
-                    menu_force_redraw();
-                    }
-                    break;
-                case SCREEN_PPB_WARMUP_TIME:
-                    { // Update ppb lock threshold
-                    int new_warmup_time = warmup_time_seconds + (encoder_increment);
-                    if(new_warmup_time < 0)
-                    {
-                        new_warmup_time = 0;
-                    }
-                    else if(new_warmup_time > 1000)
-                    {
-                        new_warmup_time = 1000;
-                    }
-                    warmup_time_seconds = new_warmup_time;
-                    LCD_Clear();
-                    menu_force_redraw();
-                    }
-                    break;
-                case SCREEN_PPB_ALGO:
-                    { // Update algorithm
-                    displayed_correction_algorithm =  (displayed_correction_algorithm + encoder_increment) % (CORRECTION_ALGO_ERIC_H+1);
-                    if(displayed_correction_algorithm > CORRECTION_ALGO_ERIC_H) displayed_correction_algorithm = CORRECTION_ALGO_ERIC_H;
-                    LCD_Clear();
-                    menu_force_redraw();
-                    }
-                    break;
-                case SCREEN_PPB_CORRECTION_FACTOR:
-                    { // Update correction factor
-                    correction_factor = increment_correction_factor_value(correction_algorithm,correction_factor,encoder_increment);
-                    LCD_Clear();
-                    menu_force_redraw();
-                    }
-                    break;
-                case SCREEN_PPB_AUTO_SAVE_PWM:
-                    // Update mode
-                    pwm_auto_save = !pwm_auto_save;
-                    LCD_Clear();
-                    menu_force_redraw();
-                    break;
-                case SCREEN_PPB_AUTO_SYNC_PPS:
-                    // Update mode
-                    pps_ppm_auto_sync = !pps_ppm_auto_sync;
-                    LCD_Clear();
-                    menu_force_redraw();
-                    break;
-                case SCREEN_PPB_LOCK_THRESHOLD:
-                    { // Update ppb lock threshold
-                    int new_threshold = ppb_lock_threshold + (5*encoder_increment);
-                    if(new_threshold < 0)
-                    {
-                        new_threshold = 0;
-                    }
-                    else if(new_threshold > MAX_PPB_LOCK_THRESHOLD)
-                    {
-                        new_threshold = MAX_PPB_LOCK_THRESHOLD;
-                    }
-                    ppb_lock_threshold = new_threshold;
-                    LCD_Clear();
-                    menu_force_redraw();
-                    }
-                    break;
-                default:
-                    break;
-            }
+    } else if (menu_level == 1) {
+        const menu_item_t* item = menu_current_item();
+        if(item->flags & MENU_ITEM_EXIT)
+        {   // Go back to main screen to prevent returning to exit screen
+            menu_item_index[current_menu_screen] = 0;
+            menu_level = 0;
         }
-        else if(menu_level == 2 && current_menu_screen == SCREEN_GPS)
-        {   // Sub-sub menu for PPB screen
-            switch(current_menu_gps_screen)
-            {
-                case SCREEN_GPS_BAUDRATE:
-                    { // Update baudrate
-                    baudrate max_baudrate = BAUDRATE_MAX;
-                    switch (gps_model)
-                    {
-                        case GPS_MODEL_ATGM336H:
-                            max_baudrate = BAUDRATE_115200 + 1;
-                            break;
-                        default:
-                            break;
-                    }
-                    gps_baudrate_enum =  (gps_baudrate_enum + encoder_increment) % max_baudrate;
-                    if(gps_baudrate_enum >= max_baudrate) gps_baudrate_enum = max_baudrate-1; // Roll over for first sceen - 1
-                    gps_baudrate = menu_get_baudrate_value(gps_baudrate_enum);
-                    LCD_Clear();
-                    menu_force_redraw();
-                    }
-                    break;
-                case SCREEN_GPS_TIME_OFFSET:
-                    {   // Update time offset
-                        gps_time_offset += encoder_increment;
-                        if (gps_time_offset > MAX_TIME_OFFSET) {
-                            gps_time_offset = MIN_TIME_OFFSET;
-                        } 
-                        else if(gps_time_offset < MIN_TIME_OFFSET)
-                        {
-                            gps_time_offset = MAX_TIME_OFFSET;
-                        }
-
-                        LCD_Clear();
-                        menu_force_redraw();
-                    }
-                    break;
-                case SCREEN_GPS_DATE_FORMAT:
-                    {   // Update date format
-                        int new_gps_date_format = gps_date_format+encoder_increment;
-                        if(new_gps_date_format < DATE_FORMAT_UTC) 
-                        {
-                            new_gps_date_format = DATE_FORMAT_ISO_DASH;
-                        }
-                        else if(new_gps_date_format > DATE_FORMAT_ISO_DASH)
-                        {
-                            new_gps_date_format = DATE_FORMAT_UTC;
-                        }
-                        gps_date_format = new_gps_date_format;
-                        LCD_Clear();
-                        menu_force_redraw();
-                    }
-                    break;
-                case SCREEN_GPS_MODEL:
-                    { // Update model
-                    gps_model =  (gps_model + encoder_increment) % (GPS_MODEL_UNKNOWN+1);
-                    if(gps_model > GPS_MODEL_UNKNOWN) gps_model = GPS_MODEL_UNKNOWN; // Roll over for first sceen - 1
-                    LCD_Clear();
-                    menu_force_redraw();
-                    }
-                    break;
-                default:
-                    break;
-            }
+        else if(item->flags & MENU_ITEM_ACTION)
+        {
+            item->commit();
         }
-        else if(menu_level == 2 && current_menu_screen == SCREEN_PPS)
-        {   // Sub-sub menu for PPS screen
-            switch(current_menu_pps_screen)
+        else if(item->flags & MENU_ITEM_EDIT)
+        {
+            if(!item->lock || !*item->lock)
             {
-                case SCREEN_PPS_SYNC_MODE:
-                    // Update mode
-                    pps_sync_on = !pps_sync_on;
-                    LCD_Clear();
-                    menu_force_redraw();
-                    break;
-                case SCREEN_PPS_SYNC_DELAY:
-                    // Update delay
-                    pps_sync_delay += encoder_increment;
-                    LCD_Clear();
-                    menu_force_redraw();
-                    break;
-                case SCREEN_PPS_SYNC_THRESHOLD:
-                    // Update threshold
-                    pps_sync_threshold += encoder_increment;
-                    LCD_Clear();
-                    menu_force_redraw();
-                    break;
-                case SCREEN_PPS_FORCE_SYNC:
-                    // PPB view => change ppb menu
-                    current_menu_pps_screen =  (current_menu_pps_screen + encoder_increment) % SCREEN_PPS_MAX;
-                    if(current_menu_pps_screen >= SCREEN_PPS_MAX) current_menu_pps_screen = SCREEN_PPS_MAX-1; // Roll over for first sceen - 1
-                    LCD_Clear();
-                    menu_force_redraw();
-                    break;
-                default:
-                    break;
+                menu_level = 2;
             }
         }
-        if(previous_menu_screen == SCREEN_TREND)
-        {   // After trend screen, restore custom icon chars
-            lcd_create_chars();
+        else
+        {
+            menu_level = 0;
         }
-        last_encoder_value = new_encoder_value;
+    } else {
+        // Leave edit mode and save changes
+        menu_item_commit(menu_current_item());
+        menu_level = (screen->flags & MENU_SCREEN_DIRECT) ? 0 : 1;
     }
+}
 
-    if (rotary_get_click()) {
-        if (menu_level == 0) {
-            switch(current_menu_screen)
-            {
-                case SCREEN_TREND:
-                case SCREEN_PPB:
-                case SCREEN_GPS:
-                case SCREEN_PWM:
-                case SCREEN_CONTRAST:
-                case SCREEN_PPS:
-                    menu_level = 1;
-                    LCD_Clear();
-                    break;
-                default:
-                    break;
-            }
-        } else  if (menu_level == 1){
-            switch(current_menu_screen)
-            {
-                case SCREEN_TREND:
-                    switch(current_menu_trend_screen)
-                    {
-                        case SCREEN_TREND_AUTO_H:
-                        case SCREEN_TREND_AUTO_V:
-                        case SCREEN_TREND_MAIN:
-                            menu_level = 2;
-                            break;
-                        case SCREEN_TREND_V_SCALE:
-                            // Prevent editing v scale if auto-v is on
-                            menu_level = trend_auto_v ? 1 : 2;
-                            break;
-                        case SCREEN_TREND_H_SCALE:
-                            // Prevent editing h scale if auto-h is on
-                            menu_level = trend_auto_h ? 1 : 2;
-                            break;
-                        case SCREEN_TREND_EXIT:
-                        default:
-                            // Go back to main screen to prevent returning to exit screen
-                            current_menu_trend_screen = SCREEN_TREND_MAIN;
-                            menu_level = 0;
-                            break;
-                    }
-                    break;
-                case SCREEN_PWM:
-                    ee_storage.pwm = TIM1->CCR2;
-                    EE_Write();
-                    menu_level = 0;
-                    break;
-                case SCREEN_CONTRAST:
-                    if(ee_storage.contrast != contrast)
-                    {   // Contrast has changed => save it to eeprom
-                        ee_storage.contrast = contrast;
-                        EE_Write();
-                    }
-                    menu_level = 0;
-                    break;
-                case SCREEN_PPB:
-                    switch(current_menu_ppb_screen)
-                    {
-                        case SCREEN_PPB_OCXO_MODEL:
-                        case SCREEN_PPB_WARMUP_TIME:
-                        case SCREEN_PPB_ALGO:
-                        case SCREEN_PPB_CORRECTION_FACTOR:
-                        case SCREEN_PPB_AUTO_SAVE_PWM:
-                        case SCREEN_PPB_AUTO_SYNC_PPS:
-                        case SCREEN_PPB_LOCK_THRESHOLD:
-                            menu_level = 2;
-                            break;
-                        case SCREEN_PPB_EXIT:
-                            // Go back to main screen to prevent returning to exit screen
-                            current_menu_ppb_screen = SCREEN_PPB_MEAN;
-                            menu_level = 0;
-                            break;
-                        default:
-                            menu_level = 0;
-                            break;
-                    }
-                    break;
-                case SCREEN_GPS:
-                    switch(current_menu_gps_screen)
-                    {
-                        case SCREEN_GPS_MODEL:
-                        case SCREEN_GPS_DATE_FORMAT:
-                        case SCREEN_GPS_TIME_OFFSET:
-                        case SCREEN_GPS_BAUDRATE:
-                            menu_level = 2;
-                            break;
-                        case SCREEN_GPS_EXIT:
-                            // Go back to main screen to prevent returning to exit screen
-                            current_menu_gps_screen = SCREEN_GPS_TIME;
-                            menu_level = 0;
-                            break;
-                        default:
-                            menu_level = 0;
-                            break;
-                    }
-                    break;
-                case SCREEN_PPS:
-                    switch(current_menu_pps_screen)
-                    {
-                        case SCREEN_PPS_SYNC_MODE:
-                        case SCREEN_PPS_SYNC_DELAY:
-                        case SCREEN_PPS_SYNC_THRESHOLD:
-                        case SCREEN_PPS_FORCE_SYNC:
-                            menu_level = 2;
-                            break;
-                        case SCREEN_PPS_EXIT:
-                            // Go back to main screen to prevent returning to exit screen
-                            current_menu_pps_screen = SCREEN_PPS_SHIFT;
-                            menu_level = 0;
-                            break;
-                        default:
-                            menu_level = 0;
-                            break;
-                    }
-                    break;
-                default:
-                    menu_level = 0;
-                    break;
-            }
-            LCD_Clear();
-        } else  if (menu_level == 2 && current_menu_screen == SCREEN_TREND){
-            switch(current_menu_trend_screen)
-            {
-                case SCREEN_TREND_AUTO_V:
-                    if(ee_storage.trend_auto_v != trend_auto_v)
-                    {   // Save changes
-                        ee_storage.trend_auto_v = trend_auto_v;
-                        EE_Write();
-                    }
-                    break;
-                case SCREEN_TREND_AUTO_H:
-                    if(ee_storage.trend_auto_h != trend_auto_h)
-                    {   // Save changes
-                        ee_storage.trend_auto_h = trend_auto_h;
-                        EE_Write();
-                    }
-                    break;
-                case SCREEN_TREND_V_SCALE:
-                    if(ee_storage.trend_v_scale != trend_v_scale)
-                    {   // Save changes
-                        ee_storage.trend_v_scale = trend_v_scale;
-                        EE_Write();
-                    }
-                    break;
-                case SCREEN_TREND_H_SCALE:
-                    if(ee_storage.trend_h_scale != trend_h_scale)
-                    {   // Save changes
-                        ee_storage.trend_h_scale = trend_h_scale;
-                        EE_Write();
-                    }
-                    break;
-                default:
-                    break;
-            }
-            menu_level = 1;
-            LCD_Clear();
-        } else  if (menu_level == 2 && current_menu_screen == SCREEN_PPB){
-            switch(current_menu_ppb_screen)
-            {
-                case SCREEN_PPB_OCXO_MODEL:
-                    if(ee_storage.ocxo_model != ocxo_model)
-                    {   // Save changes
-                        ee_storage.ocxo_model = ocxo_model;
-                        // Alsa change warmup time accordingly
-                        warmup_time_seconds = get_default_warmup_time(ocxo_model);
-                        ee_storage.warmup_time_seconds = warmup_time_seconds;
-                        EE_Write();
-                    }
-                    break;
-                case SCREEN_PPB_WARMUP_TIME:
-                    if(ee_storage.warmup_time_seconds != warmup_time_seconds)
-                    {   // Save changes
-                        ee_storage.warmup_time_seconds = warmup_time_seconds;
-                        EE_Write();
-                    }
-                    break;
-                case SCREEN_PPB_ALGO:
-                    if(ee_storage.correction_algorithm != displayed_correction_algorithm)
-                    {   // Make sure correction algo and correction are consistant before activating new algo
-                        // Reset correction factor to default value when algo is changed
-                        correction_factor = get_default_correction_factor(displayed_correction_algorithm);
-                        correction_algorithm = displayed_correction_algorithm;
-                        // Save changes
-                        ee_storage.correction_algorithm = correction_algorithm;
-                        ee_storage.correction_factor = correction_factor;
-                        EE_Write();
-                    }
-                    break;
-                case SCREEN_PPB_CORRECTION_FACTOR:
-                    if(ee_storage.correction_factor != correction_factor)
-                    {   // Save changes
-                        ee_storage.correction_factor = correction_factor;
-                        EE_Write();
-                    }
-                    break;
-                case SCREEN_PPB_AUTO_SAVE_PWM:
-                    if(ee_storage.pwm_auto_save != pwm_auto_save)
-                    {   // Save changes
-                        ee_storage.pwm_auto_save = pwm_auto_save;
-                        EE_Write();
-                    }
-                    break;
-                case SCREEN_PPB_AUTO_SYNC_PPS:
-                    if(ee_storage.pps_ppm_auto_sync != pps_ppm_auto_sync)
-                    {   // Save changes
-                        ee_storage.pps_ppm_auto_sync = pps_ppm_auto_sync;
-                        EE_Write();
-                    }
-                    break;
-                case SCREEN_PPB_LOCK_THRESHOLD:
-                    if(ee_storage.ppb_lock_threshold != ppb_lock_threshold)
-                    {   // Save changes
-                        ee_storage.ppb_lock_threshold = ppb_lock_threshold;
-                        EE_Write();
-                    }
-                    break;
-                default:
-                    break;
-            }
-            menu_level = 1;
-            LCD_Clear();
-        } else  if (menu_level == 2 && current_menu_screen == SCREEN_GPS){
-            switch(current_menu_gps_screen)
-            {
-                case SCREEN_GPS_BAUDRATE:
-                    if(ee_storage.gps_baudrate != gps_baudrate)
-                    {   // Save changes
-                        ee_storage.gps_baudrate = gps_baudrate;
-                        EE_Write();
-                        // Reconfigure uart
-                        if(gps_configure_module_uart(gps_baudrate)>=0)
-                        {   // Reconfigure uart
-                            gps_reconfigure_uart(gps_baudrate);
-                            // Save new baudrate on gps module
-                            gps_save_config();
-                        }
-                    }
-                    break;
-                case SCREEN_GPS_TIME_OFFSET:
-                    if(ee_storage.gps_time_offset != ((uint32_t)(gps_time_offset-MIN_TIME_OFFSET)))
-                    {   // Save changes
-                        ee_storage.gps_time_offset = gps_time_offset-MIN_TIME_OFFSET;
-                        EE_Write();
-                    }
-                    break;
-                case SCREEN_GPS_DATE_FORMAT:
-                    if(ee_storage.gps_date_format != gps_date_format)
-                    {   // Save changes
-                        ee_storage.gps_date_format = gps_date_format;
-                        EE_Write();
-                    }
-                    break;
-                case SCREEN_GPS_MODEL:
-                    if(ee_storage.gps_model != gps_model)
-                    {   // Save changes
-                        ee_storage.gps_model = gps_model;
-                        EE_Write();
-                    }
-                    break;
-                default:
-                    break;
-            }
-            menu_level = 1;
-            LCD_Clear();
-        } else  if (menu_level == 2 && current_menu_screen == SCREEN_PPS){
-            switch(current_menu_pps_screen)
-            {
-                case SCREEN_PPS_SYNC_MODE:
-                    if(ee_storage.pps_sync_on != pps_sync_on)
-                    {   // Save changes
-                        ee_storage.pps_sync_on = pps_sync_on;
-                        EE_Write();
-                    }
-                    break;
-                case SCREEN_PPS_SYNC_DELAY:
-                    if(ee_storage.pps_sync_delay != pps_sync_delay)
-                    {   // Save changes
-                        ee_storage.pps_sync_delay = pps_sync_delay;
-                        EE_Write();
-                    }
-                    break;
-                case SCREEN_PPS_SYNC_THRESHOLD:
-                    if(ee_storage.pps_sync_threshold != pps_sync_threshold)
-                    {   // Save changes
-                        ee_storage.pps_sync_threshold = pps_sync_threshold;
-                        EE_Write();
-                    }
-                    break;
-                default:
-                    break;
-            }
-            menu_level = 1;
-            LCD_Clear();
-        }
-        else
+// Long press: leave the sub menu without going through its exit item, or leave edit mode like a click
+static void menu_long_press()
+{
+    if(menu_level == 1)
+    {
+        menu_item_index[current_menu_screen] = 0;
+        menu_level = 0;
+    }
+    else if(menu_level == 2)
+    {
+        menu_click();
+    }
+}
+
+void menu_run()
+{
+    // Input events queued by the SysTick interrupt, double clicks are not used: their clicks already were
+    input_event_t event;
+    while(input_get_event(&event))
+    {
+        switch(event.type)
         {
-            menu_level = 0;
-            LCD_Clear();
+            case INPUT_ROTATE:
+                menu_rotate(event.detents, event.time);
+                break;
+            case INPUT_CLICK:
+                menu_click();
+                break;
+            case INPUT_LONG_PRESS:
+                menu_long_press();
+                break;
+            default:
+                continue;
         }
+        display_clear();
         menu_force_redraw();
     }
 
@@ -1518,44 +1310,32 @@ void menu_run()
         refresh_screen = false;
 
         // Display state icon
-        if(current_menu_screen == SCREEN_TREND && (current_state_icon < 8))
-        {   // Don't use custom icon in trend screen since all 8 custom chars are used for graphic display
-            uint8_t icon;
-            switch (current_state_icon)
-            {
-                default:
-                case 1:
-                    icon = SAT_ICON_1_CODE;
-                    break;
-                case 2:
-                    icon = SAT_ICON_2_CODE;
-                    break;
-                case 3:
-                    icon = SAT_ICON_3_CODE;
-                    break;
-                case 4:
-                    icon = NO_SAT_STD_ICON_CODE;
-                    break;
-            }
-            LCD_PutCustom(0,0,icon);
+        uint8_t state_icon = current_state_icon;
+        bool graphic_icon = menu_screen_is_graphic(current_menu_screen) && (state_icon < 8);
+        if(graphic_icon)
+        {   // Graph glyphs come first in graphic screens, the icon is a custom char only if one is left after drawing
+            display_put_custom(0,0,menu_state_icon_fallback(state_icon));
         }
         else
         {
-            LCD_PutCustom(0,0,current_state_icon);
+            menu_draw_state_icon(state_icon);
         }
-        
+
         // Update PPB trend if needed
         if(update_trend)
         {
-            add_trend_value(abs(frequency_get_ppb()));
+            trend_add(TREND_CHANNEL_PPB, menu_trend_sample(TREND_CHANNEL_PPB));
+            if(trend_source != TREND_CHANNEL_PPB)
+            {
+                trend_add(trend_source, menu_trend_sample(trend_source));
+            }
             update_trend = false;
         }
 
-        if (menu_level > 0 && current_menu_screen == SCREEN_PWM) {
-            LCD_Puts(0, 0, " PRESS ");
-            LCD_Puts(0, 1, "TO SAVE");
-        } else {
-            menu_draw();
+        menu_draw();
+        if(graphic_icon && display_get(0,0) == (uint8_t)menu_state_icon_fallback(state_icon))
+        {
+            menu_draw_state_icon(state_icon);
         }
 
         // Check if we need resync or PWM save
@@ -1581,18 +1361,18 @@ void menu_run()
             }
             if(did_pps && did_pwm)
             {
-                LCD_Puts(0, 0, "PPS&PWM ");
-                LCD_Puts(0, 1, " DONE ! ");
+                display_puts(0, 0, "PPS&PWM ");
+                display_puts(0, 1, " DONE ! ");
             }
             else if(did_pps)
             {
-                LCD_Puts(0, 0, "  PPS  ");
-                LCD_Puts(0, 1, "SYNCED!");
+                display_puts(0, 0, "  PPS  ");
+                display_puts(0, 1, "SYNCED!");
             }
             else if(did_pwm)
             {
-                LCD_Puts(0, 0, "  PWM  ");
-                LCD_Puts(0, 1, "SAVED !");
+                display_puts(0, 0, "  PWM  ");
+                display_puts(0, 1, "SAVED !");
             }
         }
         bool new_ppb_lock_status = frequency_is_stable(ppb_lock_threshold);
@@ -1600,32 +1380,19 @@ void menu_run()
         {   // Update PPB lock status
             ppb_lock_status = new_ppb_lock_status;
             HAL_GPIO_WritePin(PPB_LOCK_OUTPUT_GPIO_Port, PPB_LOCK_OUTPUT_Pin, !ppb_lock_status); // Active low
-            if(current_menu_screen != SCREEN_TREND)
-            {
-                lcd_create_chars();
-            }
         }
 
         // Check if boot menu has to be changed
         if(last_menu_change != 0 && ((HAL_GetTick() - last_menu_change) > BOOT_MENU_SAVE_TIME))
         {   // Filter on eligible boot screens
-            switch (current_menu_screen)
+            if((menu_screens[current_menu_screen].flags & MENU_SCREEN_BOOT) && ee_storage.boot_menu != current_menu_screen)
             {
-                case SCREEN_MAIN:
-                case SCREEN_DATE:
-                case SCREEN_DATE_TIME:
-                case SCREEN_TREND:
-                    if(ee_storage.boot_menu != current_menu_screen)
-                    {
-                        ee_storage.boot_menu = current_menu_screen;
-                        EE_Write();
-                    }
-                    break;
-                
-                default:
-                    break;
+                ee_storage.boot_menu = current_menu_screen;
+                EE_Write();
             }
             last_menu_change = 0;
         }
     }
+    // Send what has changed to the LCD
+    display_flush();
 }
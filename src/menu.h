@@ -2,7 +2,9 @@
 #define _MENU_H_
 
 #include <stdbool.h>
+#include "gps.h"
 #include "int.h"
+#include "trend.h"
 
 // Char code for sat icons
 #define SAT_ICON_1_CODE         '-'//0x7F
@@ -27,17 +29,19 @@ extern bool trend_auto_h;
 extern bool trend_auto_v;
 extern uint32_t trend_v_scale; 
 extern uint32_t trend_h_scale; 
+extern trend_channel trend_source;
 
 extern uint32_t gps_baudrate;
 
 extern uint32_t ppb_lock_threshold; 
 
 void menu_set_current_menu(uint8_t current_menu);
+uint32_t menu_get_baudrate_value(baudrate baudrate_enum);
+baudrate menu_get_baudrate_enum(uint32_t baudrate_value);
 void menu_set_gps_baudrate(uint32_t baudrate);
+// Reflect a baudrate the GPS link fell back to, without reconfiguring anything
+void menu_update_gps_baudrate(uint32_t baudrate);
 void menu_set_correction_algorithm(correction_algo_type algo);
-bool rotary_get_click();
 void menu_run();
-void lcd_create_chars();
-void init_trend_values();
 
 #endif
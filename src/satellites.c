@@ -0,0 +1,180 @@
+#include "satellites.h"
+#include <stdlib.h>
+#include <string.h>
+
+// GSA systemId field (NMEA 4.10) to talker
+static const nmea_talker_type gsa_systems[] = { NMEA_TALKER_OTHER, NMEA_TALKER_GP, NMEA_TALKER_GL, NMEA_TALKER_GA, NMEA_TALKER_BD };
+
+satellite_t satellites[SATELLITES_MAX];
+uint8_t     satellites_count = 0;
+
+// Start of the next comma separated field, NULL at the end of the sentence
+static const char* satellites_next_field(const char* field)
+{
+    while (*field != ',') {
+        if (*field == '*' || *field == '\0') {
+            return NULL;
+        }
+        field++;
+    }
+    return field + 1;
+}
+
+static uint8_t satellites_field_count(const char* field)
+{
+    uint8_t count = 0;
+    while (field != NULL) {
+        count++;
+        field = satellites_next_field(field);
+    }
+    return count;
+}
+
+static nmea_talker_type satellites_talker(const char* line)
+{
+    if (line[1] == 'G' && line[2] == 'B') {
+        // Beidou has two talker ids
+        return NMEA_TALKER_BD;
+    }
+    for (int i = 0; i < NMEA_TALKER_OTHER; i++) {
+        const char* name = gps_nmea_talker_name(i);
+        if (line[1] == name[0] && line[2] == name[1]) {
+            return i;
+        }
+    }
+    return NMEA_TALKER_OTHER;
+}
+
+static satellite_t* satellites_find(nmea_talker_type system, uint16_t prn)
+{
+    for (uint8_t i = 0; i < satellites_count; i++) {
+        // Combined (GN) sentences without system id match any system
+        if (satellites[i].prn == prn && (satellites[i].system == system || system == NMEA_TALKER_GN || system == NMEA_TALKER_OTHER)) {
+            return &satellites[i];
+        }
+    }
+    return NULL;
+}
+
+static satellite_t* satellites_add(nmea_talker_type system, uint16_t prn)
+{
+    satellite_t* satellite = satellites_find(system, prn);
+    if (satellite == NULL && satellites_count < SATELLITES_MAX) {
+        satellite             = &satellites[satellites_count++];
+        satellite->system     = system;
+        satellite->prn        = prn;
+        // Not used in the fix until a GSA says so
+        satellite->used_epoch = (uint8_t)(gga_frames - 0x80);
+    }
+    return satellite;
+}
+
+// Drop the satellites of a system that were not listed in its last GSV sequence
+static void satellites_remove_stale(nmea_talker_type system)
+{
+    uint8_t kept = 0;
+    for (uint8_t i = 0; i < satellites_count; i++) {
+        if (satellites[i].system != system || satellites[i].refreshed) {
+            satellites[kept++] = satellites[i];
+        }
+    }
+    satellites_count = kept;
+}
+
+// $xxGSV,total,number,in view{,prn,elevation,azimuth,snr}*4[,signal id]*hh, each sentence updates the table in place
+void satellites_parse_gsv(const char* line)
+{
+    nmea_talker_type system = satellites_talker(line);
+    const char*      field  = satellites_next_field(line);
+    if (field == NULL || satellites_field_count(field) < 3) {
+        return;
+    }
+    uint8_t total  = atoi(field);
+    field          = satellites_next_field(field);
+    uint8_t number = atoi(field);
+    field          = satellites_next_field(satellites_next_field(field));
+    if (number == 1) {
+        // New sequence for this system
+        for (uint8_t i = 0; i < satellites_count; i++) {
+            if (satellites[i].system == system) {
+                satellites[i].refreshed = false;
+            }
+        }
+    }
+    // Up to 4 satellites, a trailing signal id makes the field count odd
+    for (uint8_t groups = satellites_field_count(field) / 4; groups > 0; groups--) {
+        uint16_t prn       = atoi(field);
+        int8_t   elevation = atoi(field = satellites_next_field(field));
+        uint16_t azimuth   = atoi(field = satellites_next_field(field));
+        uint8_t  snr       = atoi(field = satellites_next_field(field));
+        field              = satellites_next_field(field);
+        satellite_t* satellite = (prn != 0) ? satellites_add(system, prn) : NULL;
+        if (satellite != NULL) {
+            satellite->elevation = elevation;
+            satellite->azimuth   = azimuth;
+            satellite->snr       = snr;
+            satellite->refreshed = true;
+        }
+    }
+    if (number == total) {
+        satellites_remove_stale(system);
+    }
+}
+
+// $xxGSA,mode,fix type{,prn}*12,pdop,hdop,vdop[,system id]*hh
+void satellites_parse_gsa(const char* line)
+{
+    nmea_talker_type system = satellites_talker(line);
+    const char*      field  = satellites_next_field(line);
+    uint8_t          count  = satellites_field_count(field);
+    if (count < 14) {
+        return;
+    }
+    const char* prns = satellites_next_field(satellites_next_field(field));
+    if (system == NMEA_TALKER_GN && count >= 18) {
+        const char* system_id = prns;
+        for (int i = 0; i < 15; i++) {
+            system_id = satellites_next_field(system_id);
+        }
+        uint8_t id = atoi(system_id);
+        system     = (id < sizeof(gsa_systems) / sizeof(gsa_systems[0])) ? gsa_systems[id] : NMEA_TALKER_OTHER;
+    }
+    field = prns;
+    for (int i = 0; i < 12 && field != NULL; i++, field = satellites_next_field(field)) {
+        uint16_t     prn       = atoi(field);
+        satellite_t* satellite = (prn != 0) ? satellites_find(system, prn) : NULL;
+        if (satellite != NULL) {
+            satellite->used_epoch = gga_frames;
+        }
+    }
+}
+
+// GSA is sent after GGA in the same epoch, a satellite is used if it was reported in the current or previous epoch
+bool satellites_used(const satellite_t* satellite) { return (uint8_t)((uint8_t)gga_frames - satellite->used_epoch) <= 1; }
+
+void satellites_summary(satellites_summary_t* summary)
+{
+    uint32_t sum = 0;
+    memset(summary, 0, sizeof(*summary));
+    summary->in_view = satellites_count;
+    for (uint8_t i = 0; i < satellites_count; i++) {
+        const satellite_t* satellite = &satellites[i];
+        if (satellites_used(satellite)) {
+            summary->used++;
+        }
+        if (satellite->snr == 0) {
+            continue;
+        }
+        if (summary->tracked == 0 || satellite->snr < summary->min_snr) {
+            summary->min_snr = satellite->snr;
+        }
+        if (satellite->snr > summary->max_snr) {
+            summary->max_snr = satellite->snr;
+        }
+        sum += satellite->snr;
+        summary->tracked++;
+    }
+    if (summary->tracked > 0) {
+        summary->mean_snr = sum / summary->tracked;
+    }
+}
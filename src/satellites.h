@@ -0,0 +1,41 @@
+#ifndef _SATELLITES_H_
+#define _SATELLITES_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "gps.h"
+
+// Satellites in view, rebuilt sentence by sentence from GSV (position and C/N0) and GSA (satellites used in the fix)
+
+#define SATELLITES_MAX  32
+
+typedef struct {
+    nmea_talker_type system;
+    uint16_t         prn;
+    int8_t           elevation;     // degrees
+    uint16_t         azimuth;       // degrees
+    uint8_t          snr;           // C/N0 in dBHz, 0 when not tracked
+    uint8_t          used_epoch;    // Low byte of gga_frames when last reported in GSA
+    bool             refreshed;     // Seen in the GSV sequence being received
+} satellite_t;
+
+typedef struct {
+    uint8_t in_view;
+    uint8_t tracked;    // Satellites with a C/N0
+    uint8_t used;
+    uint8_t mean_snr;   // Over tracked satellites, dBHz
+    uint8_t min_snr;
+    uint8_t max_snr;
+} satellites_summary_t;
+
+extern satellite_t satellites[SATELLITES_MAX];
+extern uint8_t     satellites_count;
+
+// Called by gps_parse() for each GSV / GSA sentence (with checksum already verified)
+void satellites_parse_gsv(const char* line);
+void satellites_parse_gsa(const char* line);
+
+bool satellites_used(const satellite_t* satellite);
+void satellites_summary(satellites_summary_t* summary);
+
+#endif
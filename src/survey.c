@@ -0,0 +1,207 @@
+#include "survey.h"
+#include "casic.h"
+#include "eeprom.h"
+#include "gps.h"
+#include "ubx.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define UBX_CFG_TMODE2                  0x3D
+#define CASIC_CFG_TMODE                 0x06
+#define UBX_KEY_TMODE_MODE              0x20030001
+#define UBX_KEY_TMODE_POS_TYPE          0x20030002
+#define UBX_KEY_TMODE_LAT               0x40030009
+#define UBX_KEY_TMODE_LON               0x4003000A
+#define UBX_KEY_TMODE_HEIGHT            0x4003000B
+#define UBX_KEY_TMODE_FIXED_POS_ACC     0x4003000F
+
+// Samples further than this from the first one (about 11 km) are outliers
+#define SURVEY_MAX_DEVIATION    (1 << 20)
+// Size of 1e-7 degree of latitude, in cm
+#define SURVEY_CM_PER_UNIT      1.1132f
+#define SURVEY_UNSET            0xFFFFFFFF
+
+typedef enum { SURVEY_LATITUDE, SURVEY_LONGITUDE, SURVEY_HEIGHT, SURVEY_AXES } survey_axis;
+
+survey_state_type survey_state   = SURVEY_IDLE;
+uint32_t          survey_minutes = DEFAULT_SURVEY_MINUTES;
+
+// Running sums of the offsets to the first sample, mean and variance are derived from them in fixed point
+static int32_t  survey_origin[SURVEY_AXES];
+static int64_t  survey_sum[SURVEY_AXES];
+static int64_t  survey_sum_squares[SURVEY_AXES];
+static uint32_t survey_samples     = 0;
+static uint32_t survey_accuracy_cm = 0;
+
+static inline void survey_put_u32(uint8_t* p, uint32_t v) { p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24; }
+
+void survey_init()
+{
+    if (ee_storage.survey_minutes == SURVEY_UNSET) {
+        ee_storage.survey_minutes = DEFAULT_SURVEY_MINUTES;
+    }
+    survey_minutes = ee_storage.survey_minutes;
+    if (ee_storage.survey_accuracy != SURVEY_UNSET) {
+        survey_accuracy_cm = ee_storage.survey_accuracy;
+        survey_state       = SURVEY_FIXED;
+    }
+}
+
+// Variance of one axis, in units^2
+static int64_t survey_variance(survey_axis axis)
+{
+    int64_t mean     = survey_sum[axis] / survey_samples;
+    int64_t variance = survey_sum_squares[axis] / survey_samples - mean * mean;
+    return (variance > 0) ? variance : 0;
+}
+
+static void survey_update_accuracy()
+{
+    float cos_latitude = cosf(survey_origin[SURVEY_LATITUDE] * (float)(M_PI / 180e7));
+    float unit2        = SURVEY_CM_PER_UNIT * SURVEY_CM_PER_UNIT;
+    float variance     = survey_variance(SURVEY_LATITUDE) * unit2 + survey_variance(SURVEY_LONGITUDE) * unit2 * cos_latitude * cos_latitude
+        + survey_variance(SURVEY_HEIGHT);
+    survey_accuracy_cm = (uint32_t)sqrtf(variance);
+}
+
+static void survey_send_fixed_position(bool fixed)
+{
+    int32_t  latitude  = ee_storage.survey_latitude;
+    int32_t  longitude = ee_storage.survey_longitude;
+    int32_t  height    = ee_storage.survey_height;
+    uint32_t accuracy  = ee_storage.survey_accuracy;
+    switch (gps_model) {
+        case GPS_MODEL_NEO6M: {
+            // CFG-TMODE2, only accepted by timing variants of the receiver
+            uint8_t payload[28] = { 0 };
+            payload[0] = fixed ? 2 : 0;
+            payload[2] = 0x01; // Position is given as latitude / longitude / height
+            survey_put_u32(payload + 4, latitude);
+            survey_put_u32(payload + 8, longitude);
+            survey_put_u32(payload + 12, height);
+            survey_put_u32(payload + 16, accuracy * 10); // mm
+            ubx_send(UBX_CLASS_CFG, UBX_CFG_TMODE2, payload, sizeof(payload));
+            break;
+        }
+        case GPS_MODEL_NEOM9N: {
+            // CFG-TMODE-* keys, only accepted by timing variants of the receiver
+            uint8_t payload[4 + 2 * 5 + 4 * 8] = { 0, 0x01, 0, 0 };
+            uint8_t* p = payload + 4;
+            survey_put_u32(p, UBX_KEY_TMODE_MODE);
+            p[4] = fixed ? 2 : 0;
+            p += 5;
+            survey_put_u32(p, UBX_KEY_TMODE_POS_TYPE);
+            p[4] = 1; // LLH
+            p += 5;
+            const uint32_t keys[4]   = { UBX_KEY_TMODE_LAT, UBX_KEY_TMODE_LON, UBX_KEY_TMODE_HEIGHT, UBX_KEY_TMODE_FIXED_POS_ACC };
+            const uint32_t values[4] = { latitude, longitude, height, accuracy * 100 }; // 0.1 mm
+            for (int i = 0; i < 4; i++, p += 8) {
+                survey_put_u32(p, keys[i]);
+                survey_put_u32(p + 4, values[i]);
+            }
+            ubx_send(UBX_CLASS_CFG, UBX_CFG_VALSET, payload, sizeof(payload));
+            break;
+        }
+        case GPS_MODEL_ATGM336H: {
+            // CFG-TMODE: mode U4, fixedPos R8[3] (ECEF, m), fixedPosVar R4 (m^2), svinMinDur U4, svinVarLimit R4
+            uint8_t payload[40] = { 0 };
+            payload[0]          = fixed ? 2 : 0;
+            // WGS84 ellipsoid
+            const double a        = 6378137.0;
+            const double e2       = 6.69437999014e-3;
+            double       lat      = latitude * (M_PI / 180e7);
+            double       lon      = longitude * (M_PI / 180e7);
+            double       h        = height / 100.0;
+            double       n        = a / sqrt(1 - e2 * sin(lat) * sin(lat));
+            double       ecef[3]  = { (n + h) * cos(lat) * cos(lon), (n + h) * cos(lat) * sin(lon), (n * (1 - e2) + h) * sin(lat) };
+            float        variance = (accuracy / 100.0f) * (accuracy / 100.0f);
+            memcpy(payload + 4, ecef, sizeof(ecef));
+            memcpy(payload + 28, &variance, sizeof(variance));
+            casic_send(CASIC_CLASS_CFG, CASIC_CFG_TMODE, payload, sizeof(payload));
+            break;
+        }
+        case GPS_MODEL_UNKNOWN:
+            break;
+    }
+}
+
+// Let the receiver compute its position again and forget the saved result, so that a reboot does not restore it
+static void survey_leave_fixed()
+{
+    if (survey_state == SURVEY_FIXED) {
+        survey_send_fixed_position(false);
+    }
+    if (ee_storage.survey_accuracy != SURVEY_UNSET) {
+        ee_storage.survey_accuracy = SURVEY_UNSET;
+        EE_Write();
+    }
+}
+
+void survey_start()
+{
+    survey_leave_fixed();
+    memset(survey_sum, 0, sizeof(survey_sum));
+    memset(survey_sum_squares, 0, sizeof(survey_sum_squares));
+    survey_samples     = 0;
+    survey_accuracy_cm = 0;
+    survey_state       = SURVEY_RUNNING;
+}
+
+void survey_stop()
+{
+    survey_leave_fixed();
+    survey_state = SURVEY_IDLE;
+}
+
+void survey_apply()
+{
+    if (survey_state == SURVEY_FIXED) {
+        survey_send_fixed_position(true);
+    }
+}
+
+void survey_add_position(int32_t latitude, int32_t longitude, int32_t height)
+{
+    if (survey_state != SURVEY_RUNNING) {
+        return;
+    }
+    int32_t position[SURVEY_AXES] = { latitude, longitude, height };
+    if (survey_samples == 0) {
+        memcpy(survey_origin, position, sizeof(survey_origin));
+    }
+    for (int i = 0; i < SURVEY_AXES; i++) {
+        if (abs(position[i] - survey_origin[i]) > SURVEY_MAX_DEVIATION) {
+            return;
+        }
+    }
+    for (int i = 0; i < SURVEY_AXES; i++) {
+        int64_t offset = position[i] - survey_origin[i];
+        survey_sum[i] += offset;
+        survey_sum_squares[i] += offset * offset;
+    }
+    survey_samples++;
+    survey_update_accuracy();
+
+    if (survey_samples >= survey_minutes * 60) {
+        // Done: save mean position and switch the receiver to fixed position mode
+        ee_storage.survey_latitude  = survey_origin[SURVEY_LATITUDE] + survey_sum[SURVEY_LATITUDE] / survey_samples;
+        ee_storage.survey_longitude = survey_origin[SURVEY_LONGITUDE] + survey_sum[SURVEY_LONGITUDE] / survey_samples;
+        ee_storage.survey_height    = survey_origin[SURVEY_HEIGHT] + survey_sum[SURVEY_HEIGHT] / survey_samples;
+        ee_storage.survey_accuracy  = survey_accuracy_cm;
+        EE_Write();
+        survey_state = SURVEY_FIXED;
+        survey_send_fixed_position(true);
+    }
+}
+
+uint32_t survey_progress()
+{
+    if (survey_state == SURVEY_FIXED) {
+        return 100;
+    }
+    uint32_t total = survey_minutes * 60;
+    return (total == 0) ? 0 : (survey_samples * 100) / total;
+}
+
+uint32_t survey_accuracy() { return survey_accuracy_cm; }
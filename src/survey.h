@@ -0,0 +1,33 @@
+#ifndef _SURVEY_H_
+#define _SURVEY_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Survey-in: average the GPS position while the GPSDO is stationary, then put the receiver in fixed position timing mode
+
+#define DEFAULT_SURVEY_MINUTES  60
+#define MAX_SURVEY_MINUTES      1440
+#define SURVEY_MINUTES_STEP     5
+
+typedef enum { SURVEY_IDLE, SURVEY_RUNNING, SURVEY_FIXED } survey_state_type;
+
+extern survey_state_type survey_state;
+// Survey duration in minutes, 0 disables fixed position mode
+extern uint32_t          survey_minutes;
+
+// Restore a survey result saved in ee_storage
+void     survey_init();
+// Start a new survey, leaving fixed position mode first
+void     survey_start();
+// Stop surveying and leave fixed position mode
+void     survey_stop();
+// Called on each GGA with a valid fix: latitude / longitude in 1e-7 degrees, ellipsoid height in cm
+void     survey_add_position(int32_t latitude, int32_t longitude, int32_t height);
+// Send the fixed position to the receiver (after module (re)configuration)
+void     survey_apply();
+uint32_t survey_progress();
+// 3D standard deviation of the averaged position, in cm
+uint32_t survey_accuracy();
+
+#endif
@@ -0,0 +1,179 @@
+#include "telemetry.h"
+#include "bridge.h"
+#include "gps.h"
+#include "casic.h"
+#include "format.h"
+#include "int.h"
+#include "menu.h"
+#include "satellites.h"
+#include "trend_log.h"
+#include "usart.h"
+#include "ubx.h"
+#include <string.h>
+
+#define TELEMETRY_BUFFER_SIZE   96
+// Room kept for "*XX\r\n"
+#define TELEMETRY_TAIL_SIZE     5
+#define TELEMETRY_FIELDS_END    (telemetry_buffer + TELEMETRY_BUFFER_SIZE - TELEMETRY_TAIL_SIZE)
+
+static char     telemetry_buffer[TELEMETRY_BUFFER_SIZE];
+static uint32_t last_telemetry_uptime    = 0;
+static uint8_t  telemetry_stats_index    = 0;
+static uint8_t  telemetry_counters_index = 0;
+static uint32_t last_gps_rx_bytes        = 0;
+static uint32_t telemetry_loop_max       = 0;
+
+// Sentences are formatted in place in telemetry_buffer: "$PGPSD,<type>" then comma separated fields
+static char* telemetry_begin(const char* type) { return format_string(format_string(telemetry_buffer, TELEMETRY_FIELDS_END, "$PGPSD,"), TELEMETRY_FIELDS_END, type); }
+
+static char* telemetry_string_field(char* end, const char* value)
+{
+    return format_string(format_char(end, TELEMETRY_FIELDS_END, ','), TELEMETRY_FIELDS_END, value);
+}
+
+static char* telemetry_fields(char* end, const int32_t* values, uint8_t count)
+{
+    for (uint8_t i = 0; i < count; i++) {
+        end = format_int(format_char(end, TELEMETRY_FIELDS_END, ','), TELEMETRY_FIELDS_END, values[i], 0, ' ');
+    }
+    return end;
+}
+
+#define TELEMETRY_FIELDS(end, ...) telemetry_fields(end, (const int32_t[]) { __VA_ARGS__ }, sizeof((const int32_t[]) { __VA_ARGS__ }) / sizeof(int32_t))
+
+// Append checksum and line ending to the sentence in telemetry_buffer and send it, a truncated sentence (NULL end) is dropped
+static void telemetry_send(char* end)
+{
+    if (end == NULL) {
+        return;
+    }
+    const char* buffer_end = telemetry_buffer + TELEMETRY_BUFFER_SIZE;
+    uint8_t     checksum   = gps_nmea_checksum(telemetry_buffer);
+    end                    = format_string(format_hex(format_char(end, buffer_end, '*'), buffer_end, checksum, 2), buffer_end, "\r\n");
+    // Never wait for the port, the bridge drops this telemetry frame if the host link is saturated
+    bridge_inject_to_host(telemetry_buffer, end - telemetry_buffer);
+}
+
+// NMEA statistics are sent one counter set per second, cycling through sentence types, talkers and total
+static void telemetry_send_nmea_stats()
+{
+    const char*         name;
+    const nmea_stats_t* stats;
+    if (telemetry_stats_index < NMEA_SENTENCE_MAX) {
+        name  = gps_nmea_sentence_name(telemetry_stats_index);
+        stats = &nmea_sentence_stats[telemetry_stats_index];
+    } else if (telemetry_stats_index < NMEA_SENTENCE_MAX + NMEA_TALKER_MAX) {
+        name  = gps_nmea_talker_name(telemetry_stats_index - NMEA_SENTENCE_MAX);
+        stats = &nmea_talker_stats[telemetry_stats_index - NMEA_SENTENCE_MAX];
+    } else {
+        name  = "ALL";
+        stats = &nmea_total_stats;
+    }
+    telemetry_stats_index = (telemetry_stats_index + 1) % (NMEA_SENTENCE_MAX + NMEA_TALKER_MAX + 1);
+
+    char* end = telemetry_string_field(telemetry_begin("NMEA"), name);
+    telemetry_send(TELEMETRY_FIELDS(end, stats->good, stats->bad_checksum, stats->overlong, stats->truncated));
+}
+
+// Passthrough link counters: bytes to host / to GPS, dropped bytes in each direction, reception overruns and host port errors
+static void telemetry_send_link_stats()
+{
+    telemetry_send(TELEMETRY_FIELDS(telemetry_begin("LINK"), bridge_stats.to_host, bridge_stats.to_gps, bridge_stats.host_overflows,
+        bridge_stats.gps_overflows, gps_rx_overruns, bridge_stats.host_rx_overruns, bridge_stats.host_rx_errors));
+}
+
+void telemetry_loop_time(uint32_t cycles)
+{
+    if (cycles > telemetry_loop_max) {
+        telemetry_loop_max = cycles;
+    }
+}
+
+// GPS link load: received bytes per second, delay from PPS to the parsed GGA (us) and longest main loop iteration (us)
+static void telemetry_send_load()
+{
+    char* end = TELEMETRY_FIELDS(telemetry_begin("LOAD"), gps_rx_bytes - last_gps_rx_bytes, gps_gga_delay,
+        telemetry_loop_max / (HAL_RCC_GetHCLKFreq() / 1000000));
+    last_gps_rx_bytes  = gps_rx_bytes;
+    telemetry_loop_max = 0;
+    telemetry_send(end);
+}
+
+// PPS sample quality: GGA fix quality, satellites, HDOP, weight of the last sample (/256) and rejected samples
+static void telemetry_send_quality()
+{
+    char* end = TELEMETRY_FIELDS(telemetry_begin("QUAL"), gps_fix_quality, num_sats);
+    telemetry_send(TELEMETRY_FIELDS(telemetry_string_field(end, gps_hdop), pps_weight, pps_rejected));
+}
+
+// Satellites in view / tracked / used and C/N0 (dBHz) statistics of the tracked ones
+static void telemetry_send_snr()
+{
+    satellites_summary_t summary;
+    satellites_summary(&summary);
+    telemetry_send(TELEMETRY_FIELDS(telemetry_begin("SNR"), summary.in_view, summary.tracked, summary.used, summary.mean_snr, summary.min_snr,
+        summary.max_snr));
+}
+
+// GPS UART baudrate with its valid sentence / framing / noise / overrun counters, then link state machine counters
+static void telemetry_send_baud_stats()
+{
+    baudrate                index = menu_get_baudrate_enum(huart3.Init.BaudRate);
+    const gps_baud_stats_t* stats = &gps_baud_stats[index];
+    telemetry_send(TELEMETRY_FIELDS(telemetry_begin("BAUD"), huart3.Init.BaudRate, stats->valid, stats->framing, stats->noise, stats->overrun,
+        gps_link_stats.switches, gps_link_stats.retries, gps_link_stats.failures, gps_link_stats.scans, gps_link_stats.detections));
+}
+
+// Trend log records written / restored once UTC time is valid, CRC errors found when restoring, page erases and flash errors
+static void telemetry_send_trend_log_stats()
+{
+    telemetry_send(TELEMETRY_FIELDS(telemetry_begin("TLOG"), trend_log_stats.records, trend_log_stats.restored, trend_log_stats.crc_errors,
+        trend_log_stats.erases, trend_log_stats.write_errors));
+}
+
+// UBX frame counters and last TIM-TP quantization error (ps)
+static void telemetry_send_ubx_stats()
+{
+    telemetry_send(TELEMETRY_FIELDS(telemetry_begin("UBX"), ubx_stats.good, ubx_stats.bad_checksum, ubx_stats.overlong, ubx_stats.acks, ubx_stats.naks,
+        ubx_last_qerr));
+}
+
+// CASIC frame counters and configuration read back from the module
+static void telemetry_send_casic_stats()
+{
+    telemetry_send(TELEMETRY_FIELDS(telemetry_begin("CASIC"), casic_stats.good, casic_stats.bad_checksum, casic_stats.acks, casic_stats.naks,
+        casic_stats.tim_tp, casic_config.baudrate, casic_config.tp_interval, casic_config.tp_width, casic_config.tp_enable));
+}
+
+void telemetry_run()
+{
+    if (device_uptime == last_telemetry_uptime) {
+        return;
+    }
+    // Once per second
+    last_telemetry_uptime = device_uptime;
+    telemetry_send_nmea_stats();
+    telemetry_send_load();
+    telemetry_send_quality();
+    telemetry_send_snr();
+    // Cumulative counters are sent one sentence per second in turn, so that a second of telemetry fits in the bridge inject buffer
+    switch (telemetry_counters_index) {
+        case 0:
+            telemetry_send_link_stats();
+            break;
+        case 1:
+            telemetry_send_baud_stats();
+            break;
+        case 2:
+            telemetry_send_trend_log_stats();
+            break;
+        default:
+            if (gps_model == GPS_MODEL_NEO6M || gps_model == GPS_MODEL_NEOM9N) {
+                telemetry_send_ubx_stats();
+            } else if (gps_model == GPS_MODEL_ATGM336H) {
+                telemetry_send_casic_stats();
+            }
+            break;
+    }
+    telemetry_counters_index = (telemetry_counters_index + 1) % 4;
+}
@@ -0,0 +1,13 @@
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include <stdint.h>
+
+// Telemetry is sent on the GPS passthrough port as proprietary $PGPSD NMEA sentences
+// so that it can be logged along with the GPS stream and ignored by GPS tools
+
+void telemetry_run();
+// Duration of a main loop iteration, in CPU cycles: the longest one is reported every second
+void telemetry_loop_time(uint32_t cycles);
+
+#endif
@@ -0,0 +1,485 @@
+#include "trend.h"
+#include "trend_log.h"
+#include <stddef.h>
+#include <string.h>
+
+// Nibble codes of the seconds blocks, deltas to the previous value are counted in steps of the store:
+// zig-zag step count (-6 to 6) up to 12, then a code followed by a nibble for -4 to 3 steps and 1 more or less,
+// an escape for an 8 bit zig-zag delta and one for a raw 16 bit value (large steps and unset values)
+#define TREND_CODE_STEPS_MAX    12
+#define TREND_CODE_STEPS_ONE    13
+#define TREND_CODE_DELTA8       14
+#define TREND_CODE_RAW          15
+#define TREND_STEPS_ONE_MIN     -4
+#define TREND_STEPS_ONE_MAX     3
+#define TREND_BLOCK_NIBBLES     (TREND_BLOCK_SIZE * 2)
+
+// Steps in 1/256: the PPB value is a mean of 70 MHz tick errors over 128 s, so it moves by multiples of 1 tick / 128 s
+// (11.16 PPB x100) give or take the rounding; the other channels move by units
+#define TREND_STEP_PPB          (100000000000ULL * 256 / (70000000ULL * 128))
+#define TREND_STEP_UNIT         256
+
+// Block index: the first value of each block is kept here, the block data only holds the following ones
+typedef struct {
+    uint32_t first;   // Number of the first second of the block
+    int16_t  value;   // Value of that second
+    uint8_t  length;  // Nibbles used
+} trend_block_index_t;
+
+// Decoding position of the last read, screen points are read in sequence
+typedef struct {
+    uint32_t block;
+    uint32_t second;
+    uint8_t  nibble;
+    int16_t  value;
+} trend_cursor_t;
+
+// History of one channel, storage is sized per store
+typedef struct {
+    uint8_t (*blocks)[TREND_BLOCK_SIZE];
+    trend_block_index_t* block_index;
+    // Aggregated tiers, one row of tier_size buckets per tier but the seconds one
+    trend_bucket_t*      buckets;
+    // First half of the bucket being aggregated for each tier but the seconds one
+    trend_bucket_t*      pending;
+    bool*                pending_set;
+    // Number of buckets completed in each tier
+    uint32_t*            counts;
+    uint8_t              block_slots;
+    uint8_t              tiers;
+    uint8_t              tier_size;
+    // Delta of one step of the nibble codes, in 1/256
+    uint16_t             step;
+    // Number of blocks started, the last one is being filled
+    uint32_t             block_count;
+    int16_t              last_value;
+    // Seconds of history restored from the trend log
+    uint32_t             restored;
+    trend_cursor_t       cursor;
+} trend_store_t;
+
+static uint8_t             trend_ppb_blocks[TREND_BLOCKS][TREND_BLOCK_SIZE];
+static trend_block_index_t trend_ppb_block_index[TREND_BLOCKS];
+static trend_bucket_t      trend_ppb_buckets[(TREND_TIERS - 1) * TREND_TIER_SIZE];
+static trend_bucket_t      trend_ppb_pending[TREND_TIERS - 1];
+static bool                trend_ppb_pending_set[TREND_TIERS - 1];
+static uint32_t            trend_ppb_counts[TREND_TIERS];
+static trend_store_t       trend_ppb = { trend_ppb_blocks, trend_ppb_block_index, trend_ppb_buckets, trend_ppb_pending, trend_ppb_pending_set,
+    trend_ppb_counts, TREND_BLOCKS, TREND_TIERS, TREND_TIER_SIZE, TREND_STEP_PPB };
+
+static uint8_t             trend_aux_blocks[TREND_AUX_BLOCKS][TREND_BLOCK_SIZE];
+static trend_block_index_t trend_aux_block_index[TREND_AUX_BLOCKS];
+static trend_bucket_t      trend_aux_buckets[(TREND_AUX_TIERS - 1) * TREND_AUX_TIER_SIZE];
+static trend_bucket_t      trend_aux_pending[TREND_AUX_TIERS - 1];
+static bool                trend_aux_pending_set[TREND_AUX_TIERS - 1];
+static uint32_t            trend_aux_counts[TREND_AUX_TIERS];
+static trend_store_t       trend_aux = { trend_aux_blocks, trend_aux_block_index, trend_aux_buckets, trend_aux_pending, trend_aux_pending_set,
+    trend_aux_counts, TREND_AUX_BLOCKS, TREND_AUX_TIERS, TREND_AUX_TIER_SIZE, TREND_STEP_UNIT };
+static trend_channel       trend_aux_channel = TREND_CHANNEL_PWM;
+
+// Screen returned by the last trend_get_screen(), one for both stores as a single channel is shown at a time
+typedef struct {
+    const trend_store_t* store;   // NULL when it must be read again
+    uint32_t             shift;
+    uint32_t             h_scale;
+    uint8_t              tier;
+    uint32_t             count;   // Points completed in the tier when the screen was read
+    trend_screen_t       screen;
+} trend_view_t;
+
+static trend_view_t trend_view;
+
+static void trend_reset(trend_store_t* store)
+{
+    memset(store->pending_set, 0, store->tiers - 1);
+    memset(store->counts, 0, store->tiers * sizeof(uint32_t));
+    store->restored     = 0;
+    store->block_count  = 0;
+    store->cursor.block = UINT32_MAX;
+    if (trend_view.store == store) {
+        trend_view.store = NULL;
+    }
+}
+
+void trend_init()
+{
+    trend_reset(&trend_ppb);
+    trend_reset(&trend_aux);
+}
+
+void trend_select_aux(trend_channel channel)
+{
+    if (channel != TREND_CHANNEL_PPB && channel != trend_aux_channel) {
+        trend_aux_channel = channel;
+        trend_reset(&trend_aux);
+    }
+}
+
+// Store holding a channel, NULL if it isn't recorded
+static trend_store_t* trend_store(trend_channel channel)
+{
+    if (channel == TREND_CHANNEL_PPB) {
+        return &trend_ppb;
+    }
+    return (channel == trend_aux_channel) ? &trend_aux : NULL;
+}
+
+static inline uint8_t trend_get_nibble(const uint8_t* block, uint8_t nibble)
+{
+    return (nibble & 1) ? (block[nibble >> 1] & 0x0F) : (block[nibble >> 1] >> 4);
+}
+
+static inline void trend_put_nibble(uint8_t* block, uint8_t nibble, uint8_t code)
+{
+    block[nibble >> 1] |= (nibble & 1) ? code : (code << 4);
+}
+
+static inline uint32_t trend_zigzag(int32_t delta) { return (delta < 0) ? ((uint32_t)(-delta) << 1) - 1 : (uint32_t)delta << 1; }
+static inline int32_t  trend_unzigzag(uint32_t code) { return (code & 1) ? -(int32_t)((code + 1) >> 1) : (int32_t)(code >> 1); }
+
+// Delta of a number of steps, rounded to the nearest unit
+static inline int32_t trend_steps(const trend_store_t* store, int32_t steps)
+{
+    int32_t delta = steps * store->step;
+    return ((delta < 0) ? delta - 128 : delta + 128) / 256;
+}
+
+// Append one second to the seconds blocks, a new block is started when the encoded value doesn't fit in the current one
+static void trend_encode(trend_store_t* store, int16_t value)
+{
+    uint8_t  codes[5];
+    uint8_t  length = 0;
+    bool     set    = value != TREND_UNSET_VALUE && store->last_value != TREND_UNSET_VALUE;
+    int32_t  delta  = (int32_t)value - store->last_value;
+    // Nearest number of steps and what is left
+    int32_t  steps  = set ? ((delta < 0) ? delta * 256 - store->step / 2 : delta * 256 + store->step / 2) / store->step : 0;
+    int32_t  rest   = delta - trend_steps(store, steps);
+    uint32_t zigzag = set ? trend_zigzag(delta) : UINT32_MAX;
+    if (set && rest == 0 && trend_zigzag(steps) <= TREND_CODE_STEPS_MAX) {
+        codes[length++] = trend_zigzag(steps);
+    } else if (set && (rest == 1 || rest == -1) && steps >= TREND_STEPS_ONE_MIN && steps <= TREND_STEPS_ONE_MAX) {
+        codes[length++] = TREND_CODE_STEPS_ONE;
+        codes[length++] = (steps - TREND_STEPS_ONE_MIN) << 1 | (rest > 0);
+    } else if (zigzag <= 0xFF) {
+        codes[length++] = TREND_CODE_DELTA8;
+        codes[length++] = zigzag >> 4;
+        codes[length++] = zigzag & 0x0F;
+    } else {
+        codes[length++] = TREND_CODE_RAW;
+        for (int shift = 12; shift >= 0; shift -= 4) {
+            codes[length++] = ((uint16_t)value >> shift) & 0x0F;
+        }
+    }
+    trend_block_index_t* index = &store->block_index[(store->block_count - 1) % store->block_slots];
+    if (store->block_count == 0 || index->length + length > TREND_BLOCK_NIBBLES) {
+        uint32_t slot = store->block_count % store->block_slots;
+        memset(store->blocks[slot], 0, TREND_BLOCK_SIZE);
+        store->block_index[slot] = (trend_block_index_t) { store->counts[0], value, 0 };
+        store->block_count++;
+    } else {
+        uint8_t* block = store->blocks[(store->block_count - 1) % store->block_slots];
+        for (uint8_t i = 0; i < length; i++) {
+            trend_put_nibble(block, index->length++, codes[i]);
+        }
+    }
+    store->last_value = value;
+}
+
+static inline uint32_t trend_oldest_block(const trend_store_t* store)
+{
+    return (store->block_count > store->block_slots) ? store->block_count - store->block_slots : 0;
+}
+
+// Number of seconds still held by the seconds blocks
+static uint32_t trend_seconds_available(const trend_store_t* store)
+{
+    return (store->block_count == 0) ? 0 : store->counts[0] - store->block_index[trend_oldest_block(store) % store->block_slots].first;
+}
+
+// Block holding a second, the one of the last read when the second is further in it, else found with a binary search of the index
+static uint32_t trend_find_block(const trend_store_t* store, uint32_t second)
+{
+    uint32_t low    = trend_oldest_block(store);
+    uint32_t high   = store->block_count - 1;
+    uint32_t cursor = store->cursor.block;
+    if (cursor != UINT32_MAX && cursor >= low && store->cursor.second <= second
+        && (cursor == high || store->block_index[(cursor + 1) % store->block_slots].first > second)) {
+        return cursor;
+    }
+    while (low < high) {
+        uint32_t middle = (low + high + 1) / 2;
+        if (store->block_index[middle % store->block_slots].first <= second) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return low;
+}
+
+// Value of a second, decoded from the block start or from the last read
+static int16_t trend_decode(trend_store_t* store, uint32_t second)
+{
+    uint32_t                   low    = trend_find_block(store, second);
+    const trend_block_index_t* index  = &store->block_index[low % store->block_slots];
+    const uint8_t*             block  = store->blocks[low % store->block_slots];
+    trend_cursor_t*            cursor = &store->cursor;
+    if (cursor->block != low || cursor->second > second) {
+        cursor->block  = low;
+        cursor->second = index->first;
+        cursor->nibble = 0;
+        cursor->value  = index->value;
+    }
+    while (cursor->second < second && cursor->nibble < index->length) {
+        uint8_t code = trend_get_nibble(block, cursor->nibble++);
+        if (code <= TREND_CODE_STEPS_MAX) {
+            cursor->value += trend_steps(store, trend_unzigzag(code));
+        } else if (code == TREND_CODE_STEPS_ONE) {
+            uint8_t steps = trend_get_nibble(block, cursor->nibble++);
+            cursor->value += trend_steps(store, (steps >> 1) + TREND_STEPS_ONE_MIN) + ((steps & 1) ? 1 : -1);
+        } else if (code == TREND_CODE_DELTA8) {
+            uint32_t zigzag = trend_get_nibble(block, cursor->nibble) << 4 | trend_get_nibble(block, cursor->nibble + 1);
+            cursor->value += trend_unzigzag(zigzag);
+            cursor->nibble += 2;
+        } else {
+            uint16_t raw = 0;
+            for (int i = 0; i < 4; i++) {
+                raw = (raw << 4) | trend_get_nibble(block, cursor->nibble++);
+            }
+            cursor->value = (int16_t)raw;
+        }
+        cursor->second++;
+    }
+    return cursor->value;
+}
+
+static void trend_merge(trend_bucket_t* result, const trend_bucket_t* first, const trend_bucket_t* second)
+{
+    uint32_t weight = first->weight + second->weight;
+    if (weight == 0) {
+        *result = (trend_bucket_t) { TREND_UNSET_VALUE, TREND_UNSET_VALUE, TREND_UNSET_VALUE, 0 };
+        return;
+    }
+    result->mean   = ((int32_t)first->mean * first->weight + (int32_t)second->mean * second->weight) / (int32_t)weight;
+    result->min    = (second->weight == 0 || (first->weight != 0 && first->min < second->min)) ? first->min : second->min;
+    result->max    = (second->weight == 0 || (first->weight != 0 && first->max > second->max)) ? first->max : second->max;
+    result->weight = weight / 2;
+}
+
+static inline trend_bucket_t* trend_bucket(trend_store_t* store, uint8_t tier, uint32_t index)
+{
+    return &store->buckets[(tier - 1) * store->tier_size + index % store->tier_size];
+}
+
+// Feed a completed bucket of the previous tier, every second one completes a bucket of this tier
+static void trend_accumulate(trend_store_t* store, uint8_t tier, const trend_bucket_t* bucket)
+{
+    if (tier >= store->tiers) {
+        return;
+    }
+    if (!store->pending_set[tier - 1]) {
+        store->pending[tier - 1]     = *bucket;
+        store->pending_set[tier - 1] = true;
+        return;
+    }
+    store->pending_set[tier - 1] = false;
+    trend_bucket_t* aggregated   = trend_bucket(store, tier, store->counts[tier]);
+    trend_merge(aggregated, &store->pending[tier - 1], bucket);
+    store->counts[tier]++;
+    if (store == &trend_ppb && tier == TREND_LOG_TIER) {
+        trend_log_append(aggregated);
+    }
+    trend_accumulate(store, tier + 1, aggregated);
+}
+
+void trend_add(trend_channel channel, int32_t value)
+{
+    trend_store_t* store = trend_store(channel);
+    if (store == NULL) {
+        return;
+    }
+    if (value != TREND_UNSET_VALUE) {
+        if (value > TREND_MAX_VALUE) {
+            value = TREND_MAX_VALUE;
+        } else if (value < -TREND_MAX_VALUE) {
+            value = -TREND_MAX_VALUE;
+        }
+    }
+    trend_encode(store, value);
+    store->counts[0]++;
+    trend_bucket_t bucket = { value, value, value, (value == TREND_UNSET_VALUE) ? 0 : TREND_FULL_WEIGHT };
+    trend_accumulate(store, 1, &bucket);
+}
+
+void trend_restore_start(uint8_t tier)
+{
+    // Buckets of the tier are still completed from the lower tiers, the upper tiers are rebuilt from its buckets
+    memset(&trend_ppb.pending_set[tier], 0, trend_ppb.tiers - 1 - tier);
+    memset(&trend_ppb.counts[tier], 0, (trend_ppb.tiers - tier) * sizeof(uint32_t));
+    // The restored history runs up to now, the seconds recorded since boot are already counted
+    trend_ppb.restored = 0 - trend_ppb.counts[0];
+    if (trend_view.store == &trend_ppb) {
+        trend_view.store = NULL;
+    }
+}
+
+void trend_restore(uint8_t tier, const trend_bucket_t* bucket)
+{
+    *trend_bucket(&trend_ppb, tier, trend_ppb.counts[tier]) = *bucket;
+    trend_ppb.counts[tier]++;
+    trend_ppb.restored += 1UL << tier;
+    trend_accumulate(&trend_ppb, tier + 1, bucket);
+}
+
+void trend_restore_gap(uint8_t tier, uint32_t count)
+{
+    const trend_bucket_t unset = { TREND_UNSET_VALUE, TREND_UNSET_VALUE, TREND_UNSET_VALUE, 0 };
+    bool                 top   = tier == trend_ppb.tiers - 1;
+    if (!top && trend_ppb.pending_set[tier] && count > 0) {
+        // Complete the half filled bucket of the next tier first
+        trend_restore(tier, &unset);
+        count--;
+    }
+    if (count > trend_ppb.tier_size + 1) {
+        // The oldest buckets of the gap would be overwritten in this tier by the end of it, they only count as pairs in the next tier
+        uint32_t skipped = (count - trend_ppb.tier_size) & ~1UL;
+        trend_ppb.counts[tier] += skipped;
+        count -= skipped;
+        if (top) {
+            trend_ppb.restored += skipped << tier;
+        } else {
+            trend_restore_gap(tier + 1, skipped / 2);
+        }
+    }
+    while (count--) {
+        trend_restore(tier, &unset);
+    }
+}
+
+uint32_t trend_duration(trend_channel channel)
+{
+    const trend_store_t* store = trend_store(channel);
+    return (store == NULL) ? 0 : store->counts[0] + store->restored;
+}
+
+uint32_t trend_max_h_scale(trend_channel channel) { return 1UL << (((channel == TREND_CHANNEL_PPB) ? TREND_TIERS : TREND_AUX_TIERS) - 1); }
+
+// Tier of a (power of two) scale
+static uint8_t trend_select_tier(const trend_store_t* store, uint32_t h_scale)
+{
+    uint8_t tier = 0;
+    while (tier < store->tiers - 1 && (2UL << tier) <= h_scale) {
+        tier++;
+    }
+    return tier;
+}
+
+uint32_t trend_max_shift(trend_channel channel, uint32_t h_scale)
+{
+    const trend_store_t* store = trend_store(channel);
+    if (store == NULL) {
+        return 0;
+    }
+    uint8_t  tier = trend_select_tier(store, h_scale);
+    uint32_t size = (tier == 0) ? trend_seconds_available(store) : store->tier_size;
+    return (size > TREND_SCREEN_SIZE) ? (size - TREND_SCREEN_SIZE) << tier : 0;
+}
+
+// Point of a tier, unset if some of its values are unset
+static void trend_read_point(trend_store_t* store, uint8_t tier, uint32_t index, trend_screen_point_t* point)
+{
+    if (tier == 0) {
+        int16_t value = trend_decode(store, index);
+        *point        = (trend_screen_point_t) { value, value, value };
+        return;
+    }
+    const trend_bucket_t* bucket = trend_bucket(store, tier, index);
+    if (bucket->weight == TREND_FULL_WEIGHT) {
+        *point = (trend_screen_point_t) { bucket->mean, bucket->min, bucket->max };
+    } else {
+        *point = (trend_screen_point_t) { TREND_UNSET_VALUE, TREND_UNSET_VALUE, TREND_UNSET_VALUE };
+    }
+}
+
+const trend_screen_t* trend_get_screen(trend_channel channel, uint32_t shift, uint32_t h_scale)
+{
+    trend_store_t* store = trend_store(channel);
+    if (store == NULL) {
+        return NULL;
+    }
+    trend_view_t* view = &trend_view;
+    uint8_t       tier;
+    uint32_t      moved;
+    if (view->store == store && view->shift == shift && view->h_scale == h_scale) {
+        // Same view, the points completed since the last call push the oldest ones out
+        tier  = view->tier;
+        moved = store->counts[tier] - view->count;
+        if (moved == 0) {
+            return &view->screen;
+        }
+    } else {
+        tier  = trend_select_tier(store, h_scale);
+        moved = TREND_SCREEN_SIZE;
+    }
+    trend_screen_t*       screen = &view->screen;
+    trend_screen_point_t* points = screen->points;
+    uint32_t              count  = store->counts[tier];
+    uint32_t              held   = (tier == 0) ? trend_seconds_available(store) : store->tier_size;
+    uint32_t              skip   = shift >> tier;
+    uint32_t              limit  = (held < count) ? held : count;
+    uint32_t              kept   = (moved < TREND_SCREEN_SIZE) ? TREND_SCREEN_SIZE - moved : 0;
+    // Points before 'first' are not recorded yet or overwritten
+    uint32_t first = (skip + TREND_SCREEN_SIZE > limit) ? skip + TREND_SCREEN_SIZE - limit : 0;
+    if (first > TREND_SCREEN_SIZE) {
+        first = TREND_SCREEN_SIZE;
+    }
+    // The envelope needs a full pass only when a point that leaves the screen was on it
+    bool rescan = (kept == 0);
+    for (uint32_t position = 0; position < moved + first && position < TREND_SCREEN_SIZE && !rescan; position++) {
+        const trend_screen_point_t* point = &points[position];
+        rescan = point->mean != TREND_UNSET_VALUE && (point->min == screen->min || point->max == screen->max);
+    }
+    memmove(points, points + TREND_SCREEN_SIZE - kept, kept * sizeof(points[0]));
+    for (uint32_t position = 0; position < first; position++) {
+        points[position] = (trend_screen_point_t) { TREND_UNSET_VALUE, TREND_UNSET_VALUE, TREND_UNSET_VALUE };
+    }
+    uint32_t read = (kept > first) ? kept : first;
+    for (uint32_t position = read; position < TREND_SCREEN_SIZE; position++) {
+        trend_read_point(store, tier, count - (skip + TREND_SCREEN_SIZE - position), &points[position]);
+    }
+    if (rescan) {
+        screen->set = false;
+        read        = first;
+    }
+    for (uint32_t position = read; position < TREND_SCREEN_SIZE; position++) {
+        const trend_screen_point_t* point = &points[position];
+        if (point->mean != TREND_UNSET_VALUE) {
+            if (!screen->set || point->min < screen->min) {
+                screen->min = point->min;
+            }
+            if (!screen->set || point->max > screen->max) {
+                screen->max = point->max;
+            }
+            screen->set = true;
+        }
+    }
+    view->store   = store;
+    view->shift   = shift;
+    view->h_scale = h_scale;
+    view->tier    = tier;
+    view->count   = count;
+    return screen;
+}
+
+bool trend_get_point(trend_channel channel, uint32_t position, uint32_t shift, uint32_t h_scale, trend_point_t* point)
+{
+    const trend_screen_t* screen = trend_get_screen(channel, shift, h_scale);
+    if (screen == NULL || position >= TREND_SCREEN_SIZE) {
+        return false;
+    }
+    const trend_screen_point_t* screen_point = &screen->points[position];
+    point->mean                              = screen_point->mean;
+    point->min                               = screen_point->min;
+    point->max                               = screen_point->max;
+    return screen_point->mean != TREND_UNSET_VALUE;
+}
@@ -0,0 +1,86 @@
+#ifndef _TREND_H_
+#define _TREND_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Trend history, kept as round robin tiers of pre-aggregated buckets (RRD style): one value per second in the first tier,
+// then one tier per power of two scale (2 s, 4 s, ... 131072 s per bucket), so that any zoom level reads one bucket per screen point.
+// The seconds tier is delta encoded in fixed size blocks: the PPB value moves by whole 70 MHz tick steps, so a second mostly takes one nibble.
+// The PPB channel has its own store, the other channels share a smaller one that only records the selected channel
+
+// Plotted series, one value per second
+typedef enum { TREND_CHANNEL_PPB, TREND_CHANNEL_PWM, TREND_CHANNEL_PHASE, TREND_CHANNEL_SATS, TREND_CHANNEL_HDOP, TREND_CHANNEL_MAX } trend_channel;
+
+#define TREND_SCREEN_SIZE   40
+// Values are signed 16 bit: PPB * 100 (clamped to +/- 327 ppb), PWM - 32768, PPS phase error in 70 MHz ticks, satellites, HDOP * 10
+#define TREND_UNSET_VALUE   INT16_MIN
+#define TREND_MAX_VALUE     INT16_MAX
+#define TREND_PWM_OFFSET    32768
+#define TREND_TIERS         18
+// Seconds tier blocks (from 7 minutes of very noisy values to 35 minutes of stable ones), size of the aggregated tiers (73 days in the last one)
+// RAM: 6.5 KB of PPB buckets, 1.3 KB of PPB blocks and index, 2.6 KB for the other channels, 0.3 KB for the screen read (11 KB in all)
+#define TREND_BLOCKS        32
+#define TREND_BLOCK_SIZE    32
+#define TREND_TIER_SIZE     48
+#define TREND_MAX_H_SCALE   (1UL << (TREND_TIERS - 1))
+// Store of the other channels: up to 128 s per point, one screen per aggregated tier
+#define TREND_AUX_TIERS     8
+#define TREND_AUX_BLOCKS    8
+#define TREND_AUX_TIER_SIZE TREND_SCREEN_SIZE
+// Weight of a bucket where all seconds have a value
+#define TREND_FULL_WEIGHT   0x8000
+
+// Running aggregate of a power of two number of seconds: the sum is kept as mean * weight, weight being the share of seconds with a value
+typedef struct {
+    int16_t  mean;
+    int16_t  min;
+    int16_t  max;
+    uint16_t weight;
+} trend_bucket_t;
+
+// Mean value and envelope of the seconds behind a screen point
+typedef struct {
+    int32_t mean;
+    int32_t min;
+    int32_t max;
+} trend_point_t;
+
+// Same for a point of a whole screen read at once, the mean is TREND_UNSET_VALUE when some values are unset
+typedef struct {
+    int16_t mean;
+    int16_t min;
+    int16_t max;
+} trend_screen_point_t;
+
+// Points of a screen (0 is the oldest) and the envelope of those that are set
+typedef struct {
+    trend_screen_point_t points[TREND_SCREEN_SIZE];
+    bool                 set;   // false if no point is set
+    int32_t              min;
+    int32_t              max;
+} trend_screen_t;
+
+void     trend_init();
+// Channel recorded by the shared store, its history is cleared when it changes
+void     trend_select_aux(trend_channel channel);
+// Value of the last second, ignored for a channel that isn't recorded
+void     trend_add(trend_channel channel, int32_t value);
+// Clear the PPB tiers above a tier and that tier's buckets, before the buckets saved before the last reboot are pushed into it
+void     trend_restore_start(uint8_t tier);
+// Push a PPB bucket saved before the last reboot into a tier (history in the lower tiers is not restored)
+void     trend_restore(uint8_t tier, const trend_bucket_t* bucket);
+// Push 'count' unset buckets into a tier, long gaps go straight to the upper tiers
+void     trend_restore_gap(uint8_t tier, uint32_t count);
+// Number of seconds recorded since boot (or since the channel was selected), plus those restored from the trend log
+uint32_t trend_duration(trend_channel channel);
+uint32_t trend_max_h_scale(trend_channel channel);
+// Largest shift (in seconds) that still fills the screen at the given scale
+uint32_t trend_max_shift(trend_channel channel, uint32_t h_scale);
+// Screen 'shift' seconds back in time with 'h_scale' seconds per point, NULL if the channel isn't recorded.
+// The screen is kept until the next call: for the same view only the points completed since the last call are read
+const trend_screen_t* trend_get_screen(trend_channel channel, uint32_t shift, uint32_t h_scale);
+// One point of that screen, false if some values are unset
+bool     trend_get_point(trend_channel channel, uint32_t position, uint32_t shift, uint32_t h_scale, trend_point_t* point);
+
+#endif
@@ -0,0 +1,210 @@
+#include "trend_log.h"
+#include "int.h"
+#include "main.h"
+#include "utc.h"
+#include <stddef.h>
+
+#define TREND_LOG_MAGIC         0x5452
+#define TREND_LOG_UNSET         0xFFFFFFFF
+// Flash is only written within that delay after a PPS edge, so that the CPU stall (up to 40 ms for a page erase) ends well before the next capture
+#define TREND_LOG_PPS_WINDOW    50
+
+typedef struct {
+    uint16_t magic;
+    uint16_t sequence;
+} trend_log_header_t;
+
+// A record is programmed half-word by half-word, the index first: an interrupted write leaves a bad CRC
+typedef struct {
+    uint32_t index;     // UTC time / 64 s
+    int16_t  mean;
+    int16_t  min;
+    int16_t  max;
+    uint16_t crc;
+} trend_log_record_t;
+
+#define TREND_LOG_RECORDS       ((TREND_LOG_PAGE_SIZE - sizeof(trend_log_header_t)) / sizeof(trend_log_record_t))
+
+trend_log_stats_t trend_log_stats = { 0 };
+
+// Page being filled, and next free record in that page (a full page makes the next append erase the following one)
+static uint8_t            trend_log_page     = TREND_LOG_PAGES - 1;
+static uint32_t           trend_log_position = TREND_LOG_RECORDS;
+static uint16_t           trend_log_sequence = 0;
+static uint32_t           trend_log_index    = TREND_LOG_UNSET;
+static trend_log_record_t trend_log_pending;
+static bool               trend_log_pending_set = false;
+// The log is restored once UTC time is known, so that the gap up to now can be placed
+static bool               trend_log_restored    = false;
+// PPS edge of the last flash operation, there is at most one per second
+static uint32_t           trend_log_pps         = 0;
+
+static inline uint32_t trend_log_page_address(uint8_t page) { return TREND_LOG_ADDRESS + page * TREND_LOG_PAGE_SIZE; }
+
+static inline const trend_log_record_t* trend_log_record(uint8_t page, uint32_t position)
+{
+    return (const trend_log_record_t*)(trend_log_page_address(page) + sizeof(trend_log_header_t)) + position;
+}
+
+// CRC-16/CCITT
+static uint16_t trend_log_crc(const uint8_t* data, size_t len)
+{
+    uint16_t crc = 0xFFFF;
+    while (len--) {
+        crc ^= (uint16_t)*data++ << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static void trend_log_restore(const trend_log_record_t* record)
+{
+    if (trend_log_index == TREND_LOG_UNSET) {
+        trend_restore_start(TREND_LOG_TIER);
+    } else if (record->index > trend_log_index + 1) {
+        // Missing buckets (no fix, warmup, power off) are restored unset
+        trend_restore_gap(TREND_LOG_TIER, record->index - trend_log_index - 1);
+    }
+    trend_bucket_t bucket = { record->mean, record->min, record->max, TREND_FULL_WEIGHT };
+    trend_restore(TREND_LOG_TIER, &bucket);
+    trend_log_index = record->index;
+    trend_log_stats.restored++;
+}
+
+void trend_log_init()
+{
+    // Newest page is the one with the highest sequence number, pages are filled in turn
+    bool found = false;
+    for (uint8_t page = 0; page < TREND_LOG_PAGES; page++) {
+        const trend_log_header_t* header = (const trend_log_header_t*)trend_log_page_address(page);
+        if (header->magic == TREND_LOG_MAGIC && (!found || (int16_t)(header->sequence - trend_log_sequence) > 0)) {
+            trend_log_page     = page;
+            trend_log_sequence = header->sequence;
+            found              = true;
+        }
+    }
+    if (!found) {
+        return;
+    }
+    // Next free record of the newest page
+    for (trend_log_position = 0; trend_log_position < TREND_LOG_RECORDS; trend_log_position++) {
+        if (trend_log_record(trend_log_page, trend_log_position)->index == TREND_LOG_UNSET) {
+            break;
+        }
+    }
+}
+
+// Rebuild the trend tiers from the log, then the buckets missed since the last one up to now (power off and the time to get a fix),
+// the buckets completed since boot in these tiers are replaced: without UTC time there was no PPB value either
+static void trend_log_restore_all()
+{
+    trend_log_restored = true;
+    for (uint8_t i = 1; i <= TREND_LOG_PAGES; i++) {
+        uint8_t                   page   = (trend_log_page + i) % TREND_LOG_PAGES;
+        const trend_log_header_t* header = (const trend_log_header_t*)trend_log_page_address(page);
+        if (header->magic != TREND_LOG_MAGIC) {
+            continue;
+        }
+        for (uint32_t position = 0; position < TREND_LOG_RECORDS; position++) {
+            const trend_log_record_t* record = trend_log_record(page, position);
+            if (record->index == TREND_LOG_UNSET) {
+                break;
+            }
+            if (trend_log_crc((const uint8_t*)record, offsetof(trend_log_record_t, crc)) != record->crc) {
+                trend_log_stats.crc_errors++;
+                continue;
+            }
+            trend_log_restore(record);
+        }
+    }
+    uint32_t index = now().seconds / (1UL << TREND_LOG_TIER);
+    if (trend_log_index != TREND_LOG_UNSET && index > trend_log_index + 1) {
+        trend_restore_gap(TREND_LOG_TIER, index - trend_log_index - 1);
+    }
+}
+
+void trend_log_append(const trend_bucket_t* bucket)
+{
+    // Only log complete buckets that can be placed in time, others are restored as gaps (as those completed before the log is restored)
+    if (bucket->weight != TREND_FULL_WEIGHT || !trend_log_restored) {
+        return;
+    }
+    uint32_t index = now().seconds / (1UL << TREND_LOG_TIER);
+    if (trend_log_index != TREND_LOG_UNSET && index <= trend_log_index && trend_log_index - index < TREND_TIER_SIZE) {
+        // Buckets are not aligned on UTC time, keep indexes increasing
+        index = trend_log_index + 1;
+    }
+    trend_log_index       = index;
+    trend_log_pending     = (trend_log_record_t) { index, bucket->mean, bucket->min, bucket->max, 0 };
+    trend_log_pending.crc = trend_log_crc((const uint8_t*)&trend_log_pending, offsetof(trend_log_record_t, crc));
+    trend_log_pending_set = true;
+}
+
+static bool trend_log_program(uint32_t address, const uint16_t* data, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, address + i * 2, data[i]) != HAL_OK) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Erase the next page and write its header
+static bool trend_log_next_page()
+{
+    uint8_t                page  = (trend_log_page + 1) % TREND_LOG_PAGES;
+    FLASH_EraseInitTypeDef erase = { .TypeErase = FLASH_TYPEERASE_PAGES, .PageAddress = trend_log_page_address(page), .NbPages = 1 };
+    uint32_t               page_error;
+    // Timer overflow interrupts are lost during the erase, the next PPS period can't be measured
+    restart_pps_measurement();
+    if (HAL_FLASHEx_Erase(&erase, &page_error) != HAL_OK) {
+        return false;
+    }
+    trend_log_stats.erases++;
+    trend_log_header_t header = { TREND_LOG_MAGIC, trend_log_sequence + 1 };
+    if (!trend_log_program(trend_log_page_address(page), (const uint16_t*)&header, sizeof(header) / 2)) {
+        return false;
+    }
+    trend_log_page     = page;
+    trend_log_sequence = header.sequence;
+    trend_log_position = 0;
+    return true;
+}
+
+void trend_log_run()
+{
+    if (!trend_log_restored) {
+        if (utc_valid) {
+            trend_log_restore_all();
+        }
+        return;
+    }
+    uint32_t pps = last_pps;
+    if (!trend_log_pending_set || pps == trend_log_pps || HAL_GetTick() - pps > TREND_LOG_PPS_WINDOW) {
+        return;
+    }
+    trend_log_pps = pps;
+    HAL_FLASH_Unlock();
+    if (trend_log_position >= TREND_LOG_RECORDS) {
+        // The record is written after the next PPS edge, to keep each stall short
+        if (!trend_log_next_page()) {
+            // Don't stall every second on a failing page, try again with the next bucket
+            trend_log_stats.write_errors++;
+            trend_log_pending_set = false;
+        }
+    } else {
+        if (trend_log_program((uint32_t)trend_log_record(trend_log_page, trend_log_position), (const uint16_t*)&trend_log_pending,
+                sizeof(trend_log_record_t) / 2)) {
+            trend_log_stats.records++;
+        } else {
+            trend_log_stats.write_errors++;
+        }
+        // A failed record is skipped, its CRC won't match
+        trend_log_position++;
+        trend_log_pending_set = false;
+    }
+    HAL_FLASH_Lock();
+}
@@ -0,0 +1,35 @@
+#ifndef _TREND_LOG_H_
+#define _TREND_LOG_H_
+
+#include "trend.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Trend history kept in flash across reboots: the 64 s buckets are appended to a ring of flash pages just below the ee page,
+// pages are erased in turn (each one every 6 hours or so) and each record is CRC checked
+
+// Tier of the logged buckets (64 s)
+#define TREND_LOG_TIER      6
+#define TREND_LOG_PAGES     4
+#define TREND_LOG_PAGE_SIZE 1024
+// Last flash page is used by ee, the linker script keeps the code below the log pages
+#define TREND_LOG_ADDRESS   (0x08000000UL + 64 * 1024 - (TREND_LOG_PAGES + 1) * TREND_LOG_PAGE_SIZE)
+
+typedef struct {
+    uint32_t records;
+    uint32_t restored;
+    uint32_t crc_errors;
+    uint32_t erases;
+    uint32_t write_errors;
+} trend_log_stats_t;
+
+extern trend_log_stats_t trend_log_stats;
+
+// Find the end of the log, must be called after trend_init()
+void trend_log_init();
+// Queue a completed bucket, it is written by trend_log_run() right after the next PPS edge
+void trend_log_append(const trend_bucket_t* bucket);
+// Rebuild the trend tiers from the log once UTC time is valid, then write the queued buckets
+void trend_log_run();
+
+#endif
@@ -0,0 +1,190 @@
+#include "ubx.h"
+#include "bridge.h"
+#include "casic.h"
+#include "gps.h"
+#include <string.h>
+
+#define UBX_SYNC_1          0xB5
+#define UBX_SYNC_2          0x62
+// Largest payload we send or parse (ACK 2, TIM-TP 16, CFG-VALSET 46)
+#define UBX_MAX_PAYLOAD     64
+// Anything bigger is taken as a false sync: a wrong baudrate must not make the framer swallow the bytes that follow
+#define UBX_MAX_LENGTH      UBX_MAX_PAYLOAD
+
+typedef enum { UBX_STATE_SYNC_1, UBX_STATE_SYNC_2, UBX_STATE_CLASS, UBX_STATE_ID, UBX_STATE_LENGTH_1, UBX_STATE_LENGTH_2, UBX_STATE_PAYLOAD, UBX_STATE_CK_A, UBX_STATE_CK_B } ubx_state;
+
+ubx_stats_t ubx_stats     = { 0 };
+int32_t     ubx_last_qerr = 0;
+
+static ubx_state ubx_rx_state = UBX_STATE_SYNC_1;
+static uint8_t   ubx_rx_class;
+static uint8_t   ubx_rx_id;
+static uint16_t  ubx_rx_length;
+static uint16_t  ubx_rx_count;
+static uint8_t   ubx_rx_ck_a;
+static uint8_t   ubx_rx_ck_b;
+static uint8_t   ubx_rx_payload[UBX_MAX_PAYLOAD];
+
+static inline uint32_t ubx_u32(const uint8_t* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+static inline void     ubx_put_u16(uint8_t* p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static inline void     ubx_put_u32(uint8_t* p, uint32_t v) { p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24; }
+
+// 8-bit Fletcher checksum over class, id, length and payload
+static inline void ubx_checksum_add(uint8_t c)
+{
+    ubx_rx_ck_a += c;
+    ubx_rx_ck_b += ubx_rx_ck_a;
+}
+
+static void ubx_handle_frame()
+{
+    switch (ubx_rx_class) {
+        case UBX_CLASS_ACK:
+            if (ubx_rx_id == UBX_ACK_ACK) {
+                ubx_stats.acks++;
+            } else if (ubx_rx_id == UBX_ACK_NAK) {
+                ubx_stats.naks++;
+            }
+            // Payload is the class and id of the acknowledged message
+            if (ubx_rx_length >= 2) {
+                gps_command_acknowledged(ubx_rx_payload[0], ubx_rx_payload[1], ubx_rx_id == UBX_ACK_ACK);
+            }
+            break;
+        case UBX_CLASS_TIM:
+            if (ubx_rx_id == UBX_TIM_TP && ubx_rx_length >= 16) {
+                // TIM-TP describes the next time pulse: towMS U4, towSubMS U4, qErr I4 (ps), week U2, flags X1, refInfo X1
+                // flags bit 4 is qErrInvalid on receivers that report it
+                if (!(ubx_rx_payload[14] & 0x10)) {
+                    ubx_last_qerr      = (int32_t)ubx_u32(ubx_rx_payload + 8);
+                    gps_pps_qerr       = ubx_last_qerr;
+                    gps_pps_qerr_valid = true;
+                }
+            }
+            break;
+    }
+}
+
+bool ubx_ingest(uint8_t c)
+{
+    switch (ubx_rx_state) {
+        case UBX_STATE_SYNC_1:
+            // A sync byte inside a CASIC frame is CASIC data
+            if (c != UBX_SYNC_1 || !casic_idle()) {
+                return false;
+            }
+            ubx_rx_state = UBX_STATE_SYNC_2;
+            return true;
+        case UBX_STATE_SYNC_2:
+            if (c != UBX_SYNC_2) {
+                // Not a UBX frame, let NMEA have this byte
+                ubx_rx_state = UBX_STATE_SYNC_1;
+                return false;
+            }
+            ubx_rx_ck_a  = 0;
+            ubx_rx_ck_b  = 0;
+            ubx_rx_state = UBX_STATE_CLASS;
+            return true;
+        case UBX_STATE_CLASS:
+            ubx_rx_class = c;
+            ubx_rx_state = UBX_STATE_ID;
+            break;
+        case UBX_STATE_ID:
+            ubx_rx_id    = c;
+            ubx_rx_state = UBX_STATE_LENGTH_1;
+            break;
+        case UBX_STATE_LENGTH_1:
+            ubx_rx_length = c;
+            ubx_rx_state  = UBX_STATE_LENGTH_2;
+            break;
+        case UBX_STATE_LENGTH_2:
+            ubx_rx_length |= c << 8;
+            ubx_rx_count = 0;
+            if (ubx_rx_length > UBX_MAX_LENGTH) {
+                ubx_stats.overlong++;
+                ubx_rx_state = UBX_STATE_SYNC_1;
+                return true;
+            }
+            ubx_rx_state = ubx_rx_length ? UBX_STATE_PAYLOAD : UBX_STATE_CK_A;
+            break;
+        case UBX_STATE_PAYLOAD:
+            ubx_rx_payload[ubx_rx_count] = c;
+            if (++ubx_rx_count == ubx_rx_length) {
+                ubx_rx_state = UBX_STATE_CK_A;
+            }
+            break;
+        case UBX_STATE_CK_A:
+            ubx_rx_state = (c == ubx_rx_ck_a) ? UBX_STATE_CK_B : UBX_STATE_SYNC_1;
+            if (ubx_rx_state == UBX_STATE_SYNC_1) {
+                ubx_stats.bad_checksum++;
+            }
+            return true;
+        case UBX_STATE_CK_B:
+            ubx_rx_state = UBX_STATE_SYNC_1;
+            if (c != ubx_rx_ck_b) {
+                ubx_stats.bad_checksum++;
+            } else {
+                ubx_stats.good++;
+                ubx_handle_frame();
+            }
+            return true;
+    }
+    ubx_checksum_add(c);
+    return true;
+}
+
+void ubx_reset() { ubx_rx_state = UBX_STATE_SYNC_1; }
+
+bool ubx_idle() { return ubx_rx_state == UBX_STATE_SYNC_1; }
+
+bool ubx_send(uint8_t msg_class, uint8_t msg_id, const uint8_t* payload, uint16_t len)
+{
+    uint8_t frame[UBX_MAX_PAYLOAD + 8];
+    if (len > UBX_MAX_PAYLOAD) {
+        return false;
+    }
+    frame[0] = UBX_SYNC_1;
+    frame[1] = UBX_SYNC_2;
+    frame[2] = msg_class;
+    frame[3] = msg_id;
+    ubx_put_u16(frame + 4, len);
+    memcpy(frame + 6, payload, len);
+    uint8_t ck_a = 0, ck_b = 0;
+    for (uint16_t i = 2; i < len + 6; i++) {
+        ck_a += frame[i];
+        ck_b += ck_a;
+    }
+    frame[len + 6] = ck_a;
+    frame[len + 7] = ck_b;
+    return bridge_send_to_gps(frame, len + 8);
+}
+
+// CFG-PRT for UART1: 8N1, UBX + NMEA in and out
+void ubx_set_baudrate(uint32_t baudrate)
+{
+    uint8_t payload[20] = { 0 };
+    payload[0] = 1; // UART1
+    ubx_put_u32(payload + 4, 0x000008D0);
+    ubx_put_u32(payload + 8, baudrate);
+    ubx_put_u16(payload + 12, 0x0003);
+    ubx_put_u16(payload + 14, 0x0003);
+    ubx_send(UBX_CLASS_CFG, UBX_CFG_PRT, payload, sizeof(payload));
+}
+
+// CFG-VALSET of a single U4 key in RAM layer
+void ubx_valset_u32(uint32_t key, uint32_t value)
+{
+    uint8_t payload[12] = { 0 };
+    payload[1] = 0x01; // RAM
+    ubx_put_u32(payload + 4, key);
+    ubx_put_u32(payload + 8, value);
+    ubx_send(UBX_CLASS_CFG, UBX_CFG_VALSET, payload, sizeof(payload));
+}
+
+// CFG-CFG: save current configuration to all non volatile memories
+void ubx_save_config()
+{
+    uint8_t payload[13] = { 0 };
+    ubx_put_u32(payload + 4, 0x0000061F);
+    payload[12] = 0x17;
+    ubx_send(UBX_CLASS_CFG, UBX_CFG_CFG, payload, sizeof(payload));
+}
@@ -0,0 +1,59 @@
+#ifndef _UBX_H_
+#define _UBX_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// u-blox UBX binary protocol, parsed from the same byte stream as NMEA
+
+#define UBX_CLASS_ACK   0x05
+#define UBX_CLASS_CFG   0x06
+#define UBX_CLASS_TIM   0x0D
+
+#define UBX_ACK_NAK     0x00
+#define UBX_ACK_ACK     0x01
+#define UBX_CFG_PRT     0x00
+#define UBX_CFG_MSG     0x01
+#define UBX_CFG_CFG     0x09
+#define UBX_CFG_TP5     0x31
+#define UBX_CFG_VALSET  0x8A
+#define UBX_TIM_TP      0x01
+
+// Configuration keys for generation 9 receivers (CFG-VALSET)
+#define UBX_KEY_UART1_BAUDRATE          0x40520001
+#define UBX_KEY_MSGOUT_GGA_UART1        0x209100BB
+#define UBX_KEY_MSGOUT_GLL_UART1        0x209100CA
+#define UBX_KEY_MSGOUT_GSA_UART1        0x209100C0
+#define UBX_KEY_MSGOUT_GSV_UART1        0x209100C5
+#define UBX_KEY_MSGOUT_RMC_UART1        0x209100AC
+#define UBX_KEY_MSGOUT_VTG_UART1        0x209100B1
+#define UBX_KEY_MSGOUT_TIM_TP_UART1     0x2091017E
+
+typedef struct {
+    uint32_t good;
+    uint32_t bad_checksum;
+    uint32_t overlong;
+    uint32_t acks;
+    uint32_t naks;
+} ubx_stats_t;
+
+extern ubx_stats_t ubx_stats;
+// Last quantization error reported by TIM-TP, in ps
+extern int32_t     ubx_last_qerr;
+
+// Feed one received byte, returns true when the byte belongs to a UBX frame and must not be given to the NMEA framer.
+// A frame only starts while the CASIC framer is idle, the framer in the middle of a frame gets all its bytes
+bool ubx_ingest(uint8_t c);
+// Drop a partly received frame (UART restart or baudrate change)
+void ubx_reset();
+// True when no frame is being received
+bool ubx_idle();
+
+// Returns false when the frame could not be queued
+bool ubx_send(uint8_t msg_class, uint8_t msg_id, const uint8_t* payload, uint16_t len);
+void ubx_set_baudrate(uint32_t baudrate);
+void ubx_valset_u32(uint32_t key, uint32_t value);
+void ubx_save_config();
+
+#endif
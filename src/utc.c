@@ -0,0 +1,76 @@
+#include "utc.h"
+#include "int.h"
+#include "main.h"
+
+// TIM1 is clocked by the 70 MHz OCXO derived system clock
+#define UTC_TICKS_PER_SECOND    70000000
+
+volatile bool     utc_valid       = false;
+uint32_t          utc_corrections = 0;
+// UTC second of the last PPS edge and TIM1 value captured on that edge
+static volatile uint32_t utc_pps_seconds = 0;
+static volatile uint32_t utc_pps_capture = 0;
+
+// Days since 1970-01-01 for a proleptic gregorian date, in constant time (H. Hinnant's days_from_civil)
+int32_t utc_days_from_civil(int32_t year, uint32_t month, uint32_t day)
+{
+    year -= (month <= 2);
+    int32_t  era = (year >= 0 ? year : year - 399) / 400;
+    uint32_t yoe = (uint32_t)(year - era * 400);                                  // [0, 399]
+    uint32_t doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1; // [0, 365]
+    uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;                         // [0, 146096]
+    return era * 146097 + (int32_t)doe - 719468;
+}
+
+void utc_set(int32_t year, uint32_t month, uint32_t day, uint32_t hour, uint32_t minute, uint32_t second)
+{
+    if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60) {
+        return;
+    }
+    uint32_t seconds = (uint32_t)utc_days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+    __disable_irq();
+    if (utc_valid && utc_pps_seconds != seconds) {
+        // Missed or spurious PPS edge, or leap second
+        utc_corrections++;
+    }
+    utc_pps_seconds = seconds;
+    utc_valid       = true;
+    __enable_irq();
+}
+
+// Ticks since the previous PPS edge, 64 bits so that long holdovers do not wrap
+static inline uint64_t utc_elapsed(uint32_t count, uint32_t capture, uint32_t overflows)
+{
+    return (uint64_t)overflows * 65536 + count - capture;
+}
+
+void utc_pps(uint32_t capture, uint32_t overflows)
+{
+    // Round to the nearest second so that missing PPS edges are accounted for
+    uint32_t seconds = (utc_elapsed(capture, utc_pps_capture, overflows) + UTC_TICKS_PER_SECOND / 2) / UTC_TICKS_PER_SECOND;
+    utc_pps_seconds += (seconds > 0) ? seconds : 1;
+    utc_pps_capture = capture;
+}
+
+utc_time_t now()
+{
+    __disable_irq();
+    uint32_t seconds   = utc_pps_seconds;
+    uint32_t capture   = utc_pps_capture;
+    uint32_t overflows = timer_overflows;
+    uint32_t count     = TIM1->CNT;
+    if ((TIM1->SR & TIM_SR_UIF) && count < 0x8000) {
+        // Counter has wrapped but the update interrupt has not been serviced yet
+        overflows++;
+    }
+    __enable_irq();
+
+    uint64_t   elapsed = utc_elapsed(count, capture, overflows);
+    utc_time_t time;
+    // Without PPS the OCXO keeps counting seconds
+    time.seconds   = seconds + (uint32_t)(elapsed / UTC_TICKS_PER_SECOND);
+    uint32_t ticks = (uint32_t)(elapsed % UTC_TICKS_PER_SECOND);
+    // 1e9 / 70e6 = 100 / 7, split to stay within 32 bits
+    time.nanos = (ticks / 7) * 100 + ((ticks % 7) * 100) / 7;
+    return time;
+}
@@ -0,0 +1,25 @@
+#ifndef _UTC_H_
+#define _UTC_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// UTC time base: set from RMC / ZDA sentences, advanced by each GPS PPS edge and interpolated with the TIM1 count (70 MHz OCXO clock)
+
+typedef struct {
+    uint32_t seconds;   // Seconds since 1970-01-01 00:00:00 UTC
+    uint32_t nanos;     // Fraction of second, in nanoseconds
+} utc_time_t;
+
+extern volatile bool utc_valid;
+// Number of times the PPS count disagreed with the time received from the GPS
+extern uint32_t      utc_corrections;
+
+int32_t    utc_days_from_civil(int32_t year, uint32_t month, uint32_t day);
+// Time of the last PPS edge, as reported by the GPS sentence following it
+void       utc_set(int32_t year, uint32_t month, uint32_t day, uint32_t hour, uint32_t minute, uint32_t second);
+// Called by the capture interrupt on each PPS edge, with the number of TIM1 overflows since the previous edge
+void       utc_pps(uint32_t capture, uint32_t overflows);
+utc_time_t now();
+
+#endif
@@ -0,0 +1,210 @@
+#include "format.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// Formatter outputs against snprintf for the same conversions, truncation included, then the cost of both on the display formats
+
+#define TEST_BUFFER_SIZE    32
+#define TEST_RANDOM_VALUES  2000
+#define BENCH_CALLS         200000
+
+static int test_failures = 0;
+static int test_checks   = 0;
+
+static const int32_t test_values[] = { 0, 1, -1, 9, -9, 10, -10, 99, -99, 100, -100, 12345, -12345, 999999, -1000000, 10000000, -9999999,
+    INT16_MAX, INT16_MIN, INT32_MAX, INT32_MIN, INT32_MIN + 1 };
+#define TEST_VALUE_COUNT    (sizeof(test_values) / sizeof(test_values[0]))
+
+// Formatter output and end pointer against the expected text for a buffer of 'size' bytes: the snprintf output,
+// and a NULL end exactly when snprintf had to truncate
+static void test_compare(const char* what, const char* out, const char* end, const char* expected, int length, size_t size)
+{
+    char    truncated[TEST_BUFFER_SIZE];
+    bool    fits = length >= 0 && (size_t)length < size;
+    snprintf(truncated, size, "%s", expected);
+    test_checks++;
+    if (strcmp(out, truncated) != 0 || (fits ? end != out + length : end != NULL)) {
+        printf("FAIL %s (size %u): \"%s\" instead of \"%s\"%s\n", what, (unsigned)size, out, truncated,
+            (fits == (end != NULL)) ? "" : (fits ? ", truncated" : ", not truncated"));
+        test_failures++;
+    }
+}
+
+static void test_int(int32_t value, uint8_t width, char pad, size_t size)
+{
+    char expected[TEST_BUFFER_SIZE];
+    char out[TEST_BUFFER_SIZE];
+    char what[48];
+    int  length = snprintf(expected, sizeof(expected), (pad == '0') ? "%0*" PRId32 : "%*" PRId32, width, value);
+    snprintf(what, sizeof(what), "int %" PRId32 " %u '%c'", value, width, pad);
+    test_compare(what, out, format_int(out, out + size, value, width, pad), expected, length, size);
+}
+
+static void test_uint(uint32_t value, uint8_t width, char pad, size_t size)
+{
+    char expected[TEST_BUFFER_SIZE];
+    char out[TEST_BUFFER_SIZE];
+    char what[48];
+    int  length = snprintf(expected, sizeof(expected), (pad == '0') ? "%0*" PRIu32 : "%*" PRIu32, width, value);
+    snprintf(what, sizeof(what), "uint %" PRIu32 " %u '%c'", value, width, pad);
+    test_compare(what, out, format_uint(out, out + size, value, width, pad), expected, length, size);
+}
+
+// snprintf has no fixed point conversion: sign, integer part and truncated fraction are printed separately, then aligned
+static void test_fixed(int32_t value, uint8_t scale, uint8_t decimals, uint8_t width, size_t size)
+{
+    char     number[TEST_BUFFER_SIZE];
+    char     expected[TEST_BUFFER_SIZE];
+    char     out[TEST_BUFFER_SIZE];
+    char     what[48];
+    uint32_t divisor   = 1;
+    uint32_t shown     = 1;
+    uint32_t magnitude = (value < 0) ? -(uint32_t)value : (uint32_t)value;
+    for (uint8_t i = 0; i < scale; i++) {
+        divisor *= 10;
+    }
+    for (uint8_t i = decimals; i < scale; i++) {
+        shown *= 10;
+    }
+    if (decimals) {
+        snprintf(number, sizeof(number), "%s%" PRIu32 ".%0*" PRIu32, (value < 0) ? "-" : "", magnitude / divisor, decimals,
+            magnitude % divisor / shown);
+    } else {
+        snprintf(number, sizeof(number), "%s%" PRIu32, (value < 0) ? "-" : "", magnitude / divisor);
+    }
+    int length = snprintf(expected, sizeof(expected), "%*s", width, number);
+    snprintf(what, sizeof(what), "fixed %" PRId32 " %u.%u %u", value, scale, decimals, width);
+    test_compare(what, out, format_fixed(out, out + size, value, scale, decimals, width), expected, length, size);
+}
+
+static void test_hex(uint32_t value, uint8_t digits, size_t size)
+{
+    char     expected[TEST_BUFFER_SIZE];
+    char     out[TEST_BUFFER_SIZE];
+    char     what[48];
+    uint32_t shown  = (digits < 8) ? value & ((1UL << (digits * 4)) - 1) : value;
+    int      length = snprintf(expected, sizeof(expected), "%0*" PRIX32, digits, shown);
+    snprintf(what, sizeof(what), "hex %08" PRIX32 " %u", value, digits);
+    test_compare(what, out, format_hex(out, out + size, value, digits), expected, length, size);
+}
+
+// All the conversions of a value, in full and truncated at every buffer size
+static void test_value(int32_t value)
+{
+    for (size_t size = 1; size <= TEST_BUFFER_SIZE; size++) {
+        for (uint8_t width = 0; width <= 13; width += (width < 3) ? 1 : 5) {
+            test_int(value, width, ' ', size);
+            test_int(value, width, '0', size);
+            test_uint((uint32_t)value, width, ' ', size);
+            test_uint((uint32_t)value, width, '0', size);
+            test_fixed(value, 2, 2, width, size);
+        }
+        test_fixed(value, 4, 4, 0, size);
+        test_fixed(value, 7, 5, 0, size);
+        test_fixed(value, 7, 0, 4, size);
+        test_fixed(value, 0, 0, 6, size);
+        test_hex((uint32_t)value, 2, size);
+        test_hex((uint32_t)value, 8, size);
+    }
+}
+
+// Cases named in the formatter contract, with their expected text
+static void test_expected(const char* what, const char* out, const char* end, const char* expected, bool truncated)
+{
+    test_checks++;
+    if (strcmp(out, expected) != 0 || (end == NULL) != truncated) {
+        printf("FAIL %s: \"%s\" instead of \"%s\"%s\n", what, out, expected, truncated ? " and NULL" : "");
+        test_failures++;
+    }
+}
+
+static void test_edges()
+{
+    char out[12];
+    test_expected("INT32_MIN", out, format_int(out, FORMAT_END(out), INT32_MIN, 0, ' '), "-2147483648", false);
+    test_expected("INT32_MIN hundredths", out, format_hundredths(out, FORMAT_END(out), INT32_MIN), "-21474836.4", true);
+    test_expected("'0' padding after the sign", out, format_int(out, FORMAT_END(out), -42, 6, '0'), "-00042", false);
+    test_expected("' ' padding before the sign", out, format_int(out, FORMAT_END(out), -42, 6, ' '), "   -42", false);
+    test_expected("truncated", out, format_int(out, out + 4, 12345, 0, ' '), "123", true);
+    test_expected("exact fit", out, format_int(out, out + 6, 12345, 0, ' '), "12345", false);
+    test_expected("no room", out, format_char(out, out + 1, 'x'), "", true);
+}
+
+// A chain stops at the first overflow and leaves what was written before it
+static void test_chain()
+{
+    char  out[8];
+    char* end = format_string(out, FORMAT_END(out), "ab");
+    end       = format_int(format_char(end, FORMAT_END(out), ','), FORMAT_END(out), -12345, 0, ' ');
+    test_checks++;
+    if (end != NULL || strcmp(out, "ab,-123") != 0) {
+        printf("FAIL chain: \"%s\"\n", out);
+        test_failures++;
+    }
+    test_checks++;
+    if (format_string(format_hundredths(end, FORMAT_END(out), 5), FORMAT_END(out), "x") != NULL || strcmp(out, "ab,-123") != 0) {
+        printf("FAIL chain after NULL: \"%s\"\n", out);
+        test_failures++;
+    }
+}
+
+static double bench_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+// Time per call of the display formats, the snprintf versions are those the menus used
+#define BENCH(name, snprintf_call, format_call)                                                             \
+    do {                                                                                                    \
+        char   buffer[TEST_BUFFER_SIZE];                                                                    \
+        double start = bench_now();                                                                         \
+        for (int32_t i = 0; i < BENCH_CALLS; i++) {                                                         \
+            int32_t value = i * 7919 - BENCH_CALLS;                                                         \
+            snprintf_call;                                                                                  \
+            bench_sink += buffer[0];                                                                        \
+        }                                                                                                   \
+        double middle = bench_now();                                                                        \
+        for (int32_t i = 0; i < BENCH_CALLS; i++) {                                                         \
+            int32_t value = i * 7919 - BENCH_CALLS;                                                         \
+            format_call;                                                                                    \
+            bench_sink += buffer[0];                                                                        \
+        }                                                                                                   \
+        double stop = bench_now();                                                                          \
+        printf("%-12s %8.1f %8.1f\n", name, (middle - start) / BENCH_CALLS, (stop - middle) / BENCH_CALLS); \
+    } while (0)
+
+static volatile uint32_t bench_sink;
+
+static void bench()
+{
+    printf("ns per call  snprintf   format\n");
+    BENCH("%ld", snprintf(buffer, sizeof(buffer), "%" PRId32, value), format_int(buffer, FORMAT_END(buffer), value, 0, ' '));
+    BENCH("%03ld", snprintf(buffer, sizeof(buffer), "%03" PRId32, value % 1000),
+        format_int(buffer, FORMAT_END(buffer), value % 1000, 3, '0'));
+    BENCH("%ld.%02ld", snprintf(buffer, sizeof(buffer), "%" PRId32 ".%02" PRId32, value / 100, (value < 0 ? -value : value) % 100),
+        format_hundredths(buffer, FORMAT_END(buffer), value));
+    BENCH("degrees", snprintf(buffer, sizeof(buffer), "%" PRId32 ".%07" PRId32, value / 10000000, (value < 0 ? -value : value) % 10000000),
+        format_degrees(buffer, FORMAT_END(buffer), value, 7));
+}
+
+int main()
+{
+    for (uint32_t i = 0; i < TEST_VALUE_COUNT; i++) {
+        test_value(test_values[i]);
+    }
+    uint32_t seed = 1;
+    for (uint32_t i = 0; i < TEST_RANDOM_VALUES; i++) {
+        seed = seed * 1103515245 + 12345;
+        // Spread over all magnitudes
+        test_value((int32_t)seed >> (seed % 31));
+    }
+    test_edges();
+    test_chain();
+    printf("%d checks, %d failed\n", test_checks, test_failures);
+    bench();
+    return test_failures ? 1 : 0;
+}
@@ -0,0 +1,92 @@
+#include "casic.h"
+#include "ubx.h"
+#include <stdio.h>
+#include <string.h>
+
+// UBX and CASIC framers fed from one stream as gps_read() does: sync bytes of one protocol inside a frame
+// of the other (length, payload, checksum) must stay with that frame
+
+extern uint8_t gps_stub_sent[];
+extern size_t  gps_stub_sent_length;
+
+static int test_failures = 0;
+
+#define TEST_CHECK(condition, ...)                      \
+    do {                                                \
+        if (!(condition)) {                             \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__);                        \
+            printf("\n");                               \
+            test_failures++;                            \
+        }                                               \
+    } while (0)
+
+// Same dispatch as gps_read(), returns the number of bytes left to the NMEA framer
+static size_t test_feed(const uint8_t* data, size_t length)
+{
+    size_t nmea = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (!ubx_ingest(data[i]) && !casic_ingest(data[i])) {
+            nmea++;
+        }
+    }
+    return nmea;
+}
+
+static void test_put_u32(uint8_t* p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+// CFG-TP read back with 'fill' in every payload byte but the interval, which holds UBX sync bytes
+static void test_casic_frame(uint8_t fill)
+{
+    uint8_t payload[16];
+    memset(payload, fill, sizeof(payload));
+    test_put_u32(payload, 0x62B562B5);
+    casic_send(CASIC_CLASS_CFG, CASIC_CFG_TP, payload, sizeof(payload));
+
+    uint32_t good     = casic_stats.good;
+    uint32_t ubx_good = ubx_stats.good + ubx_stats.bad_checksum + ubx_stats.overlong;
+    size_t   nmea     = test_feed((const uint8_t*)"$GPGGA,1*00\r\n", 13);
+    nmea             += test_feed(gps_stub_sent, gps_stub_sent_length);
+    TEST_CHECK(nmea == 13, "fill %02X: %u bytes given to NMEA instead of 13", fill, (unsigned)nmea);
+    TEST_CHECK(casic_stats.good == good + 1, "fill %02X: CASIC frame lost", fill);
+    TEST_CHECK(casic_config.tp_interval == 0x62B562B5, "fill %02X: interval %08X", fill, (unsigned)casic_config.tp_interval);
+    TEST_CHECK(ubx_stats.good + ubx_stats.bad_checksum + ubx_stats.overlong == ubx_good, "fill %02X: UBX framer took CASIC bytes", fill);
+    TEST_CHECK(ubx_idle() && casic_idle(), "fill %02X: framer left mid-frame", fill);
+}
+
+// TIM-TP with CASIC sync bytes in the quantization error
+static void test_ubx_frame(uint8_t fill)
+{
+    uint8_t payload[16];
+    memset(payload, fill, sizeof(payload));
+    test_put_u32(payload + 8, 0xCEBACEBA);
+    payload[14] = 0;
+    ubx_send(UBX_CLASS_TIM, UBX_TIM_TP, payload, sizeof(payload));
+
+    uint32_t good       = ubx_stats.good;
+    uint32_t casic_seen = casic_stats.good + casic_stats.bad_checksum + casic_stats.overlong;
+    size_t   nmea       = test_feed(gps_stub_sent, gps_stub_sent_length);
+    TEST_CHECK(nmea == 0, "fill %02X: %u UBX bytes given to NMEA", fill, (unsigned)nmea);
+    TEST_CHECK(ubx_stats.good == good + 1, "fill %02X: UBX frame lost", fill);
+    TEST_CHECK(ubx_last_qerr == (int32_t)0xCEBACEBA, "fill %02X: qErr %08X", fill, (unsigned)ubx_last_qerr);
+    TEST_CHECK(casic_stats.good + casic_stats.bad_checksum + casic_stats.overlong == casic_seen, "fill %02X: CASIC framer took UBX bytes",
+        fill);
+    TEST_CHECK(ubx_idle() && casic_idle(), "fill %02X: framer left mid-frame", fill);
+}
+
+int main()
+{
+    // Every byte value in the payload, so that the checksums also go through the sync values
+    for (uint32_t fill = 0; fill <= 0xFF; fill++) {
+        test_casic_frame(fill);
+        test_ubx_frame(fill);
+    }
+    printf("%s\n", test_failures ? "FAILED" : "OK");
+    return test_failures ? 1 : 0;
+}
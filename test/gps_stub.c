@@ -0,0 +1,30 @@
+#include "bridge.h"
+#include "gps.h"
+#include <string.h>
+
+// Host stand-ins for what the binary framers use from gps.c and bridge.c: frames sent to the module are kept for the test
+
+volatile int32_t gps_pps_qerr       = 0;
+volatile bool    gps_pps_qerr_valid = false;
+
+uint8_t  gps_stub_sent[128];
+size_t   gps_stub_sent_length = 0;
+uint32_t gps_stub_acks        = 0;
+
+bool bridge_send_to_gps(const uint8_t* data, size_t len)
+{
+    if (len > sizeof(gps_stub_sent)) {
+        return false;
+    }
+    memcpy(gps_stub_sent, data, len);
+    gps_stub_sent_length = len;
+    return true;
+}
+
+void gps_command_acknowledged(uint8_t msg_class, uint8_t msg_id, bool ack)
+{
+    (void)msg_class;
+    (void)msg_id;
+    (void)ack;
+    gps_stub_acks++;
+}
@@ -0,0 +1,138 @@
+#include "trend.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// Cost of a trend screen redraw with auto-V, before and after the pre-aggregated tiers: every second one value is added,
+// then the screen range and its 40 points are read, as menu_draw_trend() does. Fails if the trend store is slower at any scale
+
+#define BENCH_HISTORY   7208    // Seconds recorded before timing (size of the former ring)
+#define BENCH_REDRAWS   2000    // Redraws timed per round
+#define BENCH_ROUNDS    5       // Best round is kept, to get rid of scheduling noise
+
+// Former store (menu.c before the tiers): one raw value per second in a ring, a point averages h_scale values
+#define LEGACY_SIZE     7208
+#define LEGACY_UNSET    0xFFFF
+
+static uint16_t          legacy_values[LEGACY_SIZE];
+static uint32_t          legacy_position = 0;
+static uint32_t          legacy_reads    = 0;
+static volatile int32_t  bench_sink;
+
+static void legacy_add(uint16_t value)
+{
+    legacy_values[legacy_position] = value;
+    legacy_position                = (legacy_position + 1) % LEGACY_SIZE;
+}
+
+static uint32_t legacy_data(uint32_t index)
+{
+    int32_t read_index = (int32_t)(legacy_position + index);
+    if (read_index < 0) {
+        read_index += LEGACY_SIZE;
+    }
+    legacy_reads++;
+    return legacy_values[read_index];
+}
+
+static uint32_t legacy_value(uint32_t position, uint32_t shift, uint32_t h_scale)
+{
+    if (h_scale == 1) {
+        return legacy_data(position - TREND_SCREEN_SIZE - shift);
+    }
+    uint32_t result = 0;
+    for (uint32_t i = 0; i < h_scale; i++) {
+        uint32_t value = legacy_data((position * h_scale) + i - (TREND_SCREEN_SIZE * h_scale) - (legacy_position % h_scale) - shift);
+        if (value == LEGACY_UNSET) {
+            return LEGACY_UNSET;
+        }
+        result += value;
+    }
+    return result / h_scale;
+}
+
+static void legacy_redraw(uint32_t h_scale)
+{
+    uint32_t peak = 0;
+    for (uint32_t position = 0; position < TREND_SCREEN_SIZE; position++) {
+        uint32_t value = legacy_value(position, 0, h_scale);
+        if (value != LEGACY_UNSET && value > peak) {
+            peak = value;
+        }
+    }
+    int32_t sum = peak;
+    for (uint32_t position = 0; position < TREND_SCREEN_SIZE; position++) {
+        sum += legacy_value(position, 0, h_scale);
+    }
+    bench_sink = sum;
+}
+
+static void trend_redraw(uint32_t h_scale)
+{
+    const trend_screen_t* screen = trend_get_screen(TREND_CHANNEL_PPB, 0, h_scale);
+    int32_t               sum    = screen->set ? screen->max : 0;
+    for (uint32_t position = 0; position < TREND_SCREEN_SIZE; position++) {
+        if (screen->points[position].mean != TREND_UNSET_VALUE) {
+            sum += screen->points[position].mean;
+        }
+    }
+    bench_sink = sum;
+}
+
+// Noisy PPB x100 values around a slow drift
+static int16_t bench_sample()
+{
+    static uint32_t seed  = 1;
+    static int32_t  drift = 0;
+    seed = seed * 1103515245 + 12345;
+    if ((seed >> 16) % 64 == 0) {
+        drift += ((seed >> 8) & 1) ? 1 : -1;
+    }
+    return 500 + drift + (int32_t)((seed >> 16) % 7) - 3;
+}
+
+static double bench_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+int main()
+{
+    trend_init();
+    for (uint32_t i = 0; i < BENCH_HISTORY; i++) {
+        int16_t value = bench_sample();
+        legacy_add(value);
+        trend_add(TREND_CHANNEL_PPB, value);
+    }
+
+    int failures = 0;
+    printf("h_scale  legacy ns  legacy reads  trend ns\n");
+    for (uint32_t h_scale = 1; h_scale <= 64; h_scale *= 2) {
+        double legacy_time = 0, trend_time = 0;
+        for (int round = 0; round < BENCH_ROUNDS; round++) {
+            legacy_reads = 0;
+            double start = bench_now();
+            for (uint32_t i = 0; i < BENCH_REDRAWS; i++) {
+                legacy_add(bench_sample());
+                legacy_redraw(h_scale);
+            }
+            double time = (bench_now() - start) / BENCH_REDRAWS;
+            legacy_time = (round == 0 || time < legacy_time) ? time : legacy_time;
+
+            start = bench_now();
+            for (uint32_t i = 0; i < BENCH_REDRAWS; i++) {
+                trend_add(TREND_CHANNEL_PPB, bench_sample());
+                trend_redraw(h_scale);
+            }
+            time       = (bench_now() - start) / BENCH_REDRAWS;
+            trend_time = (round == 0 || time < trend_time) ? time : trend_time;
+        }
+        bool slower = trend_time > legacy_time;
+        printf("%7u  %9.0f  %12u  %8.0f%s\n", (unsigned)h_scale, legacy_time, (unsigned)(legacy_reads / BENCH_REDRAWS), trend_time,
+            slower ? "  SLOWER" : "");
+        failures += slower;
+    }
+    return failures ? 1 : 0;
+}
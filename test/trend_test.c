@@ -0,0 +1,231 @@
+// The block internals are checked, so the store is built in this file
+#include "trend.c"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Seconds tier codec: every second still held decodes to the value added, the blocks never overflow
+// and the PPB capture keeps more history than raw 16 bit values in the same RAM.
+// Gaps restored from the trend log leave the tiers as the same unset buckets pushed one by one
+
+#define TEST_MAX_VALUES 20000
+// Lowest compression ratio accepted on the capture (raw bytes / block and index bytes)
+#define TEST_MIN_RATIO  2.8
+
+static int16_t  test_values[TEST_MAX_VALUES];
+static uint32_t test_count    = 0;
+static int      test_failures = 0;
+
+#define TEST_CHECK(condition, ...)                      \
+    do {                                                \
+        if (!(condition)) {                             \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__);                        \
+            printf("\n");                               \
+            test_failures++;                            \
+        }                                               \
+    } while (0)
+
+static bool test_load(const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        printf("Can't open %s\n", path);
+        return false;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), file) && test_count < TEST_MAX_VALUES) {
+        if (line[0] != '#' && line[0] != '\n') {
+            test_values[test_count++] = (int16_t)atoi(line);
+        }
+    }
+    fclose(file);
+    return test_count > 0;
+}
+
+// Value of a second as read back at 1 s per point, 'back' seconds before the last one added
+static bool test_read(uint32_t back, int16_t* value)
+{
+    trend_point_t point;
+    bool          set = trend_get_point(TREND_CHANNEL_PPB, TREND_SCREEN_SIZE - 1, back, 1, &point);
+    *value            = set ? point.mean : TREND_UNSET_VALUE;
+    return set;
+}
+
+// Add 'count' values, checking each one as soon as it is added, then every second still held in both read directions
+static void test_round_trip(const int16_t* values, uint32_t count)
+{
+    int16_t value;
+    trend_init();
+    for (uint32_t i = 0; i < count; i++) {
+        trend_add(TREND_CHANNEL_PPB, values[i]);
+        test_read(0, &value);
+        TEST_CHECK(value == values[i], "second %u: added %d, read %d", (unsigned)i, values[i], value);
+    }
+    uint32_t held = trend_seconds_available(&trend_ppb);
+    TEST_CHECK(held <= count, "%u seconds held out of %u", (unsigned)held, (unsigned)count);
+    for (uint32_t back = 0; back < held; back++) {
+        test_read(back, &value);
+        TEST_CHECK(value == values[count - 1 - back], "%u s back: added %d, read %d", (unsigned)back, values[count - 1 - back], value);
+    }
+    for (uint32_t back = held; back-- > 0;) {
+        test_read(back, &value);
+        TEST_CHECK(value == values[count - 1 - back], "%u s back: added %d, read %d", (unsigned)back, values[count - 1 - back], value);
+    }
+    TEST_CHECK(!test_read(held, &value), "second %u s back should have been overwritten", (unsigned)held);
+    for (uint32_t block = trend_oldest_block(&trend_ppb); block < trend_ppb.block_count; block++) {
+        TEST_CHECK(trend_ppb.block_index[block % TREND_BLOCKS].length <= TREND_BLOCK_NIBBLES, "block %u overflows", (unsigned)block);
+    }
+}
+
+// Envelope of the set points of a screen matches its range
+static bool test_envelope(const trend_screen_t* screen)
+{
+    bool    set = false;
+    int32_t min = 0, max = 0;
+    for (uint32_t position = 0; position < TREND_SCREEN_SIZE; position++) {
+        const trend_screen_point_t* point = &screen->points[position];
+        if (point->mean != TREND_UNSET_VALUE) {
+            min = (!set || point->min < min) ? point->min : min;
+            max = (!set || point->max > max) ? point->max : max;
+            set = true;
+        }
+    }
+    return set == screen->set && (!set || (min == screen->min && max == screen->max));
+}
+
+// Screen kept up to date second by second against the same screen read from scratch, at each scale and near the end of the history
+static void test_screen(const int16_t* values, uint32_t count)
+{
+    for (uint32_t h_scale = 1; h_scale <= TREND_MAX_H_SCALE; h_scale *= 4) {
+        for (uint32_t shift = 0; shift <= 800; shift += 400) {
+            trend_init();
+            for (uint32_t i = 0; i < count * ((h_scale > 64) ? 2 : 1); i++) {
+                trend_add(TREND_CHANNEL_PPB, values[i % count]);
+                trend_screen_t kept = *trend_get_screen(TREND_CHANNEL_PPB, shift, h_scale);
+                // Another view, so that the next read starts from scratch
+                trend_get_screen(TREND_CHANNEL_PPB, shift + 1, h_scale);
+                const trend_screen_t* fresh = trend_get_screen(TREND_CHANNEL_PPB, shift, h_scale);
+                bool same = test_envelope(&kept) && test_envelope(fresh) && memcmp(kept.points, fresh->points, sizeof(kept.points)) == 0;
+                TEST_CHECK(same, "scale %u shift %u second %u: updated screen differs from a fresh read", (unsigned)h_scale, (unsigned)shift,
+                    (unsigned)i);
+                if (!same) {
+                    return;
+                }
+            }
+        }
+    }
+}
+
+// Each code of the nibble encoding, at its limits for the PPB step (11.16): +/-6 steps, 7 steps, -4 steps - 1, 3 steps + 1,
+// 4 steps - 1, 1 step + 2, 8 bit delta limits, 1 more or less
+static void test_codes()
+{
+    static const int16_t values[] = { TREND_UNSET_VALUE, 0, 67, 0, 78, 32, 66, 110, 123, -5, 123, 134, 135, 134, TREND_UNSET_VALUE,
+        TREND_UNSET_VALUE, 5, TREND_MAX_VALUE, -TREND_MAX_VALUE, TREND_MAX_VALUE, TREND_MAX_VALUE - 1, 0, -128, -256, TREND_UNSET_VALUE, 1 };
+    int16_t repeated[TREND_BLOCKS * TREND_BLOCK_NIBBLES];
+    for (uint32_t i = 0; i < sizeof(repeated) / sizeof(repeated[0]); i++) {
+        repeated[i] = values[i % (sizeof(values) / sizeof(values[0]))];
+    }
+    test_round_trip(repeated, sizeof(repeated) / sizeof(repeated[0]));
+    test_screen(repeated, sizeof(repeated) / sizeof(repeated[0]));
+}
+
+// Tiers after a restored gap, compared on the buckets still held
+typedef struct {
+    trend_bucket_t buckets[(TREND_TIERS - 1) * TREND_TIER_SIZE];
+    uint32_t       counts[TREND_TIERS];
+    bool           pending_set[TREND_TIERS - 1];
+    uint32_t       restored;
+} test_tiers_t;
+
+static void test_gap(uint32_t gap)
+{
+    static test_tiers_t  expected;
+    const trend_bucket_t set   = { 100, 50, 150, TREND_FULL_WEIGHT };
+    const trend_bucket_t unset = { TREND_UNSET_VALUE, TREND_UNSET_VALUE, TREND_UNSET_VALUE, 0 };
+    for (int pass = 0; pass < 2; pass++) {
+        trend_init();
+        trend_restore_start(TREND_LOG_TIER);
+        // An odd number of buckets, so that the gap starts with half a bucket pending in the next tier
+        for (int i = 0; i < 3; i++) {
+            trend_restore(TREND_LOG_TIER, &set);
+        }
+        if (pass == 0) {
+            for (uint32_t i = 0; i < gap; i++) {
+                trend_restore(TREND_LOG_TIER, &unset);
+            }
+        } else {
+            trend_restore_gap(TREND_LOG_TIER, gap);
+        }
+        trend_restore(TREND_LOG_TIER, &set);
+        if (pass == 0) {
+            memcpy(expected.buckets, trend_ppb_buckets, sizeof(expected.buckets));
+            memcpy(expected.counts, trend_ppb_counts, sizeof(expected.counts));
+            memcpy(expected.pending_set, trend_ppb_pending_set, sizeof(expected.pending_set));
+            expected.restored = trend_ppb.restored;
+            continue;
+        }
+        TEST_CHECK(memcmp(expected.counts, trend_ppb_counts, sizeof(expected.counts)) == 0, "gap %u: bucket counts differ", (unsigned)gap);
+        TEST_CHECK(memcmp(expected.pending_set, trend_ppb_pending_set, sizeof(expected.pending_set)) == 0, "gap %u: pending buckets differ",
+            (unsigned)gap);
+        TEST_CHECK(expected.restored == trend_ppb.restored, "gap %u: %u s restored instead of %u", (unsigned)gap, (unsigned)trend_ppb.restored,
+            (unsigned)expected.restored);
+        for (uint8_t tier = TREND_LOG_TIER; tier < TREND_TIERS; tier++) {
+            uint32_t count = expected.counts[tier];
+            for (uint32_t index = (count > TREND_TIER_SIZE) ? count - TREND_TIER_SIZE : 0; index < count; index++) {
+                uint32_t slot = (tier - 1) * TREND_TIER_SIZE + index % TREND_TIER_SIZE;
+                TEST_CHECK(memcmp(&expected.buckets[slot], &trend_ppb_buckets[slot], sizeof(trend_bucket_t)) == 0,
+                    "gap %u: bucket %u of tier %u differs", (unsigned)gap, (unsigned)index, tier);
+            }
+        }
+    }
+}
+
+static void test_gaps()
+{
+    static const uint32_t gaps[] = { 0, 1, 2, 47, 48, 49, 50, 51, 97, 98, 99, 1000, 12345, 600000, 3000000 };
+    for (uint32_t i = 0; i < sizeof(gaps) / sizeof(gaps[0]); i++) {
+        test_gap(gaps[i]);
+    }
+}
+
+static void test_capture(const char* path)
+{
+    if (!test_load(path)) {
+        test_failures++;
+        return;
+    }
+    test_round_trip(test_values, test_count);
+    test_screen(test_values, test_count);
+
+    uint32_t held        = trend_seconds_available(&trend_ppb);
+    uint32_t first_block = trend_oldest_block(&trend_ppb);
+    uint32_t blocks      = trend_ppb.block_count - first_block;
+    uint32_t nibbles     = 0;
+    for (uint32_t block = first_block; block < trend_ppb.block_count; block++) {
+        nibbles += trend_ppb.block_index[block % TREND_BLOCKS].length;
+    }
+    // Data actually used (plus the first value of each block) and the RAM of the seconds tier
+    double used  = nibbles / 2.0 + blocks * sizeof(int16_t);
+    size_t ram   = sizeof(trend_ppb_blocks) + sizeof(trend_ppb_block_index);
+    double ratio = held * sizeof(int16_t) / (double)ram;
+    printf("Capture: %u s, %u s held in %u blocks (%.2f nibbles per second, %.0f%% of the block data used)\n", (unsigned)test_count,
+        (unsigned)held, (unsigned)blocks, nibbles / (double)(held - blocks), 100.0 * nibbles / (blocks * TREND_BLOCK_NIBBLES));
+    printf("Compression: %.2f bytes per second of data, ratio %.2f against raw values in the same %u bytes of RAM\n",
+        used / held, ratio, (unsigned)ram);
+    TEST_CHECK(blocks == TREND_BLOCKS, "capture should fill all the blocks, %u used", (unsigned)blocks);
+    TEST_CHECK(ratio >= TEST_MIN_RATIO, "ratio %.2f below %.2f", ratio, TEST_MIN_RATIO);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 2) {
+        printf("Usage: %s <ppb capture>\n", argv[0]);
+        return 2;
+    }
+    test_codes();
+    test_gaps();
+    test_capture(argv[1]);
+    printf("%s\n", test_failures ? "FAILED" : "OK");
+    return test_failures ? 1 : 0;
+}